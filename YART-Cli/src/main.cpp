@@ -73,6 +73,37 @@ int main(int argc, char** argv)
 	using Scene = yart::Scene<RGBSpectrum>;
 
 	yart::Initialize();
+
+	// --threads N limits rendering and acceleration structure builds to N threads, by default every core is used
+	// --pass-spp N renders progressively in passes of N samples per pixel, writing the image after every pass
+	// --time-budget S stops a progressive render before a pass that would not finish within S seconds
+	// --error-threshold E stops sampling pixels once the relative standard error of their luminance is below E
+	// --average-spp N spends N samples per pixel on average with --error-threshold, favoring noisy pixels
+	// --stats writes the aggregate statistics and traversal counters of the render as JSON next to the image
+	ProgressiveParameters progressive;
+	AdaptiveParameters adaptive;
+	bool writeStatistics = false;
+	for (i32 i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if ((argument == "--threads" || argument == "-t") && i + 1 < argc)
+			SetNumThreads(std::max(0, std::atoi(argv[++i])));
+		else if (argument == "--pass-spp" && i + 1 < argc)
+		{
+			progressive.m_SamplesPerPass = std::max(0, std::atoi(argv[++i]));
+			progressive.m_WritePasses = true;
+		}
+		else if (argument == "--time-budget" && i + 1 < argc)
+			progressive.m_TimeBudget = std::max(0.0, std::atof(argv[++i]));
+		else if (argument == "--error-threshold" && i + 1 < argc)
+			adaptive.m_ErrorThreshold = std::max(0.0, std::atof(argv[++i]));
+		else if (argument == "--average-spp" && i + 1 < argc)
+			adaptive.m_SamplesPerPixel = std::max(0, std::atoi(argv[++i]));
+		else if (argument == "--stats")
+			writeStatistics = true;
+	}
+	LOG_INFO("Rendering with {} threads", NumThreads());
+
 	const i32 x = 320, y = 320, spp = 20;
 
 	Bounds2f cropWindow{{0, 0}, {1, 1}};
@@ -92,6 +123,9 @@ int main(int argc, char** argv)
 	Scene scene(spherePrimitive);
 
 	TestIntegrator<RGBSpectrum> integrator(camera, sampler);
+	integrator.SetProgressiveParameters(progressive);
+	integrator.SetAdaptiveParameters(adaptive);
+	integrator.SetWriteStatistics(writeStatistics);
 	integrator.Render(scene);
 
 	return 0;
@@ -1,21 +1,90 @@
 #pragma once
 #include "core/memoryutil.h"
+#include "core/parallel.h"
 #include "core/primitive.h"
+#include "core/statistics.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 namespace yart
 {
     enum class SplitMethod
     {
-        // SAH,
-        // HLBVH,
+        SAH,
+        HLBVH,
         Middle,
         EqualCounts,
+        SBVH,
         COUNT
     };
 
     extern const char* const SplitMethodNames[];
 
+    // Node layout traversed by BVHAccelerator::IntersectRay(). The wide layouts are collapsed from the binary tree after it has
+    // been built and test all children of a node with a single SIMD slab test. The compressed layout keeps the binary topology
+    // but quantizes child bounds to 8 bits, shrinking nodes from 32 to 16 bytes. The clustered layout also keeps the binary
+    // topology, but reorders the nodes so that the treelets most likely to be traversed together share a block of memory. The
+    // wide layouts keep the binary nodes for Refit(), packets and streams, so their nodes come on top of the binary ones. The
+    // compressed and clustered layouts replace the binary nodes and trace the rays of packets and streams one at a time. Trees
+    // too deep for the traversal stack keep only the binary nodes, whichever layout was selected
+    enum class BVHLayout
+    {
+        Binary,
+        Wide4,
+        Wide8,
+        Compressed,
+        Clustered,
+        COUNT
+    };
+
+    extern const char* const BVHLayoutNames[];
+
+    // Cost model used by SplitMethod::SAH and SplitMethod::SBVH. Costs are relative, only their ratio affects the shape of the
+    // tree
+    struct BVHBuildParameters
+    {
+        i32 m_NumBuckets = 12;        // Number of bins the centroid bounds are split into along the split axis
+        real m_TraversalCost = 0.125; // Cost of visiting an interior node
+        real m_IntersectionCost = 1;  // Cost of a single ray-primitive intersection test
+
+        // SplitMethod::SBVH may duplicate up to this fraction of the primitives into both children of a spatial split, and
+        // only looks for spatial splits where the children of the best object split overlap by more than this fraction of the
+        // surface area of the whole scene
+        real m_SpatialSplitBudget = 0.3;
+        real m_SpatialSplitOverlap = 1e-5;
+
+        // Subtrees over at least this many primitives are built and flattened on separate threads
+        i32 m_ParallelBuildThreshold = 16384;
+
+        BVHLayout m_Layout = BVHLayout::Binary;
+
+        // Size in bytes of the blocks BVHLayout::Clustered fills with treelets, a cache line or a page are sensible choices. Has
+        // to be a power of two, the nodes are allocated aligned to it so that every block starts on a block boundary
+        i32 m_ClusterBlockSize = 4096;
+
+        // Prefetch the node visited after the near subtree while traversing the binary and clustered layouts
+        bool m_PrefetchFarChild = false;
+
+        // Traverse the binary layout with links to the parent of every node instead of a stack of pending nodes, at the cost of
+        // 4 bytes per node and revisiting interior nodes on the way up. Trees too deep for the traversal stack always do this,
+        // and do not build the selected layout
+        bool m_StacklessTraversal = false;
+
+        // Test the primitive that blocked the previous occlusion query of a thread before traversing the tree
+        bool m_CacheLastOccluder = true;
+
+        // Store complete spheres inline in flat arrays and intersect them from their world space centers and radii instead of
+        // calling into their primitives. Hits are found in world space, so their distances can differ from the ones
+        // Sphere::IntersectRay() finds by rounding
+        bool m_InlineSpheres = false;
+
+        // If set, flattened trees are saved to and mapped back from files in this directory, keyed by a hash of the primitive
+        // bounds and the parameters that affect the shape of the tree
+        std::string m_CacheDirectory;
+    };
+
     struct BVHBuildNode
     {
         void InitLeaf(i32 firstPrimOffset, i32 numPrimitives, const Bounds3f& bounds)
@@ -24,6 +93,7 @@ namespace yart
             m_NumPrimitives = numPrimitives;
             m_Bounds = bounds;
             m_Children[0] = m_Children[1] = nullptr;
+            m_NumNodes = 1;
         }
 
         void InitInterior(i32 splitAxis, BVHBuildNode* c1, BVHBuildNode* c2)
@@ -33,6 +103,7 @@ namespace yart
             m_Bounds = Union(c1->m_Bounds, c2->m_Bounds);
             m_SplitAxis = splitAxis;
             m_NumPrimitives = 0;
+            m_NumNodes = 1 + c1->m_NumNodes + c2->m_NumNodes;
         }
 
         inline bool IsInteriorNode() const
@@ -43,8 +114,14 @@ namespace yart
         Bounds3f m_Bounds;
         BVHBuildNode* m_Children[2];
         i32 m_SplitAxis, m_FirstPrimOffset, m_NumPrimitives;
+        i32 m_NumNodes; // Number of nodes in the subtree rooted at this node
     };
 
+    // Turns subtrees of at most maxPrimsInNode primitives into single leaves wherever intersecting all of their primitives is
+    // expected to be cheaper than traversing the subtree under the SAH cost model. A subtree is only collapsed if its leaves
+    // cover a contiguous range of the primitive order, which every build method produces. Returns the number of nodes removed
+    i32 CollapseBVHLeaves(BVHBuildNode* root, i32 maxPrimsInNode, real traversalCost, real intersectionCost);
+
     struct BVHLinearNode
     {
         void InitFromBuildNode(const BVHBuildNode& buildNode)
@@ -52,11 +129,17 @@ namespace yart
             m_Bounds = buildNode.m_Bounds;
             m_NumPrimitives = buildNode.m_NumPrimitives;
             m_SplitAxis = buildNode.m_SplitAxis;
+            m_LargerChild = 0;
 
             if (!buildNode.IsInteriorNode())
             {
                 m_FirstPrimOffset = buildNode.m_FirstPrimOffset;
             }
+            else
+            {
+                m_LargerChild =
+                    buildNode.m_Children[1]->m_Bounds.SurfaceArea() > buildNode.m_Children[0]->m_Bounds.SurfaceArea();
+            }
         }
 
         inline bool IsInteriorNode() const
@@ -72,8 +155,238 @@ namespace yart
         };
         u16 m_NumPrimitives; // 0: Interior node
         u8 m_SplitAxis;
+        u8 m_LargerChild; // Interior node: 1 if the second child has the larger surface area
+    };
+
+    // Complete spheres among the primitives of the tree. The spheres of a leaf are moved to the front of its range of the
+    // primitive order and their world space centers and radii are kept in SoA arrays indexed like the primitive order, so the
+    // spheres of a leaf are contiguous in every array and are intersected without touching their primitives
+    template <typename Spectrum>
+    struct BVHFlatSpheres
+    {
+        std::vector<u8> m_NumLeafSpheres; // Indexed by the first primitive offset of a leaf, the spheres it starts with
+        std::vector<real> m_CenterX;
+        std::vector<real> m_CenterY;
+        std::vector<real> m_CenterZ;
+        std::vector<real> m_RadiusSquared;
+        std::vector<const Sphere*> m_Spheres; // nullptr for the primitives that are not spheres
+        std::vector<const AbstractPrimitive<Spectrum>*> m_Primitives;
+    };
+
+    // Stores the bounds of up to Width children in SoA layout so they can be loaded straight into SIMD registers
+    template <i32 Width>
+    struct alignas(32) BVHWideNode
+    {
+        inline bool IsInteriorChild(i32 child) const
+        {
+            return m_NumPrimitives[child] == 0;
+        }
+
+        real m_Bounds[2][3][Width]; // [min/max][axis][child]
+        union
+        {
+            i32 m_FirstPrimOffset[Width]; // Leaf child
+            i32 m_ChildOffset[Width];     // Interior child, offset of its wide node
+        };
+        u16 m_NumPrimitives[Width]; // 0: Interior child
+        u8 m_NumChildren;
+    };
+
+    // Binary node in the same depth first order as BVHLinearNode. Instead of its own bounds a node stores the bounds of its two
+    // children, quantized relative to its own bounds, which are decoded from the parent during traversal
+    struct BVHCompressedNode
+    {
+        inline bool IsInteriorNode() const
+        {
+            return m_SplitAxis != 3;
+        }
+
+        union
+        {
+            u8 m_ChildBounds[2][2][3]; // Interior node, [child][min/max][axis] in 1/255ths of the node's bounds
+            u16 m_NumPrimitives;       // Leaf node
+        };
+        u32 m_Offset : 30;   // Interior node: offset of the second child, leaf node: offset of the first primitive
+        u32 m_SplitAxis : 2; // 3: Leaf node
+    };
+
+    static_assert(sizeof(BVHCompressedNode) == 16);
+
+    inline real DequantizeBound(u8 quantized, real min, real max)
+    {
+        // Lerp() is exact at both ends, so 0 and 255 decode to the bounds of the parent
+        return Lerp(quantized * ((real)1 / 255), min, max);
+    }
+
+    inline Bounds3f DequantizeBounds(const Bounds3f& parent, const u8 quantized[2][3])
+    {
+        Bounds3f bounds;
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            bounds.m_MinBound[axis] = DequantizeBound(quantized[0][axis], parent.m_MinBound[axis], parent.m_MaxBound[axis]);
+            bounds.m_MaxBound[axis] = DequantizeBound(quantized[1][axis], parent.m_MinBound[axis], parent.m_MaxBound[axis]);
+        }
+
+        return bounds;
+    }
+
+    // Quantizes every node of a flattened binary BVH, rounding outwards so that decoded bounds always contain the original ones
+    std::vector<BVHCompressedNode> CompressBVH(const BVHLinearNode* tree, i32 numNodes);
+
+    // Binary nodes with the topology of a compressed BVH and the decoded bounds of its nodes
+    std::vector<BVHLinearNode> DecompressBVH(const std::vector<BVHCompressedNode>& compressedTree, const Bounds3f& rootBounds);
+
+    // Binary node whose children are stored next to each other, which frees the layout from depth first order
+    struct BVHClusteredNode
+    {
+        inline bool IsInteriorNode() const
+        {
+            return m_NumPrimitives == 0;
+        }
+
+        Bounds3f m_Bounds;
+        union
+        {
+            i32 m_FirstPrimOffset; // Leaf node
+            i32 m_ChildOffset;     // Interior node, offset of the first child, the second child follows it
+        };
+        u16 m_NumPrimitives; // 0: Interior node
+        u8 m_SplitAxis;
+    };
+
+    // Siblings share a cache line, so the bounds of both children are loaded together. Node offsets address the pair at
+    // offset / 2, the root is the first node of the first pair and the second node of that pair is unused
+    struct alignas(YART_L1_CACHE_SIZE) BVHClusteredNodePair
+    {
+        BVHClusteredNode m_Nodes[2];
+    };
+
+    // Reorders a flattened binary BVH into blocks of blockSize bytes. Starting from the root, each block is filled with the
+    // pairs of children of the nodes with the largest surface area, since those are the most likely to be visited, and the
+    // nodes left over when a block is full become the roots of the treelets in the blocks that follow. The pairs are allocated
+    // aligned to the block size, or to a cache line if that is larger, and have to be released with FreeAligned()
+    BVHClusteredNodePair* ClusterBVH(const BVHLinearNode* tree, i32 blockSize, i32* numPairs);
+
+    // Binary nodes in depth first order with the topology and bounds of a clustered BVH of numNodes nodes
+    std::vector<BVHLinearNode> DeclusterBVH(const BVHClusteredNodePair* clusteredTree, i32 numNodes);
+
+    // Ray data shared by the slab tests of every wide node visited by a ray
+    struct BVHWideRay
+    {
+        BVHWideRay(const Ray& ray)
+            : m_Origin(ray.o), m_InvDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z),
+              m_DirIsNeg{m_InvDir.x < 0, m_InvDir.y < 0, m_InvDir.z < 0}
+        {
+        }
+
+        Vector3f m_Origin;
+        Vector3f m_InvDir;
+        i32 m_DirIsNeg[3];
+    };
+
+    // SoA copy of the rays of a packet for testing one box against four rays at a time
+    struct BVHRayPacket
+    {
+        BVHRayPacket(const Ray* rays, i32 numRays);
+
+        alignas(16) real m_Origin[3][MaxRayPacketSize];
+        alignas(16) real m_InvDir[3][MaxRayPacketSize];
+        alignas(16) real m_Tmax[MaxRayPacketSize];
+    };
+
+    // Intersects bounds with every ray of the packet selected by activeMask, returns the mask of rays that hit
+    u32 IntersectPacketBounds(const Bounds3f& bounds, const BVHRayPacket& packet, u32 activeMask);
+
+    // Orders the rays of a stream by direction octant, and within an octant by the Morton code of their origin relative to
+    // bounds. octantOffsets receives the position of the first ray of every octant in the returned order, followed by numRays
+    std::vector<i32> SortRayStream(const Ray* rays, i32 numRays, const Bounds3f& bounds, std::array<i32, 9>* octantOffsets);
+
+    // Primitive that blocked the last occlusion query of the calling thread. Shadow rays from nearby points towards the same
+    // light tend to be blocked by the same primitive, so it is worth testing before any node
+    struct BVHLastOccluder
+    {
+        const void* m_Accelerator = nullptr;
+        u64 m_PrimitiveOffset = 0;
+    };
+
+    BVHLastOccluder& LastOccluder();
+
+    // Deepest level of a tree the traversal loops can keep their pending nodes for on the stack, one per level
+    static constexpr i32 MaxBVHTraversalDepth = 64;
+
+    // Offset of the parent of every node of a flattened binary BVH, -1 for the root. depth receives the number of levels
+    std::vector<i32> BVHParentOffsets(const BVHLinearNode* tree, i32 numNodes, i32* depth);
+
+    // Shape, cost and memory use of a built tree, for tuning the split method and leaf sizes on real scenes
+    struct BVHStatistics
+    {
+        SplitMethod m_SplitMethod = SplitMethod::SAH;
+        BVHLayout m_Layout = BVHLayout::Binary; // The layout traversed, binary for trees too deep for the selected one
+        i32 m_NumNodes = 0;
+        i32 m_NumLeaves = 0;
+        i32 m_NumReferences = 0; // Primitives referenced by the leaves, spatial splits can reference a primitive more than once
+        i32 m_Depth = 0;
+        std::vector<i32> m_LeafSizeHistogram; // Entry i counts the leaves holding i primitives
+        real m_SAHCost = 0;
+        u64 m_NodeBytes = 0;       // Nodes of the binary tree and of the traversed layout derived from it
+        u64 m_BinaryNodeBytes = 0; // Nodes of the same tree in the binary layout, the layout saves the difference to m_NodeBytes
+        u64 m_TotalBytes = 0;      // Everything the accelerator keeps
     };
 
+    // Fills in the statistics that only depend on the topology of a flattened binary BVH
+    BVHStatistics BVHTreeStatistics(const BVHLinearNode* tree, i32 numNodes);
+    std::string ToJSON(const BVHStatistics& statistics);
+
+    // Collapses a flattened binary BVH into a tree of wide nodes by repeatedly opening the interior child with the largest
+    // surface area until a node has Width children
+    template <i32 Width>
+    std::vector<BVHWideNode<Width>> CollapseBVH(const BVHLinearNode* tree);
+
+    // Intersects the ray with the bounds of all children of node at once. Returns a bit mask of the children that were hit and
+    // writes the entry distance of each child to tNear
+    template <i32 Width>
+    u32 IntersectWideNode(const BVHWideNode<Width>& node, const BVHWideRay& ray, real tMax, real* tNear);
+
+    // Hands out one arena per concurrently built subtree, every arena lives until the tree has been flattened
+    class BVHBuildArenas
+    {
+    public:
+        MemoryArena& Allocate()
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            return *m_Arenas.emplace_back(CreateScope<MemoryArena>(1024 * 1024));
+        }
+
+    private:
+        std::mutex m_Mutex;
+        std::vector<Scope<MemoryArena>> m_Arenas;
+    };
+
+    struct BVHBucketInfo
+    {
+        i32 m_Count = 0;
+        Bounds3f m_Bounds;
+    };
+
+    struct MortonPrimitive
+    {
+        u32 m_PrimitiveIndex;
+        u32 m_MortonCode;
+    };
+
+    struct LBVHTreelet
+    {
+        i32 m_StartIndex, m_NumPrimitives;
+        BVHBuildNode* m_BuildNodes;
+    };
+
+    // Interleaves the bits of the components of v into a 30 bit Morton code, each component must be in [0, 1024]
+    u32 EncodeMorton3(const Vector3f& v);
+
+    // Stable sort by Morton code, implemented as a least significant digit radix sort where each pass histograms and
+    // scatters blocks of the input in parallel
+    void RadixSort(std::vector<MortonPrimitive>* v);
+
     struct BVHPrimitiveInfo
     {
         BVHPrimitiveInfo() = default;
@@ -87,6 +400,19 @@ namespace yart
         Vector3f m_Center;
     };
 
+    // The tree only depends on the bounds of the primitives and the build settings, so they are all that is hashed
+    u64 BVHCacheKey(const std::vector<BVHPrimitiveInfo>& primitiveInfo, i32 maxPrimsInNode, SplitMethod splitMethod,
+                    const BVHBuildParameters& parameters);
+    std::string BVHCachePath(const std::string& directory, u64 key);
+
+    // Maps the cache file at path if it holds a tree for key over numPrimitives primitives, otherwise returns nullptr. nodes and
+    // primitiveOrder point into the returned mapping, so the tree is used in place without being parsed or copied. Spatial
+    // splits can reference a primitive more than once, so the order holds numReferences entries
+    Scope<MappedFile> LoadBVHCache(const std::string& path, u64 key, i32 numPrimitives, BVHLinearNode** nodes, i32* numNodes,
+                                   const u32** primitiveOrder, i32* numReferences);
+    bool SaveBVHCache(const std::string& path, u64 key, const BVHLinearNode* nodes, i32 numNodes,
+                      const std::vector<u32>& primitiveOrder);
+
     template <typename Spectrum>
     class BVHAccelerator final : public AbstractAggregate<Spectrum>
     {
@@ -94,30 +420,107 @@ namespace yart
         using AbstractPrimitive = yart::AbstractPrimitive<Spectrum>;
         using MaterialInteraction = yart::MaterialInteraction<Spectrum>;
 
-        BVHAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives, i32 maxPrimsInNode, SplitMethod splitMethod);
+        BVHAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives, i32 maxPrimsInNode, SplitMethod splitMethod,
+                       const BVHBuildParameters& parameters = BVHBuildParameters{});
         ~BVHAccelerator();
 
         virtual Bounds3f WorldBound() const override;
         virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const override;
         virtual bool IntersectRay(const Ray& ray) const override;
 
+        // Packets traverse the binary nodes regardless of the selected layout, the compressed and clustered layouts release them
+        // and trace the rays of a packet one at a time instead
+        virtual u32 IntersectPacket(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions) const override;
+        virtual u32 IntersectPacket(const Ray* rays, i32 numRays) const override;
+
+        // Streams are sorted and walk the binary nodes once per direction octant, filtering the active rays at every node. Like
+        // packets, streams over the compressed and clustered layouts trace their rays one at a time
+        virtual void IntersectStream(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions,
+                                     bool* hits) const override;
+        virtual void IntersectStream(const Ray* rays, i32 numRays, bool* hits) const override;
+
+        bool LoadedFromCache() const
+        {
+            return m_LoadedFromCache;
+        }
+
+        // Size in bytes of all nodes kept. The binary tree is still needed by Refit(), packet and stream traversal when a wide
+        // layout is selected, so it is counted along with the layout derived from it. The compressed and clustered layouts
+        // replace the binary tree. Trees too deep to be traversed with a stack only keep the binary tree
+        u64 NodeMemoryUsage() const;
+
+        // Expected cost of intersecting a ray with the tree under the SAH cost model of the build parameters
+        real SAHCost() const;
+
+        BVHStatistics Statistics() const;
+        virtual std::string ReportStatistics() const override
+        {
+            return ToJSON(Statistics());
+        }
+
+        // Recomputes the bounds of every node from the current WorldBound() of the primitives while keeping the topology, for
+        // primitives that moved since the build. Returns SAHCost() relative to the cost right after the build, the further it
+        // grows above 1 the more a rebuild would pay off. Must not run concurrently with intersection queries
+        real Refit();
+
     private:
         const i32 m_MaxPrimsInNode;
         const SplitMethod m_SplitMethod;
+        const BVHBuildParameters m_Parameters;
         std::vector<Ref<AbstractPrimitive>> m_Primitives;
-        BVHLinearNode* m_BVHTree = nullptr;
+        BVHLinearNode* m_BVHTree = nullptr; // Points into m_CacheFile if the tree was loaded from the cache
+        Scope<MappedFile> m_CacheFile;
+        bool m_LoadedFromCache = false;
+        i32 m_TotalNodes = 0;
+        real m_BuildSAHCost = 0;
+        std::vector<BVHWideNode<4>> m_BVH4Tree;
+        std::vector<BVHWideNode<8>> m_BVH8Tree;
+        std::vector<BVHCompressedNode> m_CompressedTree;
+        Bounds3f m_CompressedRootBounds; // The only bounds of the compressed layout stored at full precision
+        BVHClusteredNodePair* m_ClusteredTree = nullptr;
+        i32 m_NumClusteredPairs = 0;
+        std::vector<i32> m_ParentOffsets; // Only set if the tree is traversed without a stack
+        BVHFlatSpheres<Spectrum> m_FlatSpheres;
 
     private:
-        BVHBuildNode* RecursiveBuild(MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo, i32 start, i32 end,
-                                     i32* totalNodes, std::vector<Ref<AbstractPrimitive>>& orderedPrimitives);
-        BVHLinearNode* FlattenBVHTree(BVHBuildNode* root, i32 totalNodes);
+        BVHBuildNode* RecursiveBuild(BVHBuildArenas& arenas, MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                                     i32 start, i32 end, std::vector<u32>& primitiveOrder);
+        BVHBuildNode* SpatialSplitBuild(MemoryArena& arena, std::vector<BVHPrimitiveInfo>& references, real sceneArea,
+                                        i32 depth, i32* referenceBudget, std::vector<u32>& primitiveOrder);
+        BVHBuildNode* HLBVHBuild(MemoryArena& arena, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                                 std::vector<u32>& primitiveOrder);
+        BVHBuildNode* EmitLBVH(BVHBuildNode*& buildNodes, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                               MortonPrimitive* mortonPrimitives, i32 numPrimitives, std::vector<u32>& primitiveOrder,
+                               i32* orderedPrimitivesOffset, i32 bitIndex);
+        BVHBuildNode* BuildUpperSAH(MemoryArena& arena, std::vector<BVHBuildNode*>& treeletRoots, i32 start, i32 end);
+        i32 MinCostSplitBucket(const BVHBucketInfo* buckets, const Bounds3f& totalBound, real* cost) const;
+        BVHLinearNode* FlattenBVHTree(BVHBuildNode* root);
+        void BuildAlternateLayout(const BVHLinearNode* tree);
+        void ReleaseBinaryTree();
+        const BVHLinearNode* BinaryTree(std::vector<BVHLinearNode>* decodedTree) const;
+
+        template <i32 Width>
+        bool IntersectWideBVH(const std::vector<BVHWideNode<Width>>& tree, const Ray& ray,
+                              MaterialInteraction* materialInteraction) const;
+        bool IntersectCompressedBVH(const Ray& ray, MaterialInteraction* materialInteraction) const;
+        bool IntersectClusteredBVH(const Ray& ray, MaterialInteraction* materialInteraction) const;
+        bool IntersectStacklessBVH(const Ray& ray, MaterialInteraction* materialInteraction) const;
+        void CacheOccluder(u64 primitiveOffset) const;
+        void BuildFlatSpheres(const BVHLinearNode* tree);
+        bool IntersectFlatSphere(i32 primitiveOffset, const Ray& ray, MaterialInteraction* materialInteraction) const;
+        bool IntersectLeaf(i32 firstPrimOffset, i32 numPrimitives, const Ray& ray,
+                           MaterialInteraction* materialInteraction) const;
+        u32 IntersectPacketBVH(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions) const;
+        void IntersectStreamBVH(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions, bool* hits) const;
     };
 
     template <typename Spectrum>
     BVHAccelerator<Spectrum>::BVHAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives, i32 maxPrimsInNode,
-                                             SplitMethod splitMethod)
-        : m_MaxPrimsInNode(std::min(255, maxPrimsInNode)), m_SplitMethod(splitMethod), m_Primitives(primitives)
+                                             SplitMethod splitMethod, const BVHBuildParameters& parameters)
+        : m_MaxPrimsInNode(std::min(255, maxPrimsInNode)), m_SplitMethod(splitMethod), m_Parameters(parameters),
+          m_Primitives(primitives)
     {
+        ASSERT(m_Parameters.m_NumBuckets >= 2);
         if (primitives.size() == 0)
             return;
 
@@ -127,21 +530,143 @@ namespace yart
             primitiveInfo[i] = {i, primitives[i]->WorldBound()};
         }
 
-        MemoryArena arena(1024 * 1024);
-        i32 totalNodes = 0;
-        std::vector<Ref<AbstractPrimitive>> orderedPrimitives;
-        BVHBuildNode* root = RecursiveBuild(arena, primitiveInfo, 0, primitives.size(), &totalNodes, orderedPrimitives);
-        m_Primitives.swap(orderedPrimitives);
-        m_BVHTree = FlattenBVHTree(root, totalNodes);
+        u64 cacheKey = 0;
+        std::string cachePath;
+        if (!m_Parameters.m_CacheDirectory.empty())
+        {
+            cacheKey = BVHCacheKey(primitiveInfo, m_MaxPrimsInNode, m_SplitMethod, m_Parameters);
+            cachePath = BVHCachePath(m_Parameters.m_CacheDirectory, cacheKey);
+
+            const u32* cachedPrimitiveOrder;
+            i32 numReferences;
+            m_CacheFile = LoadBVHCache(cachePath, cacheKey, primitives.size(), &m_BVHTree, &m_TotalNodes, &cachedPrimitiveOrder,
+                                       &numReferences);
+            if (m_CacheFile)
+            {
+                m_LoadedFromCache = true;
+                m_Primitives.resize(numReferences);
+                for (i32 i = 0; i < numReferences; i++)
+                    m_Primitives[i] = primitives[cachedPrimitiveOrder[i]];
+            }
+        }
+
+        if (!m_CacheFile)
+        {
+            BVHBuildArenas arenas;
+            MemoryArena& arena = arenas.Allocate();
+            std::vector<u32> primitiveOrder;
+            BVHBuildNode* root;
+            if (m_SplitMethod == SplitMethod::SBVH)
+            {
+                Bounds3f totalBound;
+                for (const BVHPrimitiveInfo& info : primitiveInfo)
+                    totalBound = Union(totalBound, info.m_Bounds);
+
+                i32 referenceBudget = (i32)(m_Parameters.m_SpatialSplitBudget * primitives.size());
+                primitiveOrder.reserve(primitives.size() + referenceBudget);
+                root = SpatialSplitBuild(arena, primitiveInfo, totalBound.SurfaceArea(), 0, &referenceBudget, primitiveOrder);
+            }
+            else
+            {
+                primitiveOrder.resize(primitives.size());
+                if (m_SplitMethod == SplitMethod::HLBVH)
+                    root = HLBVHBuild(arena, primitiveInfo, primitiveOrder);
+                else
+                    root = RecursiveBuild(arenas, arena, primitiveInfo, 0, primitives.size(), primitiveOrder);
+            }
+
+            CollapseBVHLeaves(root, m_MaxPrimsInNode, m_Parameters.m_TraversalCost, m_Parameters.m_IntersectionCost);
+
+            m_Primitives.resize(primitiveOrder.size());
+            for (u64 i = 0; i < primitiveOrder.size(); i++)
+                m_Primitives[i] = primitives[primitiveOrder[i]];
+            m_TotalNodes = root->m_NumNodes;
+            m_BVHTree = FlattenBVHTree(root);
+
+            if (!cachePath.empty() && !SaveBVHCache(cachePath, cacheKey, m_BVHTree, m_TotalNodes, primitiveOrder))
+                LOG_WARN("Failed to write BVH cache file {}", cachePath);
+        }
+
+        i32 depth;
+        std::vector<i32> parentOffsets = BVHParentOffsets(m_BVHTree, m_TotalNodes, &depth);
+        if (depth > MaxBVHTraversalDepth)
+        {
+            LOG_WARN("BVH is {} levels deep, more than the {} levels stack based traversal supports, traversing it without a stack",
+                     depth, MaxBVHTraversalDepth);
+            m_ParentOffsets = std::move(parentOffsets);
+        }
+        else if (m_Parameters.m_StacklessTraversal && m_Parameters.m_Layout == BVHLayout::Binary)
+            m_ParentOffsets = std::move(parentOffsets);
+
+        BuildFlatSpheres(m_BVHTree);
+        BuildAlternateLayout(m_BVHTree);
+        m_BuildSAHCost = SAHCost();
     }
 
+    // The other layouts are derived from the binary tree. It is kept for Refit(), packet and stream traversal, except by the
+    // compressed and clustered layouts, which replace it. Trees traversed without a stack only ever walk the binary nodes, so
+    // they build no other layout
     template <typename Spectrum>
-    BVHAccelerator<Spectrum>::~BVHAccelerator()
+    void BVHAccelerator<Spectrum>::BuildAlternateLayout(const BVHLinearNode* tree)
+    {
+        if (!m_ParentOffsets.empty())
+            return;
+
+        if (m_Parameters.m_Layout == BVHLayout::Wide4)
+            m_BVH4Tree = CollapseBVH<4>(tree);
+        else if (m_Parameters.m_Layout == BVHLayout::Wide8)
+            m_BVH8Tree = CollapseBVH<8>(tree);
+        else if (m_Parameters.m_Layout == BVHLayout::Compressed)
+        {
+            m_CompressedTree = CompressBVH(tree, m_TotalNodes);
+            m_CompressedRootBounds = tree[0].m_Bounds;
+        }
+        else if (m_Parameters.m_Layout == BVHLayout::Clustered)
+        {
+            FreeAligned(m_ClusteredTree);
+            m_ClusteredTree = ClusterBVH(tree, m_Parameters.m_ClusterBlockSize, &m_NumClusteredPairs);
+        }
+
+        const bool replacesBinaryTree =
+            m_Parameters.m_Layout == BVHLayout::Compressed || m_Parameters.m_Layout == BVHLayout::Clustered;
+        if (replacesBinaryTree && m_BVHTree)
+            ReleaseBinaryTree();
+    }
+
+    template <typename Spectrum>
+    void BVHAccelerator<Spectrum>::ReleaseBinaryTree()
+    {
+        if (m_CacheFile)
+            m_CacheFile.reset();
+        else
+            FreeAligned(m_BVHTree);
+        m_BVHTree = nullptr;
+    }
+
+    // Returns the binary nodes, or decodes them from the compressed or clustered nodes into decodedTree once they were
+    // released
+    template <typename Spectrum>
+    const BVHLinearNode* BVHAccelerator<Spectrum>::BinaryTree(std::vector<BVHLinearNode>* decodedTree) const
     {
         if (m_BVHTree)
+            return m_BVHTree;
+
+        if (m_ClusteredTree)
+            *decodedTree = DeclusterBVH(m_ClusteredTree, m_TotalNodes);
+        else
+            *decodedTree = DecompressBVH(m_CompressedTree, m_CompressedRootBounds);
+        return decodedTree->data();
+    }
+
+    template <typename Spectrum>
+    BVHAccelerator<Spectrum>::~BVHAccelerator()
+    {
+        if (m_BVHTree && !m_CacheFile)
         {
             FreeAligned(m_BVHTree);
         }
+
+        FreeAligned(m_ClusteredTree);
     }
 
     template <typename Spectrum>
@@ -149,31 +674,145 @@ namespace yart
     {
         if (m_BVHTree)
             return m_BVHTree[0].m_Bounds;
+        if (m_ClusteredTree)
+            return m_ClusteredTree[0].m_Nodes[0].m_Bounds;
+
+        return m_CompressedRootBounds;
+    }
+
+    template <typename Spectrum>
+    u64 BVHAccelerator<Spectrum>::NodeMemoryUsage() const
+    {
+        const u64 binarySize = m_BVHTree ? m_TotalNodes * sizeof(BVHLinearNode) : 0;
+        switch (m_Parameters.m_Layout)
+        {
+        case BVHLayout::Wide4:
+            return binarySize + m_BVH4Tree.size() * sizeof(BVHWideNode<4>);
+        case BVHLayout::Wide8:
+            return binarySize + m_BVH8Tree.size() * sizeof(BVHWideNode<8>);
+        case BVHLayout::Compressed:
+            return binarySize + m_CompressedTree.size() * sizeof(BVHCompressedNode);
+        case BVHLayout::Clustered:
+            return binarySize + m_NumClusteredPairs * sizeof(BVHClusteredNodePair);
+        default:
+            return binarySize;
+        }
+    }
+
+    template <typename Spectrum>
+    real BVHAccelerator<Spectrum>::SAHCost() const
+    {
+        if (m_TotalNodes == 0)
+            return 0;
 
-        return Bounds3f{};
+        // Without the binary nodes the cost is taken over the decoded bounds of the compressed or clustered nodes
+        std::vector<BVHLinearNode> decodedTree;
+        const BVHLinearNode* tree = BinaryTree(&decodedTree);
+        const real rootArea = tree[0].m_Bounds.SurfaceArea();
+        real cost = 0;
+        for (i32 i = 0; i < m_TotalNodes; i++)
+        {
+            const BVHLinearNode& node = tree[i];
+            real nodeCost = node.IsInteriorNode() ? m_Parameters.m_TraversalCost
+                                                  : m_Parameters.m_IntersectionCost * node.m_NumPrimitives;
+            cost += nodeCost * (rootArea > 0 ? node.m_Bounds.SurfaceArea() / rootArea : 1);
+        }
+
+        return cost;
+    }
+
+    template <typename Spectrum>
+    BVHStatistics BVHAccelerator<Spectrum>::Statistics() const
+    {
+        std::vector<BVHLinearNode> decodedTree;
+        BVHStatistics statistics = BVHTreeStatistics(m_TotalNodes > 0 ? BinaryTree(&decodedTree) : nullptr, m_TotalNodes);
+        statistics.m_SplitMethod = m_SplitMethod;
+        statistics.m_Layout = m_ParentOffsets.empty() ? m_Parameters.m_Layout : BVHLayout::Binary;
+        statistics.m_SAHCost = SAHCost();
+        statistics.m_NodeBytes = NodeMemoryUsage();
+        statistics.m_BinaryNodeBytes = m_TotalNodes * sizeof(BVHLinearNode);
+
+        statistics.m_TotalBytes = statistics.m_NodeBytes + m_Primitives.size() * sizeof(Ref<AbstractPrimitive>) +
+                                  m_ParentOffsets.size() * sizeof(i32) + m_FlatSpheres.m_NumLeafSpheres.size() * sizeof(u8) +
+                                  4 * m_FlatSpheres.m_CenterX.size() * sizeof(real) +
+                                  2 * m_FlatSpheres.m_Spheres.size() * sizeof(const void*);
+
+        return statistics;
+    }
+
+    template <typename Spectrum>
+    real BVHAccelerator<Spectrum>::Refit()
+    {
+        if (m_TotalNodes == 0)
+            return 1;
+
+        // Once the compressed or clustered layout has released the binary nodes, its topology is refit in a temporary binary
+        // tree from which the layout is built again
+        std::vector<BVHLinearNode> decodedTree;
+        BinaryTree(&decodedTree);
+        BVHLinearNode* tree = m_BVHTree ? m_BVHTree : decodedTree.data();
+
+        // Children are always stored after their parent, so walking the nodes backwards visits both children of a node
+        // before the node itself
+        for (i32 i = m_TotalNodes - 1; i >= 0; i--)
+        {
+            BVHLinearNode& node = tree[i];
+            if (node.IsInteriorNode())
+            {
+                const Bounds3f& firstBounds = tree[i + 1].m_Bounds;
+                const Bounds3f& secondBounds = tree[node.m_SecondChildOffset].m_Bounds;
+                node.m_Bounds = Union(firstBounds, secondBounds);
+                node.m_LargerChild = secondBounds.SurfaceArea() > firstBounds.SurfaceArea();
+                continue;
+            }
+
+            Bounds3f bounds;
+            for (i32 j = 0; j < node.m_NumPrimitives; j++)
+                bounds = Union(bounds, m_Primitives[node.m_FirstPrimOffset + j]->WorldBound());
+            node.m_Bounds = bounds;
+        }
+
+        BuildFlatSpheres(tree);
+        BuildAlternateLayout(tree);
+
+        return m_BuildSAHCost > 0 ? SAHCost() / m_BuildSAHCost : 1;
     }
 
     template <typename Spectrum>
     bool BVHAccelerator<Spectrum>::IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const
     {
-        if (!m_BVHTree)
+        if (m_TotalNodes == 0)
             return false;
+        COUNT_TRAVERSAL(m_RayQueries, 1);
+
+        if (!m_ParentOffsets.empty())
+            return IntersectStacklessBVH(ray, materialInteraction);
+        if (m_Parameters.m_Layout == BVHLayout::Wide4)
+            return IntersectWideBVH(m_BVH4Tree, ray, materialInteraction);
+        if (m_Parameters.m_Layout == BVHLayout::Wide8)
+            return IntersectWideBVH(m_BVH8Tree, ray, materialInteraction);
+        if (m_Parameters.m_Layout == BVHLayout::Compressed)
+            return IntersectCompressedBVH(ray, materialInteraction);
+        if (m_Parameters.m_Layout == BVHLayout::Clustered)
+            return IntersectClusteredBVH(ray, materialInteraction);
 
         bool hit = false;
         Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
         i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
 
         i32 unvisitedOffset = 0, currentNodeOffset = 0;
-        i32 unvisitedNodes[64]; // Acts as a stack for DFS traveral
+        i32 unvisitedNodes[MaxBVHTraversalDepth]; // Acts as a stack for DFS traveral
         while (true)
         {
             const BVHLinearNode* node = &m_BVHTree[currentNodeOffset];
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, 1);
 
             if (node->m_Bounds.IntersectRay(ray, invRayDir, dirIsNeg))
             {
                 if (node->IsInteriorNode())
                 {
-                    ASSERT(unvisitedOffset < 64);
+                    ASSERT(unvisitedOffset < MaxBVHTraversalDepth);
                     if (dirIsNeg[node->m_SplitAxis])
                     {
                         unvisitedNodes[unvisitedOffset++] = currentNodeOffset + 1;
@@ -184,12 +823,15 @@ namespace yart
                         unvisitedNodes[unvisitedOffset++] = node->m_SecondChildOffset;
                         currentNodeOffset = currentNodeOffset + 1;
                     }
+
+                    if (m_Parameters.m_PrefetchFarChild)
+                        Prefetch(&m_BVHTree[unvisitedNodes[unvisitedOffset - 1]]);
                 }
                 else
                 {
-                    for (i32 i = 0; i < node->m_NumPrimitives; i++)
-                        if (m_Primitives[node->m_FirstPrimOffset + i]->IntersectRay(ray, materialInteraction))
-                            hit = true;
+                    COUNT_TRAVERSAL(m_PrimitivesTested, node->m_NumPrimitives);
+                    if (IntersectLeaf(node->m_FirstPrimOffset, node->m_NumPrimitives, ray, materialInteraction))
+                        hit = true;
 
                     if (unvisitedOffset == 0)
                         break;
@@ -212,23 +854,50 @@ namespace yart
     template <typename Spectrum>
     bool BVHAccelerator<Spectrum>::IntersectRay(const Ray& ray) const
     {
-        if (!m_BVHTree)
+        if (m_TotalNodes == 0)
             return false;
+        COUNT_TRAVERSAL(m_RayQueries, 1);
+
+        const BVHLastOccluder& lastOccluder = LastOccluder();
+        if (m_Parameters.m_CacheLastOccluder && lastOccluder.m_Accelerator == this &&
+            lastOccluder.m_PrimitiveOffset < m_Primitives.size())
+        {
+            COUNT_TRAVERSAL(m_PrimitivesTested, 1);
+            const u64 offset = lastOccluder.m_PrimitiveOffset;
+            if (!m_FlatSpheres.m_Spheres.empty() && m_FlatSpheres.m_Spheres[offset] ? IntersectFlatSphere(offset, ray, nullptr)
+                                                                                    : m_Primitives[offset]->IntersectRay(ray))
+                return true;
+        }
+
+        if (!m_ParentOffsets.empty())
+            return IntersectStacklessBVH(ray, nullptr);
+        if (m_Parameters.m_Layout == BVHLayout::Wide4)
+            return IntersectWideBVH(m_BVH4Tree, ray, nullptr);
+        if (m_Parameters.m_Layout == BVHLayout::Wide8)
+            return IntersectWideBVH(m_BVH8Tree, ray, nullptr);
+        if (m_Parameters.m_Layout == BVHLayout::Compressed)
+            return IntersectCompressedBVH(ray, nullptr);
+        if (m_Parameters.m_Layout == BVHLayout::Clustered)
+            return IntersectClusteredBVH(ray, nullptr);
 
         Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
         i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
 
         i32 unvisitedOffset = 0, currentNodeOffset = 0;
-        i32 unvisitedNodes[64]; // Acts as a stack for DFS traveral
+        i32 unvisitedNodes[MaxBVHTraversalDepth]; // Acts as a stack for DFS traveral
         while (true)
         {
             const BVHLinearNode* node = &m_BVHTree[currentNodeOffset];
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, 1);
 
             if (node->m_Bounds.IntersectRay(ray, invRayDir, dirIsNeg))
             {
                 if (node->IsInteriorNode())
                 {
-                    if (dirIsNeg[node->m_SplitAxis])
+                    ASSERT(unvisitedOffset < MaxBVHTraversalDepth);
+                    // Any hit ends the query, so rather than front to back the child most likely to be hit is visited first
+                    if (node->m_LargerChild)
                     {
                         unvisitedNodes[unvisitedOffset++] = currentNodeOffset + 1;
                         currentNodeOffset = node->m_SecondChildOffset;
@@ -238,12 +907,15 @@ namespace yart
                         unvisitedNodes[unvisitedOffset++] = node->m_SecondChildOffset;
                         currentNodeOffset = currentNodeOffset + 1;
                     }
+
+                    if (m_Parameters.m_PrefetchFarChild)
+                        Prefetch(&m_BVHTree[unvisitedNodes[unvisitedOffset - 1]]);
                 }
                 else
                 {
-                    for (i32 i = 0; i < node->m_NumPrimitives; i++)
-                        if (m_Primitives[node->m_FirstPrimOffset + i]->IntersectRay(ray))
-                            return true;
+                    COUNT_TRAVERSAL(m_PrimitivesTested, node->m_NumPrimitives);
+                    if (IntersectLeaf(node->m_FirstPrimOffset, node->m_NumPrimitives, ray, nullptr))
+                        return true;
 
                     if (unvisitedOffset == 0)
                         break;
@@ -264,42 +936,702 @@ namespace yart
     }
 
     template <typename Spectrum>
-    BVHBuildNode* BVHAccelerator<Spectrum>::RecursiveBuild(MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo,
-                                                           i32 start, i32 end, i32* totalNodes,
-                                                           std::vector<Ref<AbstractPrimitive>>& orderedPrimitives)
+    void BVHAccelerator<Spectrum>::CacheOccluder(u64 primitiveOffset) const
     {
-        BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
-        (*totalNodes)++;
+        if (m_Parameters.m_CacheLastOccluder)
+            LastOccluder() = {this, primitiveOffset};
+    }
 
-        Bounds3f totalBound;
-        for (i32 i = start; i < end; i++)
+    template <typename Spectrum>
+    void BVHAccelerator<Spectrum>::BuildFlatSpheres(const BVHLinearNode* tree)
+    {
+        m_FlatSpheres = BVHFlatSpheres<Spectrum>{};
+        if (!m_Parameters.m_InlineSpheres || m_TotalNodes == 0)
+            return;
+
+        // Move the spheres of every leaf to the front of its range, keeping the order of the rest
+        Vector3f center;
+        real radius;
+        auto isSphere = [&center, &radius](const Ref<AbstractPrimitive>& primitive) {
+            return primitive->WorldSphere(&center, &radius) != nullptr;
+        };
+
+        const u64 numPrimitives = m_Primitives.size();
+        std::vector<u8> numLeafSpheres(numPrimitives, 0);
+        bool anySpheres = false;
+        for (i32 i = 0; i < m_TotalNodes; i++)
         {
-            totalBound = Union(totalBound, primitiveInfo[i].m_Bounds);
+            const BVHLinearNode& node = tree[i];
+            if (node.IsInteriorNode())
+                continue;
+
+            auto first = m_Primitives.begin() + node.m_FirstPrimOffset;
+            auto firstOther = std::stable_partition(first, first + node.m_NumPrimitives, isSphere);
+            numLeafSpheres[node.m_FirstPrimOffset] = firstOther - first;
+            anySpheres |= firstOther != first;
         }
 
-        i32 numPrimitives = end - start;
-        if (numPrimitives == 1)
+        // Without any spheres every leaf takes the primitive path and the arrays are not needed
+        if (!anySpheres)
+            return;
+
+        m_FlatSpheres.m_NumLeafSpheres = std::move(numLeafSpheres);
+        m_FlatSpheres.m_CenterX.resize(numPrimitives, 0);
+        m_FlatSpheres.m_CenterY.resize(numPrimitives, 0);
+        m_FlatSpheres.m_CenterZ.resize(numPrimitives, 0);
+        m_FlatSpheres.m_RadiusSquared.resize(numPrimitives, 0);
+        m_FlatSpheres.m_Spheres.resize(numPrimitives, nullptr);
+        m_FlatSpheres.m_Primitives.resize(numPrimitives, nullptr);
+        for (u64 i = 0; i < numPrimitives; i++)
         {
-            i32 firstPrimOffset = orderedPrimitives.size();
-            i32 primitiveNumber = primitiveInfo[start].m_PrimitiveNumber;
-            orderedPrimitives.push_back(m_Primitives[primitiveNumber]);
-            node->InitLeaf(firstPrimOffset, 1, totalBound);
+            const Sphere* sphere = m_Primitives[i]->WorldSphere(&center, &radius);
+            if (!sphere)
+                continue;
+
+            m_FlatSpheres.m_CenterX[i] = center.x;
+            m_FlatSpheres.m_CenterY[i] = center.y;
+            m_FlatSpheres.m_CenterZ[i] = center.z;
+            m_FlatSpheres.m_RadiusSquared[i] = radius * radius;
+            m_FlatSpheres.m_Spheres[i] = sphere;
+            m_FlatSpheres.m_Primitives[i] = m_Primitives[i].get();
         }
-        else
-        {
-            Bounds3f centroidBounds;
-            for (i32 i = start; i < end; i++)
-            {
-                centroidBounds = Union(centroidBounds, primitiveInfo[i].m_Center);
-            }
+    }
+
+    // Intersects the sphere stored inline at primitiveOffset. Without a material interaction it only reports whether the ray
+    // hits it, otherwise the ray is shortened to the hit and the interaction is filled in as the sphere's primitive would
+    template <typename Spectrum>
+    bool BVHAccelerator<Spectrum>::IntersectFlatSphere(i32 primitiveOffset, const Ray& ray,
+                                                       MaterialInteraction* materialInteraction) const
+    {
+        // Solves |o + t * d - center|^2 = radius^2. The discriminant is computed from the distance between the center and the
+        // point of the ray closest to it, which stays accurate for rays that start far away from the sphere
+        const real radiusSquared = m_FlatSpheres.m_RadiusSquared[primitiveOffset];
+        Vector3f centerToOrigin{ray.o.x - m_FlatSpheres.m_CenterX[primitiveOffset],
+                                ray.o.y - m_FlatSpheres.m_CenterY[primitiveOffset],
+                                ray.o.z - m_FlatSpheres.m_CenterZ[primitiveOffset]};
+        const real a = NormSquared(ray.d);
+        const real b = Dot(centerToOrigin, ray.d);
+        const real c = NormSquared(centerToOrigin) - radiusSquared;
+        const real discriminant = a * (radiusSquared - NormSquared(centerToOrigin - (b / a) * ray.d));
+        if (discriminant < 0)
+            return false;
+
+        // Both roots without cancellation, as in Quadratic()
+        const real q = -(b + std::copysign(std::sqrt(discriminant), b));
+        if (q == 0)
+            return false;
+        real t0 = q / a, t1 = c / q;
+        if (t0 > t1)
+            std::swap(t0, t1);
+
+        if (t0 > ray.m_Tmax || t1 <= 0)
+            return false;
+        const real tHit = t0 > 0 ? t0 : t1;
+        if (tHit > ray.m_Tmax)
+            return false;
+
+        if (materialInteraction)
+        {
+            ray.m_Tmax = tHit;
+            static_cast<SurfaceInteraction&>(*materialInteraction) =
+                m_FlatSpheres.m_Spheres[primitiveOffset]->WorldInteraction(ray(tHit), ray);
+            materialInteraction->m_Primitive = m_FlatSpheres.m_Primitives[primitiveOffset];
+        }
+
+        return true;
+    }
+
+    // Intersects the primitives of a leaf of any layout. The spheres at the front of the leaf are intersected from their inline
+    // copies and only the primitives after them are called. Without a material interaction it returns as soon as one of them
+    // occludes the ray, otherwise the closest hit is searched for
+    template <typename Spectrum>
+    bool BVHAccelerator<Spectrum>::IntersectLeaf(i32 firstPrimOffset, i32 numPrimitives, const Ray& ray,
+                                                 MaterialInteraction* materialInteraction) const
+    {
+        bool hit = false;
+        i32 firstOther = firstPrimOffset;
+        if (!m_FlatSpheres.m_NumLeafSpheres.empty())
+        {
+            const i32 endSpheres = firstPrimOffset + m_FlatSpheres.m_NumLeafSpheres[firstPrimOffset];
+            for (; firstOther < endSpheres; firstOther++)
+            {
+                if (!IntersectFlatSphere(firstOther, ray, materialInteraction))
+                    continue;
+
+                if (!materialInteraction)
+                {
+                    CacheOccluder(firstOther);
+                    return true;
+                }
+                hit = true;
+            }
+        }
+
+        for (i32 i = firstOther; i < firstPrimOffset + numPrimitives; i++)
+        {
+            if (!materialInteraction)
+            {
+                if (m_Primitives[i]->IntersectRay(ray))
+                {
+                    CacheOccluder(i);
+                    return true;
+                }
+            }
+            else if (m_Primitives[i]->IntersectRay(ray, materialInteraction))
+                hit = true;
+        }
+
+        return hit;
+    }
+
+    template <typename Spectrum>
+    u32 BVHAccelerator<Spectrum>::IntersectPacket(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions) const
+    {
+        // Packet traversal needs a stack and the binary nodes, so trees traversed without a stack and compressed or clustered
+        // trees fall back to tracing the rays one at a time
+        if (!m_ParentOffsets.empty() || !m_BVHTree)
+            return AbstractPrimitive::IntersectPacket(rays, numRays, materialInteractions);
+        return IntersectPacketBVH(rays, numRays, materialInteractions);
+    }
+
+    template <typename Spectrum>
+    u32 BVHAccelerator<Spectrum>::IntersectPacket(const Ray* rays, i32 numRays) const
+    {
+        if (!m_ParentOffsets.empty() || !m_BVHTree)
+            return AbstractPrimitive::IntersectPacket(rays, numRays);
+        return IntersectPacketBVH(rays, numRays, nullptr);
+    }
+
+    template <typename Spectrum>
+    void BVHAccelerator<Spectrum>::IntersectStream(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions,
+                                                   bool* hits) const
+    {
+        if (!m_BVHTree)
+            AbstractPrimitive::IntersectStream(rays, numRays, materialInteractions, hits);
+        else
+            IntersectStreamBVH(rays, numRays, materialInteractions, hits);
+    }
+
+    template <typename Spectrum>
+    void BVHAccelerator<Spectrum>::IntersectStream(const Ray* rays, i32 numRays, bool* hits) const
+    {
+        if (!m_BVHTree)
+            AbstractPrimitive::IntersectStream(rays, numRays, hits);
+        else
+            IntersectStreamBVH(rays, numRays, nullptr, hits);
+    }
+
+    // Without material interactions each ray stops at the first hit found, otherwise the closest hit is searched for
+    template <typename Spectrum>
+    void BVHAccelerator<Spectrum>::IntersectStreamBVH(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions,
+                                                      bool* hits) const
+    {
+        std::fill(hits, hits + numRays, false);
+        if (!m_BVHTree || numRays == 0)
+            return;
+
+        struct UnvisitedNode
+        {
+            i32 offset;
+            i32 raysBegin, raysEnd; // Range of rayIndices holding the rays that hit the parent of the node
+        };
+
+        std::array<i32, 9> octantOffsets;
+        std::vector<i32> rayIndices = SortRayStream(rays, numRays, WorldBound(), &octantOffsets);
+        std::vector<Vector3f> invRayDirs(numRays);
+        for (i32 i = 0; i < numRays; i++)
+            invRayDirs[i] = Vector3f{1 / rays[i].d.x, 1 / rays[i].d.y, 1 / rays[i].d.z};
+
+        // The rays of one octant share the order children are visited in. The rays that hit a node are appended to
+        // rayIndices, and both of its children read them from there. Since the stack only ever holds nested ranges,
+        // everything past the range of a popped node belongs to finished subtrees and is discarded
+        std::vector<UnvisitedNode> unvisitedNodes;
+        for (i32 octant = 0; octant < 8; octant++)
+        {
+            if (octantOffsets[octant] == octantOffsets[octant + 1])
+                continue;
+
+            i32 dirIsNeg[3] = {octant & 1, (octant >> 1) & 1, (octant >> 2) & 1};
+            unvisitedNodes.push_back({0, octantOffsets[octant], octantOffsets[octant + 1]});
+            while (unvisitedNodes.size() != 0)
+            {
+                UnvisitedNode current = unvisitedNodes.back();
+                unvisitedNodes.pop_back();
+                rayIndices.resize(std::max(current.raysEnd, numRays));
+
+                const BVHLinearNode* node = &m_BVHTree[current.offset];
+                const i32 raysBegin = rayIndices.size();
+                for (i32 i = current.raysBegin; i < current.raysEnd; i++)
+                {
+                    i32 ray = rayIndices[i];
+                    if (!materialInteractions && hits[ray])
+                        continue;
+
+                    if (node->m_Bounds.IntersectRay(rays[ray], invRayDirs[ray], dirIsNeg))
+                        rayIndices.push_back(ray);
+                }
+                const i32 raysEnd = rayIndices.size();
+
+                if (raysBegin == raysEnd)
+                    continue;
+
+                if (node->IsInteriorNode())
+                {
+                    if (dirIsNeg[node->m_SplitAxis])
+                    {
+                        unvisitedNodes.push_back({current.offset + 1, raysBegin, raysEnd});
+                        unvisitedNodes.push_back({node->m_SecondChildOffset, raysBegin, raysEnd});
+                    }
+                    else
+                    {
+                        unvisitedNodes.push_back({node->m_SecondChildOffset, raysBegin, raysEnd});
+                        unvisitedNodes.push_back({current.offset + 1, raysBegin, raysEnd});
+                    }
+                    continue;
+                }
+
+                for (i32 i = raysBegin; i < raysEnd; i++)
+                {
+                    i32 ray = rayIndices[i];
+                    MaterialInteraction* materialInteraction = materialInteractions ? &materialInteractions[ray] : nullptr;
+                    if (IntersectLeaf(node->m_FirstPrimOffset, node->m_NumPrimitives, rays[ray], materialInteraction))
+                        hits[ray] = true;
+                }
+            }
+        }
+    }
+
+    // Without material interactions each ray stops at the first hit found, otherwise the closest hit is searched for
+    template <typename Spectrum>
+    u32 BVHAccelerator<Spectrum>::IntersectPacketBVH(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions) const
+    {
+        ASSERT(numRays <= MaxRayPacketSize);
+        if (!m_BVHTree || numRays == 0)
+            return 0;
+
+        struct UnvisitedNode
+        {
+            i32 offset;
+            u32 activeMask; // Rays that hit the parent of the node
+        };
+
+        u32 hitMask = 0;
+        u32 finishedMask = 0; // Rays that no longer need to be traced
+        BVHRayPacket packet(rays, numRays);
+
+        // The packet is assumed to be coherent, so the direction of its first ray decides the order children are visited in
+        i32 dirIsNeg[3] = {rays[0].d.x < 0, rays[0].d.y < 0, rays[0].d.z < 0};
+
+        i32 unvisitedOffset = 0;
+        UnvisitedNode current{0, (1u << numRays) - 1};
+        UnvisitedNode unvisitedNodes[MaxBVHTraversalDepth];
+        while (true)
+        {
+            const BVHLinearNode* node = &m_BVHTree[current.offset];
+            u32 activeMask = IntersectPacketBounds(node->m_Bounds, packet, current.activeMask & ~finishedMask);
+
+            if (activeMask != 0)
+            {
+                if (node->IsInteriorNode())
+                {
+                    ASSERT(unvisitedOffset < MaxBVHTraversalDepth);
+                    if (dirIsNeg[node->m_SplitAxis])
+                    {
+                        unvisitedNodes[unvisitedOffset++] = {current.offset + 1, activeMask};
+                        current = {node->m_SecondChildOffset, activeMask};
+                    }
+                    else
+                    {
+                        unvisitedNodes[unvisitedOffset++] = {node->m_SecondChildOffset, activeMask};
+                        current = {current.offset + 1, activeMask};
+                    }
+                    continue;
+                }
+
+                for (i32 ray = 0; ray < numRays; ray++)
+                {
+                    MaterialInteraction* materialInteraction = materialInteractions ? &materialInteractions[ray] : nullptr;
+                    if (!(activeMask & (1u << ray)) ||
+                        !IntersectLeaf(node->m_FirstPrimOffset, node->m_NumPrimitives, rays[ray], materialInteraction))
+                        continue;
+
+                    hitMask |= 1u << ray;
+                    if (!materialInteractions)
+                        finishedMask |= 1u << ray;
+                    else
+                        packet.m_Tmax[ray] = rays[ray].m_Tmax;
+                }
+            }
+
+            if (unvisitedOffset == 0)
+                break;
+
+            current = unvisitedNodes[--unvisitedOffset];
+        }
+
+        return hitMask;
+    }
+
+    // Without a material interaction the first hit found is returned, otherwise the closest hit is searched for
+    template <typename Spectrum>
+    template <i32 Width>
+    bool BVHAccelerator<Spectrum>::IntersectWideBVH(const std::vector<BVHWideNode<Width>>& tree, const Ray& ray,
+                                                    MaterialInteraction* materialInteraction) const
+    {
+        struct UnvisitedNode
+        {
+            i32 offset;
+            i32 numPrimitives; // 0: Wide node, otherwise a leaf child
+            real tNear;
+        };
+
+        bool hit = false;
+        BVHWideRay wideRay(ray);
+
+        constexpr i32 maxUnvisitedNodes = MaxBVHTraversalDepth * Width;
+        i32 unvisitedOffset = 0;
+        UnvisitedNode unvisitedNodes[maxUnvisitedNodes];
+        unvisitedNodes[unvisitedOffset++] = {0, 0, 0};
+        while (unvisitedOffset != 0)
+        {
+            UnvisitedNode current = unvisitedNodes[--unvisitedOffset];
+
+            // A closer hit may have been found since this node was pushed
+            if (current.tNear >= ray.m_Tmax)
+                continue;
+
+            if (current.numPrimitives != 0)
+            {
+                COUNT_TRAVERSAL(m_PrimitivesTested, current.numPrimitives);
+                if (IntersectLeaf(current.offset, current.numPrimitives, ray, materialInteraction))
+                {
+                    if (!materialInteraction)
+                        return true;
+                    hit = true;
+                }
+                continue;
+            }
+
+            const BVHWideNode<Width>& node = tree[current.offset];
+            alignas(32) real tNear[Width];
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, Width); // All child slots are tested at once, including the empty ones
+            u32 hitMask = IntersectWideNode(node, wideRay, ray.m_Tmax, tNear);
+
+            // Insert the children sorted by distance, the closest one ends up on top of the stack and is visited first
+            i32 firstChild = unvisitedOffset;
+            for (i32 i = 0; i < Width; i++)
+            {
+                if (!(hitMask & (1u << i)))
+                    continue;
+
+                ASSERT(unvisitedOffset < maxUnvisitedNodes);
+                UnvisitedNode child{node.m_ChildOffset[i], node.m_NumPrimitives[i], tNear[i]};
+                i32 j = unvisitedOffset++;
+                for (; j > firstChild && unvisitedNodes[j - 1].tNear < child.tNear; j--)
+                    unvisitedNodes[j] = unvisitedNodes[j - 1];
+                unvisitedNodes[j] = child;
+            }
+        }
+
+        return hit;
+    }
+
+    // Without a material interaction the first hit found is returned, otherwise the closest hit is searched for
+    template <typename Spectrum>
+    bool BVHAccelerator<Spectrum>::IntersectCompressedBVH(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        struct UnvisitedNode
+        {
+            i32 offset;
+            Bounds3f bounds;
+        };
+
+        bool hit = false;
+        Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+        i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
+
+        // Only the root bounds are stored at full precision
+        i32 unvisitedOffset = 0;
+        UnvisitedNode current{0, m_CompressedRootBounds};
+        UnvisitedNode unvisitedNodes[MaxBVHTraversalDepth];
+        while (true)
+        {
+            const BVHCompressedNode& node = m_CompressedTree[current.offset];
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, 1);
+
+            if (current.bounds.IntersectRay(ray, invRayDir, dirIsNeg))
+            {
+                if (node.IsInteriorNode())
+                {
+                    ASSERT(unvisitedOffset < MaxBVHTraversalDepth);
+                    UnvisitedNode firstChild{current.offset + 1, DequantizeBounds(current.bounds, node.m_ChildBounds[0])};
+                    UnvisitedNode secondChild{(i32)node.m_Offset, DequantizeBounds(current.bounds, node.m_ChildBounds[1])};
+                    if (dirIsNeg[node.m_SplitAxis])
+                    {
+                        unvisitedNodes[unvisitedOffset++] = firstChild;
+                        current = secondChild;
+                    }
+                    else
+                    {
+                        unvisitedNodes[unvisitedOffset++] = secondChild;
+                        current = firstChild;
+                    }
+                    continue;
+                }
+
+                COUNT_TRAVERSAL(m_PrimitivesTested, node.m_NumPrimitives);
+                if (IntersectLeaf(node.m_Offset, node.m_NumPrimitives, ray, materialInteraction))
+                {
+                    if (!materialInteraction)
+                        return true;
+                    hit = true;
+                }
+            }
+
+            if (unvisitedOffset == 0)
+                break;
+
+            current = unvisitedNodes[--unvisitedOffset];
+        }
+
+        return hit;
+    }
+
+    template <typename Spectrum>
+    bool BVHAccelerator<Spectrum>::IntersectClusteredBVH(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        auto clusteredNode = [this](i32 offset) -> const BVHClusteredNode& {
+            return m_ClusteredTree[offset / 2].m_Nodes[offset % 2];
+        };
+
+        bool hit = false;
+        Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+        i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
+
+        i32 unvisitedOffset = 0, currentNodeOffset = 0;
+        i32 unvisitedNodes[MaxBVHTraversalDepth];
+        while (true)
+        {
+            const BVHClusteredNode& node = clusteredNode(currentNodeOffset);
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, 1);
+
+            if (node.m_Bounds.IntersectRay(ray, invRayDir, dirIsNeg))
+            {
+                if (node.IsInteriorNode())
+                {
+                    ASSERT(unvisitedOffset < MaxBVHTraversalDepth);
+                    i32 nearChild = node.m_ChildOffset + dirIsNeg[node.m_SplitAxis];
+                    i32 farChild = node.m_ChildOffset + !dirIsNeg[node.m_SplitAxis];
+                    unvisitedNodes[unvisitedOffset++] = farChild;
+                    currentNodeOffset = nearChild;
+
+                    // The far child shares its cache line with the near one, so it is the children of the far child that are
+                    // worth fetching ahead of time
+                    const BVHClusteredNode& far = clusteredNode(farChild);
+                    if (m_Parameters.m_PrefetchFarChild && far.IsInteriorNode())
+                        Prefetch(&m_ClusteredTree[far.m_ChildOffset / 2]);
+                    continue;
+                }
+
+                COUNT_TRAVERSAL(m_PrimitivesTested, node.m_NumPrimitives);
+                if (IntersectLeaf(node.m_FirstPrimOffset, node.m_NumPrimitives, ray, materialInteraction))
+                {
+                    if (!materialInteraction)
+                        return true;
+                    hit = true;
+                }
+            }
+
+            if (unvisitedOffset == 0)
+                break;
+
+            currentNodeOffset = unvisitedNodes[--unvisitedOffset];
+        }
+
+        return hit;
+    }
+
+    // Walks the tree using the parent of every node instead of a stack. Where to go next follows from whether a node was
+    // entered from its parent, from its sibling or from one of its children, so any depth is handled in constant space
+    template <typename Spectrum>
+    bool BVHAccelerator<Spectrum>::IntersectStacklessBVH(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        enum class EnteredFrom
+        {
+            Parent,
+            Sibling,
+            Child
+        };
+
+        bool hit = false;
+        Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+        i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
+
+        auto nearChild = [&](i32 offset) {
+            const BVHLinearNode& node = m_BVHTree[offset];
+            return dirIsNeg[node.m_SplitAxis] ? node.m_SecondChildOffset : offset + 1;
+        };
+        auto sibling = [&](i32 offset) {
+            i32 parent = m_ParentOffsets[offset];
+            return offset == parent + 1 ? m_BVHTree[parent].m_SecondChildOffset : parent + 1;
+        };
+
+        i32 currentNodeOffset = 0;
+        EnteredFrom enteredFrom = EnteredFrom::Parent;
+        while (true)
+        {
+            if (enteredFrom == EnteredFrom::Child)
+            {
+                // Coming back up from the near child the far child is next, coming back up from the far child the parent is done
+                if (currentNodeOffset == 0)
+                    break;
+
+                i32 parent = m_ParentOffsets[currentNodeOffset];
+                if (currentNodeOffset == nearChild(parent))
+                {
+                    currentNodeOffset = sibling(currentNodeOffset);
+                    enteredFrom = EnteredFrom::Sibling;
+                }
+                else
+                    currentNodeOffset = parent;
+                continue;
+            }
+
+            const BVHLinearNode* node = &m_BVHTree[currentNodeOffset];
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, 1);
+            if (node->m_Bounds.IntersectRay(ray, invRayDir, dirIsNeg))
+            {
+                if (node->IsInteriorNode())
+                {
+                    currentNodeOffset = nearChild(currentNodeOffset);
+                    enteredFrom = EnteredFrom::Parent;
+                    continue;
+                }
+
+                COUNT_TRAVERSAL(m_PrimitivesTested, node->m_NumPrimitives);
+                if (IntersectLeaf(node->m_FirstPrimOffset, node->m_NumPrimitives, ray, materialInteraction))
+                {
+                    if (!materialInteraction)
+                        return true;
+                    hit = true;
+                }
+            }
+
+            // A near child is followed by its sibling, while a far child was the last child of its parent left to visit
+            if (currentNodeOffset == 0)
+                break;
+
+            if (enteredFrom == EnteredFrom::Parent)
+            {
+                currentNodeOffset = sibling(currentNodeOffset);
+                enteredFrom = EnteredFrom::Sibling;
+            }
+            else
+            {
+                currentNodeOffset = m_ParentOffsets[currentNodeOffset];
+                enteredFrom = EnteredFrom::Child;
+            }
+        }
+
+        return hit;
+    }
+
+    template <typename Spectrum>
+    BVHBuildNode* BVHAccelerator<Spectrum>::RecursiveBuild(BVHBuildArenas& arenas, MemoryArena& arena,
+                                                           std::vector<BVHPrimitiveInfo>& primitiveInfo, i32 start, i32 end,
+                                                           std::vector<u32>& primitiveOrder)
+    {
+        BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
+
+        Bounds3f totalBound;
+        for (i32 i = start; i < end; i++)
+        {
+            totalBound = Union(totalBound, primitiveInfo[i].m_Bounds);
+        }
+
+        i32 numPrimitives = end - start;
+        // Primitives are partitioned in place, so the primitives of this subtree occupy [start, end) in both primitiveInfo
+        // and primitiveOrder. Subtrees built concurrently therefore never write to the same elements
+        auto initLeaf = [&]() {
+            for (i32 i = start; i < end; i++)
+                primitiveOrder[i] = primitiveInfo[i].m_PrimitiveNumber;
+            node->InitLeaf(start, numPrimitives, totalBound);
+        };
+
+        if (numPrimitives == 1)
+        {
+            initLeaf();
+        }
+        else
+        {
+            Bounds3f centroidBounds;
+            for (i32 i = start; i < end; i++)
+            {
+                centroidBounds = Union(centroidBounds, primitiveInfo[i].m_Center);
+            }
+
+            i32 axis = centroidBounds.MaximumExtent();
+            i32 mid = (start + end) / 2;
+            switch (m_SplitMethod)
+            {
+            case SplitMethod::SAH:
+            {
+                // If all primitive centers are in the same spot then every ordering of the primitives is sorted along
+                // the axis, so the default midpoint is a valid SplitMethod::EqualCounts partition
+                if (centroidBounds.m_MaxBound[axis] == centroidBounds.m_MinBound[axis])
+                {
+                    if (numPrimitives <= m_MaxPrimsInNode)
+                    {
+                        initLeaf();
+                        return node;
+                    }
+                    break;
+                }
+
+                const i32 numBuckets = m_Parameters.m_NumBuckets;
+                auto bucketIndex = [&](const BVHPrimitiveInfo& pInfo) {
+                    i32 b = (i32)(numBuckets * centroidBounds.Offset(pInfo.m_Center)[axis]);
+                    return std::min(b, numBuckets - 1);
+                };
+
+                BVHBucketInfo* buckets = YART_ALLOCA(BVHBucketInfo, numBuckets);
+                for (i32 b = 0; b < numBuckets; b++)
+                    new (&buckets[b]) BVHBucketInfo();
+
+                for (i32 i = start; i < end; i++)
+                {
+                    BVHBucketInfo& bucket = buckets[bucketIndex(primitiveInfo[i])];
+                    bucket.m_Count++;
+                    bucket.m_Bounds = Union(bucket.m_Bounds, primitiveInfo[i].m_Bounds);
+                }
+
+                real minCost;
+                i32 minCostSplitBucket = MinCostSplitBucket(buckets, totalBound, &minCost);
+                real leafCost = m_Parameters.m_IntersectionCost * numPrimitives;
+
+                if (numPrimitives <= m_MaxPrimsInNode && leafCost <= minCost)
+                {
+                    initLeaf();
+                    return node;
+                }
 
-            i32 axis = centroidBounds.MaximumExtent();
-            i32 mid = (start + end) / 2;
-            switch (m_SplitMethod)
-            {
-            case SplitMethod::Middle:
-            {
-                real midPoint = (centroidBounds.m_MinBound[axis] + centroidBounds.m_MaxBound[axis]) / 2;
+                BVHPrimitiveInfo* ptr = primitiveInfo.data();
+                // clang-format off
+                BVHPrimitiveInfo* midPrimitive = std::partition(ptr + start, ptr + end,
+                    [&bucketIndex, minCostSplitBucket](const BVHPrimitiveInfo& pInfo) {
+                        return bucketIndex(pInfo) <= minCostSplitBucket;
+                    });
+                // clang-format on
+                mid = midPrimitive - ptr;
+                break;
+            }
+            case SplitMethod::Middle:
+            {
+                real midPoint = (centroidBounds.m_MinBound[axis] + centroidBounds.m_MaxBound[axis]) / 2;
                 BVHPrimitiveInfo* ptr = primitiveInfo.data();
                 // clang-format off
                 BVHPrimitiveInfo* midPrimitive = std::partition(ptr + start, ptr + end,
@@ -326,60 +1658,611 @@ namespace yart
                 // clang-format on
                 break;
             }
+            case SplitMethod::HLBVH:
+            case SplitMethod::SBVH:
+            case SplitMethod::COUNT:
+                // HLBVHBuild() and SpatialSplitBuild() build their trees without recursing into here
+                ASSERT(false);
+                break;
+            }
+
+            BVHBuildNode* children[2];
+            if (numPrimitives >= m_Parameters.m_ParallelBuildThreshold)
+            {
+                // The second child gets an arena of its own since it may be built on another thread
+                MemoryArena* childArenas[2] = {&arena, &arenas.Allocate()};
+                i32 childStart[2] = {start, mid};
+                i32 childEnd[2] = {mid, end};
+                // clang-format off
+                ParallelFor([&](i64 i) {
+                    children[i] =
+                        RecursiveBuild(arenas, *childArenas[i], primitiveInfo, childStart[i], childEnd[i], primitiveOrder);
+                }, 2);
+                // clang-format on
+            }
+            else
+            {
+                children[0] = RecursiveBuild(arenas, arena, primitiveInfo, start, mid, primitiveOrder);
+                children[1] = RecursiveBuild(arenas, arena, primitiveInfo, mid, end, primitiveOrder);
             }
 
-            node->InitInterior(axis, RecursiveBuild(arena, primitiveInfo, start, mid, totalNodes, orderedPrimitives),
-                               RecursiveBuild(arena, primitiveInfo, mid, end, totalNodes, orderedPrimitives));
+            node->InitInterior(axis, children[0], children[1]);
         }
         return node;
     }
 
+    // Builds the tree like SplitMethod::SAH, but also considers splitting a node with a plane that cuts through the primitives
+    // straddling it. Their references are clipped to either side of the plane and end up in both children, which trades
+    // duplicate references for children that no longer overlap. Only the bounds of the primitives are known here, so a
+    // reference is clipped by intersecting its bounds with the half space on each side of the plane
     template <typename Spectrum>
-    BVHLinearNode* BVHAccelerator<Spectrum>::FlattenBVHTree(BVHBuildNode* root, i32 totalNodes)
+    BVHBuildNode* BVHAccelerator<Spectrum>::SpatialSplitBuild(MemoryArena& arena, std::vector<BVHPrimitiveInfo>& references,
+                                                              real sceneArea, i32 depth, i32* referenceBudget,
+                                                              std::vector<u32>& primitiveOrder)
     {
-        BVHLinearNode* BVHTree = AllocAligned<BVHLinearNode>(totalNodes);
-        i32 offset = 0;
+        // Every spatial split can leave both children with as many references as their parent, so the depth they are allowed
+        // at is limited to keep the tree within the traversal stack
+        static constexpr i32 MaxSpatialSplitDepth = 48;
 
-        struct TaggedBuildNode
+        BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
+
+        Bounds3f totalBound;
+        Bounds3f centroidBounds;
+        for (const BVHPrimitiveInfo& reference : references)
         {
-            i32 parentOffset;
-            BVHBuildNode* node;
+            totalBound = Union(totalBound, reference.m_Bounds);
+            centroidBounds = Union(centroidBounds, reference.m_Center);
+        }
+
+        const i32 numReferences = references.size();
+        auto initLeaf = [&]() {
+            node->InitLeaf(primitiveOrder.size(), numReferences, totalBound);
+            for (const BVHPrimitiveInfo& reference : references)
+                primitiveOrder.push_back(reference.m_PrimitiveNumber);
+        };
+
+        if (numReferences == 1)
+        {
+            initLeaf();
+            return node;
+        }
+
+        const i32 numBuckets = m_Parameters.m_NumBuckets;
+        BVHBucketInfo* buckets = YART_ALLOCA(BVHBucketInfo, numBuckets);
+
+        // Object split, binned over the reference centroids as in RecursiveBuild()
+        const i32 objectAxis = centroidBounds.MaximumExtent();
+        real objectCost = Infinity;
+        i32 objectSplitBucket = -1;
+        Bounds3f objectBounds[2];
+        auto bucketIndex = [&](const BVHPrimitiveInfo& reference) {
+            i32 b = (i32)(numBuckets * centroidBounds.Offset(reference.m_Center)[objectAxis]);
+            return std::min(b, numBuckets - 1);
+        };
+
+        if (centroidBounds.m_MaxBound[objectAxis] > centroidBounds.m_MinBound[objectAxis])
+        {
+            for (i32 b = 0; b < numBuckets; b++)
+                new (&buckets[b]) BVHBucketInfo();
+
+            for (const BVHPrimitiveInfo& reference : references)
+            {
+                BVHBucketInfo& bucket = buckets[bucketIndex(reference)];
+                bucket.m_Count++;
+                bucket.m_Bounds = Union(bucket.m_Bounds, reference.m_Bounds);
+            }
+
+            objectSplitBucket = MinCostSplitBucket(buckets, totalBound, &objectCost);
+            for (i32 b = 0; b < numBuckets; b++)
+                objectBounds[b > objectSplitBucket] = Union(objectBounds[b > objectSplitBucket], buckets[b].m_Bounds);
+        }
+
+        // Spatial split, only worth looking for if the children of the object split overlap noticeably
+        real spatialCost = Infinity;
+        i32 spatialAxis = -1;
+        real spatialPlane = 0;
+        bool childrenOverlap = objectSplitBucket == -1 || (Overlaps(objectBounds[0], objectBounds[1]) &&
+                                                           Intersect(objectBounds[0], objectBounds[1]).SurfaceArea() >
+                                                               m_Parameters.m_SpatialSplitOverlap * sceneArea);
+        if (*referenceBudget > 0 && depth < MaxSpatialSplitDepth && childrenOverlap)
+        {
+            // A reference enters the bin holding its lower bound and exits the bin holding its upper bound, while its clipped
+            // bounds are added to every bin it spans
+            i32* exitCounts = YART_ALLOCA(i32, numBuckets);
+            real* rightArea = YART_ALLOCA(real, numBuckets);
+            i32* rightCount = YART_ALLOCA(i32, numBuckets);
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                const real minBound = totalBound.m_MinBound[axis];
+                const real binWidth = (totalBound.m_MaxBound[axis] - minBound) / numBuckets;
+                if (binWidth <= 0)
+                    continue;
+
+                for (i32 b = 0; b < numBuckets; b++)
+                {
+                    new (&buckets[b]) BVHBucketInfo();
+                    exitCounts[b] = 0;
+                }
+
+                auto binIndex = [&](real x) {
+                    return Clamp((i32)((x - minBound) / binWidth), 0, numBuckets - 1);
+                };
+
+                for (const BVHPrimitiveInfo& reference : references)
+                {
+                    i32 firstBin = binIndex(reference.m_Bounds.m_MinBound[axis]);
+                    i32 lastBin = std::max(firstBin, binIndex(reference.m_Bounds.m_MaxBound[axis]));
+                    buckets[firstBin].m_Count++;
+                    exitCounts[lastBin]++;
+                    for (i32 b = firstBin; b <= lastBin; b++)
+                    {
+                        Bounds3f clipped = reference.m_Bounds;
+                        clipped.m_MinBound[axis] = std::max(clipped.m_MinBound[axis], minBound + b * binWidth);
+                        clipped.m_MaxBound[axis] = std::min(clipped.m_MaxBound[axis], minBound + (b + 1) * binWidth);
+                        buckets[b].m_Bounds = Union(buckets[b].m_Bounds, clipped);
+                    }
+                }
+
+                Bounds3f sweepBound;
+                i32 sweepCount = 0;
+                for (i32 b = numBuckets - 1; b > 0; b--)
+                {
+                    sweepBound = Union(sweepBound, buckets[b].m_Bounds);
+                    sweepCount += exitCounts[b];
+                    rightArea[b - 1] = sweepCount > 0 ? sweepBound.SurfaceArea() : 0;
+                    rightCount[b - 1] = sweepCount;
+                }
+
+                sweepBound = Bounds3f{};
+                sweepCount = 0;
+                for (i32 b = 0; b < numBuckets - 1; b++)
+                {
+                    sweepBound = Union(sweepBound, buckets[b].m_Bounds);
+                    sweepCount += buckets[b].m_Count;
+                    if (sweepCount == 0 || rightCount[b] == 0)
+                        continue;
 
-            BVHBuildNode* operator->()
+                    real cost = m_Parameters.m_TraversalCost +
+                                m_Parameters.m_IntersectionCost *
+                                    (sweepCount * sweepBound.SurfaceArea() + rightCount[b] * rightArea[b]) /
+                                    totalBound.SurfaceArea();
+                    if (cost < spatialCost)
+                    {
+                        spatialCost = cost;
+                        spatialAxis = axis;
+                        spatialPlane = minBound + (b + 1) * binWidth;
+                    }
+                }
+            }
+        }
+
+        real leafCost = m_Parameters.m_IntersectionCost * numReferences;
+        if (numReferences <= m_MaxPrimsInNode && leafCost <= std::min(objectCost, spatialCost))
+        {
+            initLeaf();
+            return node;
+        }
+
+        i32 axis = objectAxis;
+        std::vector<BVHPrimitiveInfo> childReferences[2];
+        if (spatialCost < objectCost)
+        {
+            axis = spatialAxis;
+            Bounds3f childBounds[2];
+            std::vector<const BVHPrimitiveInfo*> straddling;
+            for (const BVHPrimitiveInfo& reference : references)
             {
+                if (reference.m_Bounds.m_MaxBound[axis] <= spatialPlane)
+                {
+                    childReferences[0].push_back(reference);
+                    childBounds[0] = Union(childBounds[0], reference.m_Bounds);
+                }
+                else if (reference.m_Bounds.m_MinBound[axis] >= spatialPlane)
+                {
+                    childReferences[1].push_back(reference);
+                    childBounds[1] = Union(childBounds[1], reference.m_Bounds);
+                }
+                else
+                {
+                    straddling.push_back(&reference);
+                    childBounds[0] = Union(childBounds[0], reference.m_Bounds);
+                    childBounds[1] = Union(childBounds[1], reference.m_Bounds);
+                    childBounds[0].m_MaxBound[axis] = std::min(childBounds[0].m_MaxBound[axis], spatialPlane);
+                    childBounds[1].m_MinBound[axis] = std::max(childBounds[1].m_MinBound[axis], spatialPlane);
+                }
+            }
+
+            // Clipping a reference only pays off if it costs less than moving the whole reference into one of the children,
+            // which keeps duplicates out of spots where they would not shrink the children
+            for (const BVHPrimitiveInfo* reference : straddling)
+            {
+                i32 numChildReferences[2] = {(i32)childReferences[0].size() + 1, (i32)childReferences[1].size() + 1};
+                real childArea[2] = {childBounds[0].SurfaceArea(), childBounds[1].SurfaceArea()};
+                real splitCost = childArea[0] * numChildReferences[0] + childArea[1] * numChildReferences[1];
+                real unsplitCost[2] = {
+                    Union(childBounds[0], reference->m_Bounds).SurfaceArea() * numChildReferences[0] +
+                        childArea[1] * (numChildReferences[1] - 1),
+                    childArea[0] * (numChildReferences[0] - 1) +
+                        Union(childBounds[1], reference->m_Bounds).SurfaceArea() * numChildReferences[1]};
+
+                if (*referenceBudget > 0 && splitCost < std::min(unsplitCost[0], unsplitCost[1]))
+                {
+                    Bounds3f clipped[2] = {reference->m_Bounds, reference->m_Bounds};
+                    clipped[0].m_MaxBound[axis] = spatialPlane;
+                    clipped[1].m_MinBound[axis] = spatialPlane;
+                    childReferences[0].emplace_back(reference->m_PrimitiveNumber, clipped[0]);
+                    childReferences[1].emplace_back(reference->m_PrimitiveNumber, clipped[1]);
+                    (*referenceBudget)--;
+                }
+                else
+                {
+                    i32 child = unsplitCost[1] < unsplitCost[0];
+                    childReferences[child].push_back(*reference);
+                    childBounds[child] = Union(childBounds[child], reference->m_Bounds);
+                }
+            }
+        }
+        else if (objectSplitBucket != -1)
+        {
+            for (const BVHPrimitiveInfo& reference : references)
+                childReferences[bucketIndex(reference) > objectSplitBucket].push_back(reference);
+        }
+
+        // Neither split applies when all centroids are in the same spot and there is nothing to split spatially. The references
+        // are then partitioned around their median centroid along the axis and divided into equal halves as in RecursiveBuild()
+        if (childReferences[0].empty() || childReferences[1].empty())
+        {
+            if (numReferences <= m_MaxPrimsInNode)
+            {
+                initLeaf();
                 return node;
             }
 
-            BVHBuildNode operator*()
+            axis = objectAxis;
+            // clang-format off
+            std::nth_element(references.begin(), references.begin() + numReferences / 2, references.end(),
+                [axis](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                    return a.m_Center[axis] < b.m_Center[axis];
+                });
+            // clang-format on
+            childReferences[0].assign(references.begin(), references.begin() + numReferences / 2);
+            childReferences[1].assign(references.begin() + numReferences / 2, references.end());
+        }
+
+        // The references of this node are no longer needed, release them before building the subtrees
+        std::vector<BVHPrimitiveInfo>().swap(references);
+
+        BVHBuildNode* children[2];
+        for (i32 i = 0; i < 2; i++)
+            children[i] = SpatialSplitBuild(arena, childReferences[i], sceneArea, depth + 1, referenceBudget, primitiveOrder);
+        node->InitInterior(axis, children[0], children[1]);
+        return node;
+    }
+
+    template <typename Spectrum>
+    BVHBuildNode* BVHAccelerator<Spectrum>::HLBVHBuild(MemoryArena& arena, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                                                       std::vector<u32>& primitiveOrder)
+    {
+        const i32 numPrimitives = primitiveInfo.size();
+
+        Bounds3f centroidBounds;
+        for (const BVHPrimitiveInfo& pInfo : primitiveInfo)
+        {
+            centroidBounds = Union(centroidBounds, pInfo.m_Center);
+        }
+
+        // Quantize primitive centers to a 1024^3 grid over the centroid bounds and sort them along the Morton curve
+        std::vector<MortonPrimitive> mortonPrimitives(numPrimitives);
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            constexpr real mortonScale = 1 << 10;
+            mortonPrimitives[i].m_PrimitiveIndex = i;
+            mortonPrimitives[i].m_MortonCode = EncodeMorton3(centroidBounds.Offset(primitiveInfo[i].m_Center) * mortonScale);
+        }, numPrimitives, 512);
+        // clang-format on
+
+        RadixSort(&mortonPrimitives);
+
+        // Primitives that share the upper 12 bits of their Morton codes lie in the same cell of a 16^3 grid, each cell
+        // becomes a treelet that is built independently
+        std::vector<LBVHTreelet> treeletsToBuild;
+        for (i32 start = 0, end = 1; end <= numPrimitives; end++)
+        {
+            constexpr u32 mask = 0b00111111111111000000000000000000;
+            if (end == numPrimitives ||
+                ((mortonPrimitives[start].m_MortonCode & mask) != (mortonPrimitives[end].m_MortonCode & mask)))
+            {
+                i32 treeletPrimitives = end - start;
+                i32 maxBVHNodes = 2 * treeletPrimitives - 1;
+                BVHBuildNode* nodes = arena.Alloc<BVHBuildNode>(maxBVHNodes, false);
+                treeletsToBuild.push_back({start, treeletPrimitives, nodes});
+                start = end;
+            }
+        }
+
+        // Treelets hold disjoint ranges of the Morton sorted primitives, so each one fills its own range of the primitive order.
+        // The order is the same on every run and the leaves of a treelet cover contiguous ranges in the order they are emitted
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            constexpr i32 firstBitIndex = 29 - 12;
+            LBVHTreelet& treelet = treeletsToBuild[i];
+            BVHBuildNode* buildNodes = treelet.m_BuildNodes;
+            i32 orderedPrimitivesOffset = treelet.m_StartIndex;
+            treelet.m_BuildNodes = EmitLBVH(buildNodes, primitiveInfo, &mortonPrimitives[treelet.m_StartIndex],
+                                            treelet.m_NumPrimitives, primitiveOrder, &orderedPrimitivesOffset,
+                                            firstBitIndex);
+        }, treeletsToBuild.size());
+        // clang-format on
+
+        std::vector<BVHBuildNode*> finishedTreelets;
+        std::unordered_map<const BVHBuildNode*, const LBVHTreelet*> treeletOfRoot;
+        finishedTreelets.reserve(treeletsToBuild.size());
+        for (const LBVHTreelet& treelet : treeletsToBuild)
+        {
+            finishedTreelets.push_back(treelet.m_BuildNodes);
+            treeletOfRoot[treelet.m_BuildNodes] = &treelet;
+        }
+
+        BVHBuildNode* root = BuildUpperSAH(arena, finishedTreelets, 0, finishedTreelets.size());
+
+        // BuildUpperSAH() leaves the treelets in the depth first order of the upper tree, moving their ranges of the primitive
+        // order into the same order keeps the leaves of every subtree of the upper tree on a contiguous range as well
+        std::vector<i32> treeletOffsets(finishedTreelets.size());
+        i32 offset = 0;
+        for (u64 i = 0; i < finishedTreelets.size(); i++)
+        {
+            treeletOffsets[i] = offset;
+            offset += treeletOfRoot[finishedTreelets[i]]->m_NumPrimitives;
+        }
+
+        const std::vector<u32> mortonPrimitiveOrder = primitiveOrder;
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            const LBVHTreelet& treelet = *treeletOfRoot.at(finishedTreelets[i]);
+            std::copy(mortonPrimitiveOrder.begin() + treelet.m_StartIndex,
+                      mortonPrimitiveOrder.begin() + treelet.m_StartIndex + treelet.m_NumPrimitives,
+                      primitiveOrder.begin() + treeletOffsets[i]);
+
+            // EmitLBVH() allocates the nodes of a treelet one after the other, starting with its root
+            BVHBuildNode* treeletNodes = finishedTreelets[i];
+            for (i32 j = 0; j < treeletNodes->m_NumNodes; j++)
+                if (!treeletNodes[j].IsInteriorNode())
+                    treeletNodes[j].m_FirstPrimOffset += treeletOffsets[i] - treelet.m_StartIndex;
+        }, finishedTreelets.size());
+        // clang-format on
+
+        return root;
+    }
+
+    template <typename Spectrum>
+    BVHBuildNode* BVHAccelerator<Spectrum>::EmitLBVH(BVHBuildNode*& buildNodes, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                                                     MortonPrimitive* mortonPrimitives, i32 numPrimitives,
+                                                     std::vector<u32>& primitiveOrder,
+                                                     i32* orderedPrimitivesOffset, i32 bitIndex)
+    {
+        if (numPrimitives <= m_MaxPrimsInNode)
+        {
+            BVHBuildNode* node = buildNodes++;
+            Bounds3f bounds;
+            i32 firstPrimOffset = *orderedPrimitivesOffset;
+            *orderedPrimitivesOffset += numPrimitives;
+            for (i32 i = 0; i < numPrimitives; i++)
             {
-                return *node;
+                const BVHPrimitiveInfo& pInfo = primitiveInfo[mortonPrimitives[i].m_PrimitiveIndex];
+                primitiveOrder[firstPrimOffset + i] = pInfo.m_PrimitiveNumber;
+                bounds = Union(bounds, pInfo.m_Bounds);
+            }
+            node->InitLeaf(firstPrimOffset, numPrimitives, bounds);
+            return node;
+        }
+
+        i32 splitOffset;
+        if (bitIndex < 0)
+        {
+            // Every remaining primitive has the same Morton code, so any split is as good as another
+            splitOffset = numPrimitives / 2;
+        }
+        else
+        {
+            u32 mask = 1 << bitIndex;
+            if ((mortonPrimitives[0].m_MortonCode & mask) == (mortonPrimitives[numPrimitives - 1].m_MortonCode & mask))
+            {
+                return EmitLBVH(buildNodes, primitiveInfo, mortonPrimitives, numPrimitives, primitiveOrder,
+                                orderedPrimitivesOffset, bitIndex - 1);
+            }
+
+            // Primitives are sorted, so find the first one that has the bit set
+            // clang-format off
+            splitOffset = std::partition_point(mortonPrimitives, mortonPrimitives + numPrimitives,
+                [mask](const MortonPrimitive& mortonPrimitive) {
+                    return (mortonPrimitive.m_MortonCode & mask) == 0;
+                }) - mortonPrimitives;
+            // clang-format on
+        }
+
+        BVHBuildNode* node = buildNodes++;
+        BVHBuildNode* child1 = EmitLBVH(buildNodes, primitiveInfo, mortonPrimitives, splitOffset, primitiveOrder,
+                                        orderedPrimitivesOffset, bitIndex - 1);
+        BVHBuildNode* child2 = EmitLBVH(buildNodes, primitiveInfo, &mortonPrimitives[splitOffset], numPrimitives - splitOffset,
+                                        primitiveOrder, orderedPrimitivesOffset, bitIndex - 1);
+
+        // Morton codes interleave bits as zyxzyx..., so the bit index determines the axis that was split
+        i32 axis = std::max(bitIndex, 0) % 3;
+        node->InitInterior(axis, child1, child2);
+        return node;
+    }
+
+    template <typename Spectrum>
+    BVHBuildNode* BVHAccelerator<Spectrum>::BuildUpperSAH(MemoryArena& arena, std::vector<BVHBuildNode*>& treeletRoots,
+                                                          i32 start, i32 end)
+    {
+        i32 numNodes = end - start;
+        if (numNodes == 1)
+            return treeletRoots[start];
+
+        BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
+
+        Bounds3f totalBound, centroidBounds;
+        for (i32 i = start; i < end; i++)
+        {
+            const Bounds3f& bounds = treeletRoots[i]->m_Bounds;
+            totalBound = Union(totalBound, bounds);
+            centroidBounds = Union(centroidBounds, (real)0.5 * (bounds.m_MinBound + bounds.m_MaxBound));
+        }
+
+        i32 axis = centroidBounds.MaximumExtent();
+        i32 mid = (start + end) / 2;
+
+        // Treelets cover disjoint grid cells so their centroids only coincide when there are very few of them, in which
+        // case the default midpoint split is fine
+        if (centroidBounds.m_MaxBound[axis] != centroidBounds.m_MinBound[axis])
+        {
+            const i32 numBuckets = m_Parameters.m_NumBuckets;
+            auto bucketIndex = [&](const BVHBuildNode* treeletRoot) {
+                Vector3f centroid = (real)0.5 * (treeletRoot->m_Bounds.m_MinBound + treeletRoot->m_Bounds.m_MaxBound);
+                i32 b = (i32)(numBuckets * centroidBounds.Offset(centroid)[axis]);
+                return std::min(b, numBuckets - 1);
+            };
+
+            BVHBucketInfo* buckets = YART_ALLOCA(BVHBucketInfo, numBuckets);
+            for (i32 b = 0; b < numBuckets; b++)
+                new (&buckets[b]) BVHBucketInfo();
+
+            for (i32 i = start; i < end; i++)
+            {
+                BVHBucketInfo& bucket = buckets[bucketIndex(treeletRoots[i])];
+                bucket.m_Count++;
+                bucket.m_Bounds = Union(bucket.m_Bounds, treeletRoots[i]->m_Bounds);
+            }
+
+            real minCost;
+            i32 minCostSplitBucket = MinCostSplitBucket(buckets, totalBound, &minCost);
+
+            BVHBuildNode** ptr = treeletRoots.data();
+            // clang-format off
+            BVHBuildNode** midNode = std::partition(ptr + start, ptr + end,
+                [&bucketIndex, minCostSplitBucket](const BVHBuildNode* treeletRoot) {
+                    return bucketIndex(treeletRoot) <= minCostSplitBucket;
+                });
+            // clang-format on
+            mid = midNode - ptr;
+        }
+
+        node->InitInterior(axis, BuildUpperSAH(arena, treeletRoots, start, mid), BuildUpperSAH(arena, treeletRoots, mid, end));
+        return node;
+    }
+
+    template <typename Spectrum>
+    i32 BVHAccelerator<Spectrum>::MinCostSplitBucket(const BVHBucketInfo* buckets, const Bounds3f& totalBound,
+                                                     real* cost) const
+    {
+        const i32 numBuckets = m_Parameters.m_NumBuckets;
+
+        // Sweep from the right to find the area and count of everything above each candidate split plane,
+        // then sweep from the left to evaluate the cost of splitting after bucket b
+        real* rightArea = YART_ALLOCA(real, numBuckets);
+        i32* rightCount = YART_ALLOCA(i32, numBuckets);
+        Bounds3f sweepBound;
+        i32 sweepCount = 0;
+        for (i32 b = numBuckets - 1; b > 0; b--)
+        {
+            sweepBound = Union(sweepBound, buckets[b].m_Bounds);
+            sweepCount += buckets[b].m_Count;
+            rightArea[b - 1] = sweepCount > 0 ? sweepBound.SurfaceArea() : 0;
+            rightCount[b - 1] = sweepCount;
+        }
+
+        real minCost = Infinity;
+        i32 minCostSplitBucket = -1;
+        sweepBound = Bounds3f{};
+        sweepCount = 0;
+        for (i32 b = 0; b < numBuckets - 1; b++)
+        {
+            sweepBound = Union(sweepBound, buckets[b].m_Bounds);
+            sweepCount += buckets[b].m_Count;
+            if (sweepCount == 0 || rightCount[b] == 0)
+                continue;
+
+            real cost = sweepCount * sweepBound.SurfaceArea() + rightCount[b] * rightArea[b];
+            if (cost < minCost)
+            {
+                minCost = cost;
+                minCostSplitBucket = b;
+            }
+        }
+
+        // Normalize to the probability of hitting a child given that the ray hit this node
+        real totalArea = totalBound.SurfaceArea();
+        i32 totalCount = sweepCount + buckets[numBuckets - 1].m_Count;
+        *cost = m_Parameters.m_TraversalCost +
+                m_Parameters.m_IntersectionCost * (totalArea > 0 ? minCost / totalArea : totalCount);
+        return minCostSplitBucket;
+    }
+
+    template <typename Spectrum>
+    BVHLinearNode* BVHAccelerator<Spectrum>::FlattenBVHTree(BVHBuildNode* root)
+    {
+        BVHLinearNode* BVHTree = AllocAligned<BVHLinearNode>(root->m_NumNodes);
+
+        struct TaggedBuildNode
+        {
+            i32 offset;
+            BVHBuildNode* node;
+        };
+
+        // In depth first order a node's first child follows it and its second child follows the entire subtree of the
+        // first child, so the subtree sizes give the offset of every node without having to visit the nodes before it
+        auto flattenNode = [BVHTree](const TaggedBuildNode& taggedNode) {
+            BVHTree[taggedNode.offset].InitFromBuildNode(*taggedNode.node);
+            if (taggedNode.node->IsInteriorNode())
+            {
+                BVHTree[taggedNode.offset].m_SecondChildOffset =
+                    taggedNode.offset + 1 + taggedNode.node->m_Children[0]->m_NumNodes;
             }
         };
 
+        // Split off subtrees that are small enough to be flattened by a single thread
+        std::vector<TaggedBuildNode> subtrees;
         std::vector<TaggedBuildNode> unvisitedNodes;
         unvisitedNodes.reserve(64);
-
-        unvisitedNodes.push_back({-1, root});
+        unvisitedNodes.push_back({0, root});
 
         while (unvisitedNodes.size() != 0)
         {
             TaggedBuildNode node = unvisitedNodes.back();
             unvisitedNodes.pop_back();
 
-            if (node.parentOffset != -1)
+            if (node.node->m_NumNodes < m_Parameters.m_ParallelBuildThreshold || !node.node->IsInteriorNode())
             {
-                BVHTree[node.parentOffset].m_SecondChildOffset = offset;
+                subtrees.push_back(node);
+                continue;
             }
 
-            if (node->IsInteriorNode())
+            flattenNode(node);
+            unvisitedNodes.push_back({BVHTree[node.offset].m_SecondChildOffset, node.node->m_Children[1]});
+            unvisitedNodes.push_back({node.offset + 1, node.node->m_Children[0]});
+        }
+
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            std::vector<TaggedBuildNode> unvisitedSubtreeNodes;
+            unvisitedSubtreeNodes.reserve(64);
+            unvisitedSubtreeNodes.push_back(subtrees[i]);
+
+            while (unvisitedSubtreeNodes.size() != 0)
             {
-                unvisitedNodes.push_back({offset, node->m_Children[1]});
-                unvisitedNodes.push_back({-1, node->m_Children[0]});
-            }
+                TaggedBuildNode node = unvisitedSubtreeNodes.back();
+                unvisitedSubtreeNodes.pop_back();
 
-            BVHTree[offset].InitFromBuildNode(*node);
-            offset++;
-        }
+                flattenNode(node);
+                if (node.node->IsInteriorNode())
+                {
+                    unvisitedSubtreeNodes.push_back({BVHTree[node.offset].m_SecondChildOffset, node.node->m_Children[1]});
+                    unvisitedSubtreeNodes.push_back({node.offset + 1, node.node->m_Children[0]});
+                }
+            }
+        }, subtrees.size());
+        // clang-format on
 
         return BVHTree;
     }
@@ -0,0 +1,251 @@
+#pragma once
+#include "accelerators/bvh.h"
+#include "core/primitive.h"
+#include "core/statistics.h"
+#include <vector>
+
+namespace yart
+{
+    struct DynamicBVHNode
+    {
+        inline bool IsLeaf() const
+        {
+            return m_Children[0] == -1;
+        }
+
+        Bounds3f m_Bounds;
+        i32 m_Parent = -1; // Next free node for nodes on the free list
+        i32 m_Children[2] = {-1, -1};
+        i32 m_Height = 0; // 0 for leaves
+        u8 m_SplitAxis = 0; // Axis along which the centroid of the first child is not above the one of the second child
+    };
+
+    // Binary BVH with one leaf per item that is kept up to date while items are inserted and removed. A new leaf is paired with
+    // the node whose bounds grow the tree the least, found with a branch and bound search, and every node on the way back up
+    // to the root is rotated whenever swapping a child with a grandchild shrinks the tree. Node indices of leaves stay valid
+    // until the leaf is removed, so they double as handles for the items
+    class DynamicBVHTree
+    {
+    public:
+        // Returns the leaf node holding the item
+        i32 Insert(const Bounds3f& bounds);
+        void Remove(i32 leaf);
+        void Move(i32 leaf, const Bounds3f& bounds);
+
+        const DynamicBVHNode& Node(i32 index) const
+        {
+            return m_Nodes[index];
+        }
+
+        // -1 if the tree is empty
+        i32 Root() const
+        {
+            return m_Root;
+        }
+
+        // Number of levels below the root
+        i32 Height() const
+        {
+            return m_Root == -1 ? 0 : m_Nodes[m_Root].m_Height;
+        }
+
+        i32 NumLeaves() const
+        {
+            return m_NumLeaves;
+        }
+
+        // Upper bound on node indices, including free nodes
+        i32 Capacity() const
+        {
+            return (i32)m_Nodes.size();
+        }
+
+        // Expected cost of intersecting a ray with the tree, see BVHAccelerator::SAHCost()
+        real SAHCost(real traversalCost, real intersectionCost) const;
+
+    private:
+        i32 AllocateNode();
+        void FreeNode(i32 index);
+        void InsertLeaf(i32 leaf);
+        void RemoveLeaf(i32 leaf);
+        i32 FindBestSibling(const Bounds3f& bounds) const;
+        void RefitAncestors(i32 index);
+        void Rotate(i32 index);
+        void UpdateNode(i32 index);
+
+    private:
+        std::vector<DynamicBVHNode> m_Nodes;
+        i32 m_Root = -1;
+        i32 m_FreeList = -1;
+        i32 m_NumLeaves = 0;
+    };
+
+    // Aggregate for scenes that are edited while they are rendered, such as interactive sessions, where rebuilding a
+    // BVHAccelerator after every edit is too slow. Insertion and removal take O(log n) for reasonably distributed primitives,
+    // at the price of trees somewhat worse than a full SAH build. Edits must not run concurrently with intersection queries
+    template <typename Spectrum>
+    class DynamicBVHAccelerator final : public AbstractAggregate<Spectrum>
+    {
+    public:
+        using AbstractPrimitive = yart::AbstractPrimitive<Spectrum>;
+        using MaterialInteraction = yart::MaterialInteraction<Spectrum>;
+
+        DynamicBVHAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives = {});
+
+        virtual Bounds3f WorldBound() const override;
+        virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const override;
+        virtual bool IntersectRay(const Ray& ray) const override;
+        virtual std::string ReportStatistics() const override;
+
+        // Returns a handle identifying the primitive in Remove() and Update()
+        i32 Insert(const Ref<AbstractPrimitive>& primitive);
+        void Remove(i32 handle);
+
+        // Moves a primitive whose WorldBound() changed since it was inserted to its new place in the tree
+        void Update(i32 handle);
+
+        i32 NumPrimitives() const
+        {
+            return m_Tree.NumLeaves();
+        }
+
+        // SAH cost under the default cost model of BVHBuildParameters, to compare the tree to a full build
+        real SAHCost() const;
+
+    private:
+        template <bool AnyHit>
+        bool Traverse(const Ray& ray, MaterialInteraction* materialInteraction) const;
+
+    private:
+        DynamicBVHTree m_Tree;
+        std::vector<Ref<AbstractPrimitive>> m_Primitives; // Indexed by the leaf node holding the primitive
+    };
+
+    template <typename Spectrum>
+    DynamicBVHAccelerator<Spectrum>::DynamicBVHAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives)
+    {
+        for (const Ref<AbstractPrimitive>& primitive : primitives)
+            Insert(primitive);
+    }
+
+    template <typename Spectrum>
+    Bounds3f DynamicBVHAccelerator<Spectrum>::WorldBound() const
+    {
+        if (m_Tree.Root() == -1)
+            return Bounds3f{};
+
+        return m_Tree.Node(m_Tree.Root()).m_Bounds;
+    }
+
+    template <typename Spectrum>
+    i32 DynamicBVHAccelerator<Spectrum>::Insert(const Ref<AbstractPrimitive>& primitive)
+    {
+        i32 leaf = m_Tree.Insert(primitive->WorldBound());
+        if (leaf >= (i32)m_Primitives.size())
+            m_Primitives.resize(m_Tree.Capacity());
+
+        m_Primitives[leaf] = primitive;
+        return leaf;
+    }
+
+    template <typename Spectrum>
+    void DynamicBVHAccelerator<Spectrum>::Remove(i32 handle)
+    {
+        ASSERT(handle >= 0 && handle < (i32)m_Primitives.size() && m_Primitives[handle]);
+        m_Tree.Remove(handle);
+        m_Primitives[handle] = nullptr;
+    }
+
+    template <typename Spectrum>
+    void DynamicBVHAccelerator<Spectrum>::Update(i32 handle)
+    {
+        ASSERT(handle >= 0 && handle < (i32)m_Primitives.size() && m_Primitives[handle]);
+        m_Tree.Move(handle, m_Primitives[handle]->WorldBound());
+    }
+
+    template <typename Spectrum>
+    real DynamicBVHAccelerator<Spectrum>::SAHCost() const
+    {
+        BVHBuildParameters parameters;
+        return m_Tree.SAHCost(parameters.m_TraversalCost, parameters.m_IntersectionCost);
+    }
+
+    template <typename Spectrum>
+    std::string DynamicBVHAccelerator<Spectrum>::ReportStatistics() const
+    {
+        return fmt::format("{{\"type\": \"DynamicBVH\", \"primitives\": {}, \"nodes\": {}, \"depth\": {}, \"sahCost\": {:.4f}, "
+                           "\"nodeBytes\": {}}}",
+                           m_Tree.NumLeaves(), std::max(0, 2 * m_Tree.NumLeaves() - 1), m_Tree.Height() + 1, SAHCost(),
+                           m_Tree.Capacity() * sizeof(DynamicBVHNode));
+    }
+
+    template <typename Spectrum>
+    bool DynamicBVHAccelerator<Spectrum>::IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        return Traverse<false>(ray, materialInteraction);
+    }
+
+    template <typename Spectrum>
+    bool DynamicBVHAccelerator<Spectrum>::IntersectRay(const Ray& ray) const
+    {
+        return Traverse<true>(ray, nullptr);
+    }
+
+    template <typename Spectrum>
+    template <bool AnyHit>
+    bool DynamicBVHAccelerator<Spectrum>::Traverse(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        if (m_Tree.Root() == -1)
+            return false;
+        COUNT_TRAVERSAL(m_RayQueries, 1);
+
+        bool hit = false;
+        Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+        i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
+
+        // Rotations only keep the tree shallow for reasonable insertion orders, so deep trees fall back to a heap stack
+        i32 fixedStack[MaxBVHTraversalDepth];
+        std::vector<i32> heapStack;
+        i32* unvisitedNodes = fixedStack;
+        if (m_Tree.Height() >= MaxBVHTraversalDepth)
+        {
+            heapStack.resize(m_Tree.Height() + 1);
+            unvisitedNodes = heapStack.data();
+        }
+
+        i32 unvisitedOffset = 0, currentNodeOffset = m_Tree.Root();
+        while (true)
+        {
+            const DynamicBVHNode& node = m_Tree.Node(currentNodeOffset);
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+            COUNT_TRAVERSAL(m_BoxesTested, 1);
+
+            if (node.m_Bounds.IntersectRay(ray, invRayDir, dirIsNeg))
+            {
+                if (!node.IsLeaf())
+                {
+                    i32 nearChild = dirIsNeg[node.m_SplitAxis];
+                    unvisitedNodes[unvisitedOffset++] = node.m_Children[1 - nearChild];
+                    currentNodeOffset = node.m_Children[nearChild];
+                    continue;
+                }
+
+                COUNT_TRAVERSAL(m_PrimitivesTested, 1);
+                if (AnyHit)
+                {
+                    if (m_Primitives[currentNodeOffset]->IntersectRay(ray))
+                        return true;
+                }
+                else if (m_Primitives[currentNodeOffset]->IntersectRay(ray, materialInteraction))
+                    hit = true;
+            }
+
+            if (unvisitedOffset == 0)
+                break;
+
+            currentNodeOffset = unvisitedNodes[--unvisitedOffset];
+        }
+
+        return hit;
+    }
+}
@@ -0,0 +1,291 @@
+#pragma once
+#include "core/parallel.h"
+#include "core/primitive.h"
+#include "core/statistics.h"
+#include <vector>
+
+namespace yart
+{
+    // Resolution of the grid, given as the number of cells per primitive. The cells are as close to cubes as the bounds allow
+    struct GridBuildParameters
+    {
+        real m_Density = 1;        // Cells per primitive of a single level grid, or of every nested grid of a two level one
+        bool m_TwoLevel = false;   // Whether cells holding many primitives get a nested grid of their own
+        real m_TopDensity = 0.125; // Cells per primitive of the top level of a two level grid
+        i32 m_MaxPrimsInCell = 16; // Cells of a two level grid referencing more primitives than this get a nested grid
+        i32 m_MaxResolution = 512; // Upper limit on the number of cells along each axis of any grid
+    };
+
+    // A cell either refers to a range of primitive indices or, in the top level of a two level grid, to a nested grid
+    struct GridCell
+    {
+        inline bool HasNestedGrid() const
+        {
+            return m_NumPrimitives < 0;
+        }
+
+        i32 m_Offset;        // First entry in the primitive indices, or the index of the nested grid
+        i32 m_NumPrimitives; // -1 for cells holding a nested grid
+    };
+
+    // A uniform grid over its bounds, whose cells are stored in x, then y, then z order from m_FirstCell on
+    struct GridLevel
+    {
+        Bounds3f m_Bounds;
+        Vector3f m_CellSize;
+        Vector3f m_InvCellSize;
+        Vector3i m_Resolution;
+        i32 m_FirstCell;
+    };
+
+    // Primitives overlapping several cells would be tested again in every cell a ray crosses. Remembering the last few
+    // primitives tested against a ray skips most of those repeated tests, without per-primitive mailboxes that every thread
+    // tracing rays would share
+    struct GridMailbox
+    {
+        static constexpr i32 Size = 8;
+
+        // Returns false if the primitive was among the last Size primitives added
+        inline bool Add(i32 primitive)
+        {
+            for (i32 entry : m_Primitives)
+                if (entry == primitive)
+                    return false;
+            m_Primitives[m_Next] = primitive;
+            m_Next = (m_Next + 1) % Size;
+            return true;
+        }
+
+        i32 m_Primitives[Size] = {-1, -1, -1, -1, -1, -1, -1, -1};
+        i32 m_Next = 0;
+    };
+
+    // Builds the grid over the bounds of the primitives. The first entry of grids is the top level, followed by the nested
+    // grids of a two level grid. Primitives are referenced from every cell their bounds overlap
+    void BuildGrid(const std::vector<Bounds3f>& primitiveBounds, const GridBuildParameters& parameters,
+                   std::vector<GridLevel>* grids, std::vector<GridCell>* cells, std::vector<i32>* primitiveIndices);
+
+    // Aggregate binning primitives into the cells of a uniform grid, which is walked cell by cell with a 3D-DDA. The build is a
+    // parallel counting sort and takes linear time, which makes it far cheaper than a BVH build for scenes of many similarly
+    // sized primitives spread evenly over space. With two levels, crowded cells are subdivided once more, so clustered scenes
+    // do not pile many primitives into a single cell
+    template <typename Spectrum>
+    class GridAccelerator final : public AbstractAggregate<Spectrum>
+    {
+    public:
+        using AbstractPrimitive = yart::AbstractPrimitive<Spectrum>;
+        using MaterialInteraction = yart::MaterialInteraction<Spectrum>;
+
+        GridAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives,
+                        const GridBuildParameters& parameters = GridBuildParameters{});
+
+        virtual Bounds3f WorldBound() const override;
+        virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const override;
+        virtual bool IntersectRay(const Ray& ray) const override;
+        virtual std::string ReportStatistics() const override;
+
+        i32 NumGrids() const
+        {
+            return (i32)m_Grids.size();
+        }
+
+        i32 NumCells() const
+        {
+            return (i32)m_Cells.size();
+        }
+
+    private:
+        template <bool AnyHit>
+        bool Traverse(const GridLevel& grid, const Ray& ray, real tMin, real tMax, GridMailbox& mailbox,
+                      MaterialInteraction* materialInteraction) const;
+
+    private:
+        std::vector<Ref<AbstractPrimitive>> m_Primitives;
+        std::vector<Bounds3f> m_PrimitiveBounds;
+        std::vector<GridLevel> m_Grids;
+        std::vector<GridCell> m_Cells;
+        std::vector<i32> m_PrimitiveIndices;
+    };
+
+    template <typename Spectrum>
+    GridAccelerator<Spectrum>::GridAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives,
+                                               const GridBuildParameters& parameters)
+        : m_Primitives(primitives)
+    {
+        if (m_Primitives.empty())
+            return;
+
+        m_PrimitiveBounds.resize(m_Primitives.size());
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            m_PrimitiveBounds[i] = m_Primitives[i]->WorldBound();
+        }, m_Primitives.size(), 4096);
+        // clang-format on
+
+        BuildGrid(m_PrimitiveBounds, parameters, &m_Grids, &m_Cells, &m_PrimitiveIndices);
+    }
+
+    template <typename Spectrum>
+    Bounds3f GridAccelerator<Spectrum>::WorldBound() const
+    {
+        return m_Grids.empty() ? Bounds3f{} : m_Grids[0].m_Bounds;
+    }
+
+    template <typename Spectrum>
+    std::string GridAccelerator<Spectrum>::ReportStatistics() const
+    {
+        i32 numEmptyCells = 0;
+        for (const GridCell& cell : m_Cells)
+            numEmptyCells += cell.m_NumPrimitives == 0;
+
+        Vector3i resolution = m_Grids.empty() ? Vector3i{0, 0, 0} : m_Grids[0].m_Resolution;
+        return fmt::format("{{\"type\": \"Grid\", \"primitives\": {}, \"resolution\": [{}, {}, {}], \"nestedGrids\": {}, "
+                           "\"cells\": {}, \"emptyCells\": {}, \"primitiveReferences\": {}, \"nodeBytes\": {}}}",
+                           m_Primitives.size(), resolution.x, resolution.y, resolution.z,
+                           std::max((i32)m_Grids.size() - 1, 0), m_Cells.size(), numEmptyCells, m_PrimitiveIndices.size(),
+                           m_Grids.size() * sizeof(GridLevel) + m_Cells.size() * sizeof(GridCell) +
+                               m_PrimitiveIndices.size() * sizeof(i32) + m_PrimitiveBounds.size() * sizeof(Bounds3f));
+    }
+
+    template <typename Spectrum>
+    bool GridAccelerator<Spectrum>::IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        if (m_Grids.empty())
+            return false;
+        COUNT_TRAVERSAL(m_RayQueries, 1);
+
+        real tMin, tMax;
+        if (!m_Grids[0].m_Bounds.IntersectRay(ray, &tMin, &tMax))
+            return false;
+        GridMailbox mailbox;
+        return Traverse<false>(m_Grids[0], ray, tMin, tMax, mailbox, materialInteraction);
+    }
+
+    template <typename Spectrum>
+    bool GridAccelerator<Spectrum>::IntersectRay(const Ray& ray) const
+    {
+        if (m_Grids.empty())
+            return false;
+        COUNT_TRAVERSAL(m_RayQueries, 1);
+
+        real tMin, tMax;
+        if (!m_Grids[0].m_Bounds.IntersectRay(ray, &tMin, &tMax))
+            return false;
+        GridMailbox mailbox;
+        return Traverse<true>(m_Grids[0], ray, tMin, tMax, mailbox, nullptr);
+    }
+
+    // Steps through the cells pierced by the ray between tMin and tMax in order. A primitive overlapping several cells may
+    // be hit beyond the cell it was tested in, so the walk only stops once the closest hit lies within the current cell.
+    // Cells are much coarser than the boxes of BVH leaves, so the bounds of every primitive are tested before the primitive
+    template <typename Spectrum>
+    template <bool AnyHit>
+    bool GridAccelerator<Spectrum>::Traverse(const GridLevel& grid, const Ray& ray, real tMin, real tMax, GridMailbox& mailbox,
+                                             MaterialInteraction* materialInteraction) const
+    {
+        COUNT_TRAVERSAL(m_BoxesTested, 1);
+
+        const Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+        const i32 dirIsNeg[3] = {invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0};
+        i32 cell[3], step[3], out[3];
+        real nextCrossingT[3], deltaT[3];
+        const Vector3f entry = ray(tMin);
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            // Rounding may put the entry point just outside of the grid, so the cell is clamped
+            cell[axis] = Clamp((i32)((entry[axis] - grid.m_Bounds.m_MinBound[axis]) * grid.m_InvCellSize[axis]), 0,
+                               grid.m_Resolution[axis] - 1);
+            if (ray.d[axis] == 0)
+            {
+                nextCrossingT[axis] = Infinity;
+                deltaT[axis] = Infinity;
+                step[axis] = 0;
+                out[axis] = -1;
+            }
+            else if (ray.d[axis] > 0)
+            {
+                real nextPlane = grid.m_Bounds.m_MinBound[axis] + (cell[axis] + 1) * grid.m_CellSize[axis];
+                nextCrossingT[axis] = tMin + (nextPlane - entry[axis]) / ray.d[axis];
+                deltaT[axis] = grid.m_CellSize[axis] / ray.d[axis];
+                step[axis] = 1;
+                out[axis] = grid.m_Resolution[axis];
+            }
+            else
+            {
+                real nextPlane = grid.m_Bounds.m_MinBound[axis] + cell[axis] * grid.m_CellSize[axis];
+                nextCrossingT[axis] = tMin + (nextPlane - entry[axis]) / ray.d[axis];
+                deltaT[axis] = -grid.m_CellSize[axis] / ray.d[axis];
+                step[axis] = -1;
+                out[axis] = -1;
+            }
+        }
+
+        bool hit = false;
+        real tCellEntry = tMin;
+        while (true)
+        {
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+
+            // The axis whose cell boundary the ray crosses first is the one it steps along next
+            i32 stepAxis = nextCrossingT[0] < nextCrossingT[1] ? (nextCrossingT[0] < nextCrossingT[2] ? 0 : 2)
+                                                               : (nextCrossingT[1] < nextCrossingT[2] ? 1 : 2);
+            real tCellExit = std::min(nextCrossingT[stepAxis], tMax);
+
+            const GridCell& gridCell =
+                m_Cells[grid.m_FirstCell + (cell[2] * grid.m_Resolution.y + cell[1]) * grid.m_Resolution.x + cell[0]];
+            if (gridCell.HasNestedGrid())
+            {
+                // Nested grids are fitted to the primitives in the cell, so the ray may miss them even though it crosses
+                // the cell
+                const GridLevel& nestedGrid = m_Grids[gridCell.m_Offset];
+                real tNestedMin, tNestedMax;
+                if (nestedGrid.m_Bounds.IntersectRay(ray, &tNestedMin, &tNestedMax))
+                {
+                    tNestedMin = std::max(tNestedMin, tCellEntry);
+                    tNestedMax = std::min(tNestedMax, tCellExit);
+                    if (tNestedMin <= tNestedMax &&
+                        Traverse<AnyHit>(nestedGrid, ray, tNestedMin, tNestedMax, mailbox, materialInteraction))
+                    {
+                        if (AnyHit)
+                            return true;
+                        hit = true;
+                    }
+                }
+            }
+            else
+            {
+                for (i32 i = 0; i < gridCell.m_NumPrimitives; i++)
+                {
+                    i32 primitiveIndex = m_PrimitiveIndices[gridCell.m_Offset + i];
+                    if (!mailbox.Add(primitiveIndex))
+                        continue;
+
+                    COUNT_TRAVERSAL(m_BoxesTested, 1);
+                    if (!m_PrimitiveBounds[primitiveIndex].IntersectRay(ray, invRayDir, dirIsNeg))
+                        continue;
+
+                    COUNT_TRAVERSAL(m_PrimitivesTested, 1);
+                    const Ref<AbstractPrimitive>& primitive = m_Primitives[primitiveIndex];
+                    if (AnyHit)
+                    {
+                        if (primitive->IntersectRay(ray))
+                            return true;
+                    }
+                    else if (primitive->IntersectRay(ray, materialInteraction))
+                        hit = true;
+                }
+            }
+
+            if (ray.m_Tmax <= tCellExit || tCellExit >= tMax)
+                break;
+
+            cell[stepAxis] += step[stepAxis];
+            if (cell[stepAxis] == out[stepAxis])
+                break;
+            tCellEntry = nextCrossingT[stepAxis];
+            nextCrossingT[stepAxis] += deltaT[stepAxis];
+        }
+
+        return hit;
+    }
+}
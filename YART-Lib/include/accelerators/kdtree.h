@@ -0,0 +1,239 @@
+#pragma once
+#include "core/primitive.h"
+#include "core/statistics.h"
+#include <vector>
+
+namespace yart
+{
+    // Cost model and limits of the SAH kd-tree build. Costs are relative, only their ratio affects the shape of the tree
+    struct KdTreeBuildParameters
+    {
+        real m_IntersectionCost = 80; // Cost of a single ray-primitive intersection test
+        real m_TraversalCost = 1;     // Cost of visiting an interior node
+        real m_EmptyBonus = 0.5;      // Fraction of the cost saved by splits that leave one side empty
+        i32 m_MaxPrimsInNode = 1;
+        i32 m_MaxDepth = -1; // -1 picks 8 + 1.3 log2(number of primitives)
+    };
+
+    // Deepest level of a kd-tree, traversal keeps at most one pending node per level
+    static constexpr i32 MaxKdTreeDepth = 64;
+
+    // Interior nodes store their split position and leaves the primitives they overlap. The lower two bits of the second
+    // word hold the split axis, or 3 for leaves, and the upper bits the number of primitives of a leaf or the offset of the
+    // child above the split. The child below the split directly follows its parent
+    struct KdTreeNode
+    {
+        inline bool IsLeaf() const
+        {
+            return (m_Flags & 3) == 3;
+        }
+
+        inline i32 SplitAxis() const
+        {
+            return m_Flags & 3;
+        }
+
+        inline i32 NumPrimitives() const
+        {
+            return m_NumPrimitives >> 2;
+        }
+
+        inline i32 AboveChild() const
+        {
+            return m_AboveChild >> 2;
+        }
+
+        union
+        {
+            real m_Split;                  // Interior node
+            i32 m_OnePrimitive;            // Leaf node with a single primitive
+            i32 m_PrimitiveIndicesOffset;  // Leaf node with several primitives, offset into the primitive indices
+        };
+        union
+        {
+            u32 m_Flags;
+            u32 m_NumPrimitives; // Leaf node
+            u32 m_AboveChild;    // Interior node
+        };
+    };
+#if !defined(USE_DOUBLE_PRECISION_FLOAT)
+    static_assert(sizeof(KdTreeNode) == 8);
+#endif
+
+    // Builds the tree over the bounds of the primitives. Leaves with more than one primitive refer to the primitives through
+    // primitiveIndices, since primitives overlapping a split plane end up in more than one leaf
+    void BuildKdTree(const std::vector<Bounds3f>& primitiveBounds, const KdTreeBuildParameters& parameters,
+                     std::vector<KdTreeNode>* nodes, std::vector<i32>* primitiveIndices);
+
+    // Aggregate splitting space with axis aligned planes chosen by the SAH. Unlike a BVH, nodes do not overlap, so traversal
+    // visits them strictly front to back and stops at the first node that lies beyond the closest hit. That suits static,
+    // densely packed scenes, while BVHAccelerator handles primitives of very different sizes better
+    template <typename Spectrum>
+    class KdTreeAccelerator final : public AbstractAggregate<Spectrum>
+    {
+    public:
+        using AbstractPrimitive = yart::AbstractPrimitive<Spectrum>;
+        using MaterialInteraction = yart::MaterialInteraction<Spectrum>;
+
+        KdTreeAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives,
+                          const KdTreeBuildParameters& parameters = KdTreeBuildParameters{});
+
+        virtual Bounds3f WorldBound() const override;
+        virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const override;
+        virtual bool IntersectRay(const Ray& ray) const override;
+        virtual std::string ReportStatistics() const override;
+
+        i32 NumNodes() const
+        {
+            return (i32)m_Nodes.size();
+        }
+
+    private:
+        template <bool AnyHit>
+        bool Traverse(const Ray& ray, MaterialInteraction* materialInteraction) const;
+
+    private:
+        std::vector<Ref<AbstractPrimitive>> m_Primitives;
+        std::vector<i32> m_PrimitiveIndices;
+        std::vector<KdTreeNode> m_Nodes;
+        Bounds3f m_Bounds;
+    };
+
+    template <typename Spectrum>
+    KdTreeAccelerator<Spectrum>::KdTreeAccelerator(const std::vector<Ref<AbstractPrimitive>>& primitives,
+                                                   const KdTreeBuildParameters& parameters)
+        : m_Primitives(primitives)
+    {
+        if (m_Primitives.empty())
+            return;
+
+        std::vector<Bounds3f> primitiveBounds(m_Primitives.size());
+        for (u64 i = 0; i < m_Primitives.size(); i++)
+        {
+            primitiveBounds[i] = m_Primitives[i]->WorldBound();
+            m_Bounds = Union(m_Bounds, primitiveBounds[i]);
+        }
+
+        BuildKdTree(primitiveBounds, parameters, &m_Nodes, &m_PrimitiveIndices);
+    }
+
+    template <typename Spectrum>
+    Bounds3f KdTreeAccelerator<Spectrum>::WorldBound() const
+    {
+        return m_Bounds;
+    }
+
+    template <typename Spectrum>
+    std::string KdTreeAccelerator<Spectrum>::ReportStatistics() const
+    {
+        i32 numLeaves = 0, numReferences = 0, numEmptyLeaves = 0;
+        for (const KdTreeNode& node : m_Nodes)
+        {
+            if (!node.IsLeaf())
+                continue;
+
+            numLeaves++;
+            numReferences += node.NumPrimitives();
+            numEmptyLeaves += node.NumPrimitives() == 0;
+        }
+
+        return fmt::format("{{\"type\": \"KdTree\", \"primitives\": {}, \"nodes\": {}, \"leaves\": {}, \"emptyLeaves\": {}, "
+                           "\"primitiveReferences\": {}, \"nodeBytes\": {}}}",
+                           m_Primitives.size(), m_Nodes.size(), numLeaves, numEmptyLeaves, numReferences,
+                           m_Nodes.size() * sizeof(KdTreeNode) + m_PrimitiveIndices.size() * sizeof(i32));
+    }
+
+    template <typename Spectrum>
+    bool KdTreeAccelerator<Spectrum>::IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        return Traverse<false>(ray, materialInteraction);
+    }
+
+    template <typename Spectrum>
+    bool KdTreeAccelerator<Spectrum>::IntersectRay(const Ray& ray) const
+    {
+        return Traverse<true>(ray, nullptr);
+    }
+
+    template <typename Spectrum>
+    template <bool AnyHit>
+    bool KdTreeAccelerator<Spectrum>::Traverse(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        if (m_Nodes.empty())
+            return false;
+        COUNT_TRAVERSAL(m_RayQueries, 1);
+        COUNT_TRAVERSAL(m_BoxesTested, 1);
+
+        real tMin, tMax;
+        if (!m_Bounds.IntersectRay(ray, &tMin, &tMax))
+            return false;
+
+        struct UnvisitedNode
+        {
+            const KdTreeNode* node;
+            real tMin, tMax;
+        };
+
+        bool hit = false;
+        Vector3f invRayDir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+        i32 unvisitedOffset = 0;
+        UnvisitedNode unvisitedNodes[MaxKdTreeDepth]; // Acts as a stack for DFS traveral
+        const KdTreeNode* node = &m_Nodes[0];
+        while (node)
+        {
+            // Nodes are visited front to back, so nothing further away can be closer than a hit that was already found
+            if (ray.m_Tmax < tMin)
+                break;
+            COUNT_TRAVERSAL(m_NodesVisited, 1);
+
+            if (!node->IsLeaf())
+            {
+                i32 axis = node->SplitAxis();
+                real tPlane = (node->m_Split - ray.o[axis]) * invRayDir[axis];
+
+                bool belowFirst = ray.o[axis] < node->m_Split || (ray.o[axis] == node->m_Split && ray.d[axis] <= 0);
+                const KdTreeNode* firstChild = belowFirst ? node + 1 : &m_Nodes[node->AboveChild()];
+                const KdTreeNode* secondChild = belowFirst ? &m_Nodes[node->AboveChild()] : node + 1;
+
+                // The ray only crosses the split plane inside the node if tPlane lies in [tMin, tMax]
+                if (tPlane > tMax || tPlane <= 0)
+                    node = firstChild;
+                else if (tPlane < tMin)
+                    node = secondChild;
+                else
+                {
+                    ASSERT(unvisitedOffset < MaxKdTreeDepth);
+                    unvisitedNodes[unvisitedOffset++] = {secondChild, tPlane, tMax};
+                    node = firstChild;
+                    tMax = tPlane;
+                }
+                continue;
+            }
+
+            i32 numPrimitives = node->NumPrimitives();
+            COUNT_TRAVERSAL(m_PrimitivesTested, numPrimitives);
+            for (i32 i = 0; i < numPrimitives; i++)
+            {
+                i32 primitiveIndex =
+                    numPrimitives == 1 ? node->m_OnePrimitive : m_PrimitiveIndices[node->m_PrimitiveIndicesOffset + i];
+                if (AnyHit)
+                {
+                    if (m_Primitives[primitiveIndex]->IntersectRay(ray))
+                        return true;
+                }
+                else if (m_Primitives[primitiveIndex]->IntersectRay(ray, materialInteraction))
+                    hit = true;
+            }
+
+            if (unvisitedOffset == 0)
+                break;
+
+            --unvisitedOffset;
+            node = unvisitedNodes[unvisitedOffset].node;
+            tMin = unvisitedNodes[unvisitedOffset].tMin;
+            tMax = unvisitedNodes[unvisitedOffset].tMax;
+        }
+
+        return hit;
+    }
+}
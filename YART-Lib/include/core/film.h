@@ -4,12 +4,57 @@
 #include "core/memoryutil.h"
 #include "core/parallel.h"
 #include "core/spectrum.h"
+#include "core/varianceestimator.h"
 #include "core/yart.h"
 #include "filters/filter.h"
+#include "math/util.h"
 #include "math/vector.h"
+#include <mutex>
+#include <vector>
 
 namespace yart
 {
+    // Accumulates the samples of one part of the image on a single thread, without any synchronization. The tile covers every
+    // pixel that samples in its sample bounds contribute to, which includes a border of the filter radius around them, and
+    // is added to the film with Film::MergeFilmTile once it is complete. Besides the filtered color, every pixel keeps the
+    // mean and variance of the luminance of the samples taken inside of it
+    class FilmTile
+    {
+    public:
+        FilmTile(const Bounds2i& pixelBounds, const Vector2f& filterRadius, const real* filterTable, i32 filterTableWidth);
+
+        template <typename Spectrum>
+        void AddSample(const Vector2f& filmPoint, const Spectrum& L, real sampleWeight = 1);
+
+        const Bounds2i& GetPixelBounds() const
+        {
+            return m_PixelBounds;
+        }
+
+    private:
+        friend class Film;
+
+        struct Pixel
+        {
+            std::array<real, 3> xyz = {0, 0, 0};
+            real FilterWeightSum = 0;
+            VarianceEstimator Luminance;
+        };
+
+        Pixel& GetPixel(const Vector2i& point)
+        {
+            Vector2i offset = point - m_PixelBounds.m_MinBound;
+            return m_Pixels[offset.y * m_PixelBounds.Diagonal().x + offset.x];
+        }
+
+    private:
+        const Bounds2i m_PixelBounds;
+        const Vector2f m_FilterRadius, m_InvFilterRadius;
+        const real* m_FilterTable;
+        const i32 m_FilterTableWidth;
+        std::vector<Pixel> m_Pixels;
+    };
+
     class Film
     {
     public:
@@ -21,8 +66,19 @@ namespace yart
 
         Bounds2i GetSampleBounds() const;
         Bounds2f GetPhysicalExtent() const;
-        template <typename Spectrum>
-        void AddSample(const Vector2f& filmPoint, const Spectrum& L, real sampleWeight = 1);
+
+        // Returns a tile for the samples taken in the pixels of sampleBounds
+        Scope<FilmTile> GetFilmTile(const Bounds2i& sampleBounds) const;
+        // Adds the samples of a tile to the film, tiles may be merged from any thread in any order
+        void MergeFilmTile(Scope<FilmTile> tile);
+
+        // Filtered color of a pixel inside of m_CroppedPixelBounds
+        std::array<real, 3> GetPixelRGB(const Vector2i& point) const;
+        // Mean and variance of the luminance of the samples taken inside of a pixel of m_CroppedPixelBounds
+        VarianceEstimator GetPixelLuminance(const Vector2i& point) const;
+        // The luminance of every pixel of m_CroppedPixelBounds in rows from its minimum, copied under a single lock
+        std::vector<VarianceEstimator> GetPixelLuminances() const;
+        // Writes the samples merged so far, it may be called while tiles are merged from other threads
         void WriteImage(bool normalize = false) const;
 
     public:
@@ -35,11 +91,13 @@ namespace yart
     private:
         struct Pixel
         {
-            std::array<AtomicReal, 3> xyz;
-            AtomicReal FilterWeightSum;
+            std::array<real, 3> xyz = {0, 0, 0};
+            real FilterWeightSum = 0;
+            VarianceEstimator Luminance;
         };
-        static_assert(sizeof(Pixel) == 4 * sizeof(real));
+        static_assert(sizeof(Pixel) == 4 * sizeof(real) + sizeof(VarianceEstimator));
         Pixel* m_Pixels;
+        mutable std::mutex m_Mutex;
 
         static constexpr i32 s_FilterTableWidth = 16;
         real m_FilterTable[s_FilterTableWidth * s_FilterTableWidth];
@@ -47,51 +105,59 @@ namespace yart
     private:
         Pixel& GetPixel(const Vector2i& point)
         {
-            return m_Pixels[point.y * m_CroppedPixelBounds.Diagonal().x + point.x];
+            Vector2i offset = point - m_CroppedPixelBounds.m_MinBound;
+            return m_Pixels[offset.y * m_CroppedPixelBounds.Diagonal().x + offset.x];
         }
         const Pixel& GetPixel(const Vector2i& point) const
         {
-            return m_Pixels[point.y * m_CroppedPixelBounds.Diagonal().x + point.x];
+            return const_cast<Film*>(this)->GetPixel(point);
         }
+        static std::array<real, 3> PixelRGB(const Pixel& pixel);
     };
 
     template <typename Spectrum>
-    inline void Film::AddSample(const Vector2f& filmPoint, const Spectrum& L, real sampleWeight)
+    inline void FilmTile::AddSample(const Vector2f& filmPoint, const Spectrum& L, real sampleWeight)
     {
         std::array<real, 3> xyz = L.ToXYZ();
 
         Vector2f discreteFilmPoint = filmPoint - Vector2f(0.5, 0.5);
-        Vector2i pMin = Vector2i(Ceil(discreteFilmPoint - m_Filter->m_Radius));
-        Vector2i pMax = Vector2i(Floor(discreteFilmPoint + m_Filter->m_Radius));
-        Bounds2i filterBounds{pMin, pMax + Vector2i{1, 1}};
-        filterBounds = Intersect(filterBounds, m_CroppedPixelBounds);
+        Vector2i pMin = Max(Vector2i(Ceil(discreteFilmPoint - m_FilterRadius)), m_PixelBounds.m_MinBound);
+        Vector2i pMax = Min(Vector2i(Floor(discreteFilmPoint + m_FilterRadius)) + Vector2i{1, 1}, m_PixelBounds.m_MaxBound);
+        if (pMin.x >= pMax.x || pMin.y >= pMax.y)
+            return;
+        Bounds2i filterBounds{pMin, pMax};
         Vector2i filterDiagonal = filterBounds.Diagonal();
 
         // Precompute fitler table indices
         i32* indexX = YART_ALLOCA(i32, filterDiagonal.x);
         for (i32 x = filterBounds.m_MinBound.x; x < filterBounds.m_MaxBound.x; x++)
         {
-            real filterX = std::abs((x - discreteFilmPoint.x) * m_Filter->m_InvRadius.x * s_FilterTableWidth);
-            indexX[x - filterBounds.m_MinBound.x] = std::min((i32)filterX, s_FilterTableWidth - 1);
+            real filterX = std::abs((x - discreteFilmPoint.x) * m_InvFilterRadius.x * m_FilterTableWidth);
+            indexX[x - filterBounds.m_MinBound.x] = std::min((i32)filterX, m_FilterTableWidth - 1);
         }
 
         i32* indexY = YART_ALLOCA(i32, filterDiagonal.y);
         for (i32 y = filterBounds.m_MinBound.y; y < filterBounds.m_MaxBound.y; y++)
         {
-            real filterY = std::abs((y - discreteFilmPoint.y) * m_Filter->m_InvRadius.y * s_FilterTableWidth);
-            indexY[y - filterBounds.m_MinBound.y] = std::min((i32)filterY, s_FilterTableWidth - 1);
+            real filterY = std::abs((y - discreteFilmPoint.y) * m_InvFilterRadius.y * m_FilterTableWidth);
+            indexY[y - filterBounds.m_MinBound.y] = std::min((i32)filterY, m_FilterTableWidth - 1);
         }
 
         for (Vector2i point : filterBounds)
         {
             Pixel& pixel = GetPixel(point);
             i32 offset =
-                indexY[point.y - filterBounds.m_MinBound.y] * s_FilterTableWidth + indexX[point.x - filterBounds.m_MinBound.x];
+                indexY[point.y - filterBounds.m_MinBound.y] * m_FilterTableWidth + indexX[point.x - filterBounds.m_MinBound.x];
             real filterWeight = m_FilterTable[offset];
-            pixel.xyz[0].Add(xyz[0] * sampleWeight * filterWeight);
-            pixel.xyz[1].Add(xyz[1] * sampleWeight * filterWeight);
-            pixel.xyz[2].Add(xyz[2] * sampleWeight * filterWeight);
-            pixel.FilterWeightSum.Add(filterWeight);
+            pixel.xyz[0] += xyz[0] * sampleWeight * filterWeight;
+            pixel.xyz[1] += xyz[1] * sampleWeight * filterWeight;
+            pixel.xyz[2] += xyz[2] * sampleWeight * filterWeight;
+            pixel.FilterWeightSum += filterWeight;
         }
+
+        // The sample belongs to the pixel it was taken in, which may lie outside of the tile when the filter reaches into it
+        Vector2i samplePixel = Vector2i(Floor(filmPoint));
+        if (InsideExclusive(samplePixel, m_PixelBounds))
+            GetPixel(samplePixel).Luminance.Add(xyz[1] * sampleWeight);
     }
 }
\ No newline at end of file
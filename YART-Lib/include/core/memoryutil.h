@@ -1,5 +1,10 @@
 #pragma once
 #include "core/yart.h"
+#include <string>
+
+#if defined(PLATFORM_WINDOWS)
+    #include <xmmintrin.h>
+#endif
 
 #define YART_ALLOCA(TYPE, COUNT) (TYPE*)alloca((COUNT) * sizeof(TYPE))
 #define ARENA_ALLOC(arena, TYPE) new (arena.Alloc(sizeof(TYPE))) TYPE
@@ -7,6 +12,8 @@
 namespace yart
 {
     void* AllocAligned(u64 size);
+    // alignment must be a power of two
+    void* AllocAligned(u64 size, u64 alignment);
 
     template <typename T>
     T* AllocAligned(u64 count)
@@ -14,8 +21,58 @@ namespace yart
         return (T*)AllocAligned(count * sizeof(T));
     }
 
+    template <typename T>
+    T* AllocAligned(u64 count, u64 alignment)
+    {
+        return (T*)AllocAligned(count * sizeof(T), alignment);
+    }
+
     void FreeAligned(void*);
 
+    // Starts loading the cache line holding address into the cache without waiting for it
+    inline void Prefetch(const void* address)
+    {
+#if defined(PLATFORM_WINDOWS)
+        _mm_prefetch((const char*)address, _MM_HINT_T0);
+#else
+        __builtin_prefetch(address);
+#endif
+    }
+
+    // Identifier of the calling process, unique among the processes running at the same time
+    u32 ProcessId();
+
+    // Read only file mapped copy on write, writes through Data() stay private to the process and never reach the file
+    class MappedFile
+    {
+    public:
+        // Returns nullptr if the file does not exist or cannot be mapped
+        static Scope<MappedFile> Open(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        u8* Data() const
+        {
+            return m_Data;
+        }
+
+        u64 Size() const
+        {
+            return m_Size;
+        }
+
+    private:
+        MappedFile(u8* data, u64 size, void* mapping) : m_Data(data), m_Size(size), m_Mapping(mapping)
+        {
+        }
+
+        u8* m_Data;
+        u64 m_Size;
+        void* m_Mapping; // Handle of the file mapping object on Windows, unused elsewhere
+    };
+
     class MemoryArena
     {
     public:
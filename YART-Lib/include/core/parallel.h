@@ -1,8 +1,11 @@
 ﻿#pragma once
 #include "core/yart.h"
 #include "math/util.h"
+#include "math/vector.h"
 
 #include <atomic>
+#include <functional>
+#include <vector>
 
 namespace yart
 {
@@ -37,4 +40,46 @@ namespace yart
     private:
         std::atomic<ureal> m_Bits;
     };
+
+    // Returns the number of hardware threads available, at least 1
+    i32 NumSystemCores();
+
+    // Sets the number of threads running parallel loops, including the thread that starts a loop. 0 uses every core. The
+    // threads of the pool are started on first use and kept until the number changes, which must not happen while a loop is
+    // running
+    void SetNumThreads(i32 numThreads);
+    i32 NumThreads();
+
+    // Calls func(i) for every i in [0, count). Iterations are handed out to threads in chunks of chunkSize, the calling
+    // thread takes part in the loop and the call returns once every iteration has completed. Loops may be nested, a thread
+    // waiting for its loop to complete runs pending chunks of any loop in the meantime
+    void ParallelFor(const std::function<void(i64)>& func, i64 count, i64 chunkSize = 1);
+
+    // Calls func(p) for every p in [0, count.x) x [0, count.y), in chunks of chunkSize points along x
+    void ParallelFor2D(const std::function<void(Vector2i)>& func, const Vector2i& count, i64 chunkSize = 1);
+
+    // Combines map(i) for every i in [0, count) with combine, starting from identity. Chunks are reduced in parallel and
+    // their results combined in order, so combine only has to be associative and the result does not depend on how the
+    // chunks were spread over threads
+    template <typename T, typename Map, typename Combine>
+    T ParallelReduce(i64 count, i64 chunkSize, const T& identity, const Map& map, const Combine& combine)
+    {
+        chunkSize = std::max((i64)1, chunkSize);
+        const i64 numChunks = (count + chunkSize - 1) / chunkSize;
+        std::vector<T> chunkResults(numChunks, identity);
+
+        // clang-format off
+        ParallelFor([&](i64 chunk) {
+            T result = identity;
+            for (i64 i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+                result = combine(result, map(i));
+            chunkResults[chunk] = result;
+        }, numChunks);
+        // clang-format on
+
+        T result = identity;
+        for (const T& chunkResult : chunkResults)
+            result = combine(result, chunkResult);
+        return result;
+    }
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 #include "core/interaction.h"
 #include "geometry/geometry.h"
+#include "geometry/sphere.h"
 #include "materials/material.h"
 #include "math/boundingbox.h"
 #include "math/ray.h"
+#include "math/transform.h"
 
 namespace yart
 {
+    static constexpr i32 MaxRayPacketSize = 16;
+
     template <typename Spectrum>
     class AbstractPrimitive
     {
@@ -17,6 +21,24 @@ namespace yart
         virtual Bounds3f WorldBound() const = 0;
         virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const = 0;
         virtual bool IntersectRay(const Ray& ray) const = 0;
+
+        // Intersects a packet of up to MaxRayPacketSize rays, ideally coherent ones such as neighbouring camera rays. Returns
+        // a mask where bit i is set if rays[i] hit. The default implementation intersects the rays one at a time
+        virtual u32 IntersectPacket(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions) const;
+        virtual u32 IntersectPacket(const Ray* rays, i32 numRays) const;
+
+        // Intersects a large batch of rays, such as all secondary rays of a bounce, setting hits[i] if rays[i] hit. The
+        // default implementation intersects the rays one at a time
+        virtual void IntersectStream(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions, bool* hits) const;
+        virtual void IntersectStream(const Ray* rays, i32 numRays, bool* hits) const;
+
+        // Returns the sphere and writes its world space center and radius if the primitive is a complete sphere, which lets
+        // aggregates store it inline and intersect it without calling IntersectRay(). Returns nullptr otherwise
+        virtual const Sphere* WorldSphere(Vector3f* center, real* radius) const;
+
+        // Describes the primitive as a JSON object, such as the shape of an acceleration structure. Returns an empty string if
+        // there is nothing to report
+        virtual std::string ReportStatistics() const;
         // virtual const AreaLight* GetAreaLight() const = 0; // Return nullptr if the primitive is not emmisive
         // virtual const AbstractMaterial* GetMaterial() const = 0;
         // virtual void ComputeScatteringFuctions(SurfaceInteraction* surfaceInteraction, MemoryArena& arena, TransportMode mode,
@@ -36,6 +58,12 @@ namespace yart
         virtual Bounds3f WorldBound() const override;
         virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const override;
         virtual bool IntersectRay(const Ray& ray) const override;
+        virtual const Sphere* WorldSphere(Vector3f* center, real* radius) const override;
+
+        const Ref<AbstractGeometry>& Geometry() const
+        {
+            return m_Geometry;
+        }
 
     private:
         Ref<AbstractGeometry> m_Geometry;
@@ -45,7 +73,30 @@ namespace yart
         // TODO: medium interface
     };
 
-    // TODO: TransformPrimitive (section 4.1.2)
+    // Places a shared primitive, usually an aggregate of a whole asset, into the scene with its own transformation. Rays are
+    // transformed into the space of the primitive instead of transforming the primitive, so one copy of the primitive and its
+    // acceleration structure serves every instance
+    template <typename Spectrum>
+    class TransformPrimitive : public AbstractPrimitive<Spectrum>
+    {
+    public:
+        using AbstractPrimitive = yart::AbstractPrimitive<Spectrum>;
+        using MaterialInteraction = yart::MaterialInteraction<Spectrum>;
+
+        TransformPrimitive(const Ref<AbstractPrimitive>& primitive, const Transform& primitiveToWorld)
+            : m_Primitive(primitive), m_PrimitiveToWorld(primitiveToWorld), m_WorldToPrimitive(Inverse(primitiveToWorld))
+        {
+        }
+
+        virtual Bounds3f WorldBound() const override;
+        virtual bool IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const override;
+        virtual bool IntersectRay(const Ray& ray) const override;
+
+    private:
+        Ref<AbstractPrimitive> m_Primitive;
+        const Transform m_PrimitiveToWorld;
+        const Transform m_WorldToPrimitive;
+    };
 
     template <typename Spectrum>
     class AbstractAggregate : public AbstractPrimitive<Spectrum>
@@ -58,6 +109,58 @@ namespace yart
     {
     }
 
+    template <typename Spectrum>
+    const Sphere* AbstractPrimitive<Spectrum>::WorldSphere(Vector3f*, real*) const
+    {
+        return nullptr;
+    }
+
+    template <typename Spectrum>
+    std::string AbstractPrimitive<Spectrum>::ReportStatistics() const
+    {
+        return std::string{};
+    }
+
+    template <typename Spectrum>
+    u32 AbstractPrimitive<Spectrum>::IntersectPacket(const Ray* rays, i32 numRays,
+                                                     MaterialInteraction* materialInteractions) const
+    {
+        ASSERT(numRays <= MaxRayPacketSize);
+        u32 hitMask = 0;
+        for (i32 i = 0; i < numRays; i++)
+            if (IntersectRay(rays[i], &materialInteractions[i]))
+                hitMask |= 1u << i;
+
+        return hitMask;
+    }
+
+    template <typename Spectrum>
+    u32 AbstractPrimitive<Spectrum>::IntersectPacket(const Ray* rays, i32 numRays) const
+    {
+        ASSERT(numRays <= MaxRayPacketSize);
+        u32 hitMask = 0;
+        for (i32 i = 0; i < numRays; i++)
+            if (IntersectRay(rays[i]))
+                hitMask |= 1u << i;
+
+        return hitMask;
+    }
+
+    template <typename Spectrum>
+    void AbstractPrimitive<Spectrum>::IntersectStream(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions,
+                                                      bool* hits) const
+    {
+        for (i32 i = 0; i < numRays; i++)
+            hits[i] = IntersectRay(rays[i], &materialInteractions[i]);
+    }
+
+    template <typename Spectrum>
+    void AbstractPrimitive<Spectrum>::IntersectStream(const Ray* rays, i32 numRays, bool* hits) const
+    {
+        for (i32 i = 0; i < numRays; i++)
+            hits[i] = IntersectRay(rays[i]);
+    }
+
     template <typename Spectrum>
     Bounds3f GeometricPrimitive<Spectrum>::WorldBound() const
     {
@@ -87,4 +190,45 @@ namespace yart
     {
         return m_Geometry->IntersectRay(ray);
     }
+
+    template <typename Spectrum>
+    const Sphere* GeometricPrimitive<Spectrum>::WorldSphere(Vector3f* center, real* radius) const
+    {
+        if (!m_Geometry->WorldSphere(center, radius))
+            return nullptr;
+
+        return dynamic_cast<const Sphere*>(m_Geometry.get());
+    }
+
+    template <typename Spectrum>
+    Bounds3f TransformPrimitive<Spectrum>::WorldBound() const
+    {
+        return m_PrimitiveToWorld.AppBB(m_Primitive->WorldBound());
+    }
+
+    template <typename Spectrum>
+    bool TransformPrimitive<Spectrum>::IntersectRay(const Ray& ray, MaterialInteraction* materialInteraction) const
+    {
+        // The direction is not normalised by the transformation, so distances along both rays are the same
+        Ray primitiveRay = m_WorldToPrimitive.AppRay(ray);
+        if (!m_Primitive->IntersectRay(primitiveRay, materialInteraction))
+        {
+            return false;
+        }
+        ray.m_Tmax = primitiveRay.m_Tmax;
+
+        // Only the surface part of the interaction is transformed, the primitive and BSDF stay as set by m_Primitive
+        if (materialInteraction && !m_PrimitiveToWorld.IsIdentity())
+        {
+            static_cast<SurfaceInteraction&>(*materialInteraction) = m_PrimitiveToWorld.AppSI(*materialInteraction);
+        }
+
+        return true;
+    }
+
+    template <typename Spectrum>
+    bool TransformPrimitive<Spectrum>::IntersectRay(const Ray& ray) const
+    {
+        return m_Primitive->IntersectRay(m_WorldToPrimitive.AppRay(ray));
+    }
 }
\ No newline at end of file
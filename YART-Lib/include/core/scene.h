@@ -25,6 +25,31 @@ namespace yart
             return m_Aggregate->IntersectRay(ray);
         }
 
+        u32 IntersectPacket(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions) const
+        {
+            return m_Aggregate->IntersectPacket(rays, numRays, materialInteractions);
+        }
+
+        u32 IntersectPacket(const Ray* rays, i32 numRays) const
+        {
+            return m_Aggregate->IntersectPacket(rays, numRays);
+        }
+
+        void IntersectStream(const Ray* rays, i32 numRays, MaterialInteraction* materialInteractions, bool* hits) const
+        {
+            m_Aggregate->IntersectStream(rays, numRays, materialInteractions, hits);
+        }
+
+        void IntersectStream(const Ray* rays, i32 numRays, bool* hits) const
+        {
+            m_Aggregate->IntersectStream(rays, numRays, hits);
+        }
+
+        std::string ReportStatistics() const
+        {
+            return m_Aggregate->ReportStatistics();
+        }
+
     public:
         const Bounds3f m_WorldBound;
 
@@ -0,0 +1,38 @@
+#pragma once
+#include "core/yart.h"
+
+#include <string>
+
+// Counting costs a thread local access per visited node, so traversal counters are compiled out of release builds
+#if !defined(CONFIGURATION_RELEASE)
+#define YART_TRAVERSAL_STATISTICS
+#endif
+
+#if defined(YART_TRAVERSAL_STATISTICS)
+#define COUNT_TRAVERSAL(counter, n) (::yart::LocalTraversalCounters().counter += (n))
+#else
+#define COUNT_TRAVERSAL(counter, n) (void)0
+#endif
+
+namespace yart
+{
+    // Work done by the acceleration structures to answer ray queries. Nested aggregates, such as the ones shared by instances,
+    // count every query they answer, so there can be more queries than rays traced by the integrator
+    struct TraversalCounters
+    {
+        u64 m_RayQueries = 0;
+        u64 m_NodesVisited = 0;
+        u64 m_BoxesTested = 0;
+        u64 m_PrimitivesTested = 0;
+    };
+
+    // The counters of the calling thread
+    TraversalCounters& LocalTraversalCounters();
+
+    // Sums the counters of all threads. Threads still tracing rays are read without synchronization, so the sum is only exact
+    // once they are done
+    TraversalCounters GatherTraversalCounters();
+    void ResetTraversalCounters();
+
+    std::string ToJSON(const TraversalCounters& counters);
+}
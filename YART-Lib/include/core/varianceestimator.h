@@ -0,0 +1,54 @@
+#pragma once
+#include "core/yart.h"
+
+namespace yart
+{
+    // Running mean and variance of a sequence of values with Welford's algorithm. Estimators of separate parts of a sequence
+    // are combined with Merge
+    class VarianceEstimator
+    {
+    public:
+        void Add(real value)
+        {
+            m_Count++;
+            real delta = value - m_Mean;
+            m_Mean += delta / m_Count;
+            m_M2 += delta * (value - m_Mean);
+        }
+
+        void Merge(const VarianceEstimator& other)
+        {
+            if (other.m_Count == 0)
+                return;
+
+            i64 count = m_Count + other.m_Count;
+            real delta = other.m_Mean - m_Mean;
+            m_Mean += delta * ((real)other.m_Count / count);
+            m_M2 += other.m_M2 + delta * delta * ((real)m_Count * other.m_Count / count);
+            m_Count = count;
+        }
+
+        i64 Count() const
+        {
+            return m_Count;
+        }
+
+        real Mean() const
+        {
+            return m_Mean;
+        }
+
+        // Unbiased sample variance, 0 for fewer than two values
+        real Variance() const
+        {
+            return m_Count > 1 ? m_M2 / (m_Count - 1) : 0;
+        }
+
+    private:
+        i64 m_Count = 0;
+        real m_Mean = 0;
+        real m_M2 = 0;
+    };
+
+    static_assert(sizeof(VarianceEstimator) == sizeof(i64) + 2 * sizeof(real));
+}
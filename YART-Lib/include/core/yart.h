@@ -62,6 +62,12 @@ namespace yart
     template <typename Spectrum>
     class BVHAccelerator;
     template <typename Spectrum>
+    class DynamicBVHAccelerator;
+    template <typename Spectrum>
+    class KdTreeAccelerator;
+    template <typename Spectrum>
+    class GridAccelerator;
+    template <typename Spectrum>
     class Fresnel;
     template <typename Spectrum>
     class FresnelConductor;
@@ -88,6 +94,8 @@ namespace yart
     template <typename Spectrum>
     class GeometricPrimitive;
     template <typename Spectrum>
+    class TransformPrimitive;
+    template <typename Spectrum>
     class AbstractAggregate;
     template <typename Spectrum>
     class Scene;
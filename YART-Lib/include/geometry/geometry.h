@@ -23,6 +23,9 @@ namespace yart
         virtual bool IntersectRay(const Ray& ray, bool testAlphaTexture = true) const;
         virtual real SurfaceArea() const = 0;
 
+        // Returns true and writes the world space center and radius if the geometry is a complete sphere in world space
+        virtual bool WorldSphere(Vector3f* center, real* radius) const;
+
     public:
         const Transform* m_ObjectToWorld;
         const Transform* m_WorldToObject;
@@ -22,7 +22,17 @@ namespace yart
         virtual bool IntersectRay(const Ray& ray, bool testAlphaTexture = true) const override;
         virtual real SurfaceArea() const override;
 
+        // Holds if this is a complete sphere and its object to world transform keeps it a sphere, which is the case for any
+        // combination of rotation, uniform scaling and translation
+        virtual bool WorldSphere(Vector3f* center, real* radius) const override;
+
+        // Surface interaction of ray at pHit, a world space point on the sphere. Aggregates that intersect complete spheres
+        // from their world space center and radius fill in their hits with it instead of calling IntersectRay()
+        SurfaceInteraction WorldInteraction(const Vector3f& pHit, const Ray& ray) const;
+
     private:
+        SurfaceInteraction ObjectInteraction(const Vector3f& pHit, real phi, const Ray& ray) const;
+
         struct IntersectionData
         {
             real phi;
@@ -1,11 +1,43 @@
 #pragma once
 #include "cameras/camera.h"
+#include "core/parallel.h"
 #include "core/scene.h"
+#include "core/statistics.h"
 #include "core/yart.h"
 #include "samplers/sampler.h"
 
 namespace yart
 {
+    // Writes the statistics of the scene aggregate and the traversal counters gathered during a render as JSON next to the
+    // image, replacing the extension of imageFilename with .stats.json
+    void WriteRenderStatistics(const std::string& imageFilename, const std::string& aggregateStatistics, double renderSeconds,
+                               double samplesPerPixel);
+
+    // Progressive rendering takes the samples of every pixel in passes of m_SamplesPerPass, so the film holds an evenly sampled
+    // image after every pass. Rendering stops once all samples of the sampler are taken or, with a time budget, before a pass
+    // that is not expected to finish within it. The first pass is always rendered
+    struct ProgressiveParameters
+    {
+        i64 m_SamplesPerPass = 0;   // Every sample in a single pass when 0
+        double m_TimeBudget = 0;    // Seconds, unlimited when 0
+        bool m_WritePasses = false; // Writes the image after every pass, only with m_SamplesPerPass
+    };
+
+    // Adaptive sampling stops sampling a pixel once the standard error of its mean luminance falls below m_ErrorThreshold
+    // relative to the mean, and spends the samples saved on the pixels that are still noisy. The samples per pixel of the
+    // sampler cap the samples of any pixel, while m_SamplesPerPixel is the average over the image the render may spend.
+    // Pixels are sampled in the progressive passes, or in passes of m_MinSamplesPerPixel without them, and are only tested for
+    // convergence once they have m_MinSamplesPerPixel samples
+    struct AdaptiveParameters
+    {
+        real m_ErrorThreshold = 0; // Adaptive sampling is off when 0
+        // Pixels darker than this are held to an error relative to it instead of their mean, since their relative error is
+        // dominated by noise that does not show next to black
+        real m_MinLuminance = 0.01;
+        i64 m_MinSamplesPerPixel = 8;
+        i64 m_SamplesPerPixel = 0; // The samples of the sampler in every pixel when 0
+    };
+
     template <typename Spectrum>
     class AbstractIntegrator
     {
@@ -18,11 +50,18 @@ namespace yart
         virtual void Render(const Scene& scene) = 0;
     };
 
+    // Renders the image in square tiles of TileSize pixels, spread over all cores. Every tile gets its own memory arena, film
+    // tile and a clone of the sampler seeded with the index of the tile, so the samples drawn do not depend on which thread
+    // renders it and threads only synchronize once per tile, when merging it into the film. The tiles of every progressive
+    // pass are seeded differently
     template <typename Spectrum>
     class SamplerIntegrator : public AbstractIntegrator<Spectrum>
     {
     public:
         using Scene = yart::Scene<Spectrum>;
+
+        static constexpr i32 TileSize = 16;
+
         SamplerIntegrator(const Ref<AbstractCamera>& camera, const Ref<AbstractSampler>& sampler)
             : m_Camera(camera), m_Sampler(sampler)
         {
@@ -30,6 +69,29 @@ namespace yart
 
         virtual void Render(const Scene& scene) override;
 
+        void SetProgressiveParameters(const ProgressiveParameters& parameters)
+        {
+            m_Progressive = parameters;
+        }
+
+        void SetAdaptiveParameters(const AdaptiveParameters& parameters)
+        {
+            m_Adaptive = parameters;
+        }
+
+        // Write the statistics of every render next to the image with WriteRenderStatistics()
+        void SetWriteStatistics(bool writeStatistics)
+        {
+            m_WriteStatistics = writeStatistics;
+        }
+
+        // Average samples per pixel taken by the last render, fewer than those of the sampler when it ran out of time or
+        // pixels converged
+        double SamplesPerPixelTaken() const
+        {
+            return m_SamplesPerPixelTaken;
+        }
+
         virtual void Preprocess(const Scene& scene, AbstractSampler& sampler)
         {
         }
@@ -39,35 +101,167 @@ namespace yart
     protected:
         Ref<AbstractCamera> m_Camera;
 
+    private:
+        // Takes up to passSamples more samples in every pixel of the tile that is still active. The pixel state is indexed like
+        // the cropped film, tiles only touch the entries of their own pixels
+        void RenderTile(const Scene& scene, const Bounds2i& tileBounds, i64 passSamples, const std::vector<u8>& pixelActive,
+                        std::vector<i64>* pixelSamples, AbstractSampler& sampler, MemoryArena& arena,
+                        FilmTile& filmTile) const;
+
+        static bool HasConverged(const VarianceEstimator& luminance, const AdaptiveParameters& parameters)
+        {
+            real standardError = std::sqrt(luminance.Variance() / luminance.Count());
+            return standardError <= parameters.m_ErrorThreshold * std::max(luminance.Mean(), parameters.m_MinLuminance);
+        }
+
     private:
         Ref<AbstractSampler> m_Sampler;
+        ProgressiveParameters m_Progressive;
+        AdaptiveParameters m_Adaptive;
+        bool m_WriteStatistics = false;
+        double m_SamplesPerPixelTaken = 0;
     };
 
     template <typename Spectrum>
     inline void SamplerIntegrator<Spectrum>::Render(const Scene& scene)
     {
+        auto startTime = std::chrono::steady_clock::now();
+        ResetTraversalCounters();
+
         Preprocess(scene, *m_Sampler);
-        MemoryArena arena;
-        for (Vector2i pixel : m_Camera->m_Film->m_CroppedPixelBounds)
+
+        Film& film = *m_Camera->m_Film;
+        const Bounds2i& pixelBounds = film.m_CroppedPixelBounds;
+        const Vector2i pixelExtent = pixelBounds.Diagonal();
+        const Vector2i numTiles{(pixelExtent.x + TileSize - 1) / TileSize, (pixelExtent.y + TileSize - 1) / TileSize};
+        const i64 numPixels = std::max((i64)pixelBounds.Area(), (i64)1);
+
+        const i64 maxSamplesPerPixel = m_Sampler->m_SamplesPerPixel;
+        const bool adaptive = m_Adaptive.m_ErrorThreshold > 0;
+        const i64 minSamplesPerPixel = std::max(m_Adaptive.m_MinSamplesPerPixel, (i64)2);
+        i64 samplesPerPass = maxSamplesPerPixel;
+        if (m_Progressive.m_SamplesPerPass > 0)
+            samplesPerPass = std::min(m_Progressive.m_SamplesPerPass, maxSamplesPerPixel);
+        else if (adaptive)
+            samplesPerPass = std::min(minSamplesPerPixel, maxSamplesPerPixel);
+        const i64 sampleBudget =
+            (adaptive && m_Adaptive.m_SamplesPerPixel > 0 ? m_Adaptive.m_SamplesPerPixel : maxSamplesPerPixel) * numPixels;
+
+        // Samples taken in every pixel of the film and whether it is still sampled, indexed like the cropped film
+        std::vector<i64> pixelSamples(numPixels, 0);
+        std::vector<u8> pixelActive(numPixels, true);
+        i64 numSamples = 0;
+        i64 numActivePixels = numPixels;
+
+        // The remaining budget is spread evenly over the pixels still being sampled once it does not last a full pass
+        i64 passSamples = std::min(samplesPerPass, sampleBudget / numPixels);
+        for (i64 pass = 0; passSamples > 0; pass++)
         {
-            m_Sampler->StartPixel(pixel);
-            do
+            auto passStartTime = std::chrono::steady_clock::now();
+
+            // clang-format off
+            ParallelFor2D([&](Vector2i tile) {
+                Vector2i tileMin = pixelBounds.m_MinBound + tile * TileSize;
+                Bounds2i tileBounds = Intersect(Bounds2i{tileMin, tileMin + Vector2i{TileSize, TileSize}}, pixelBounds);
+
+                Scope<AbstractSampler> tileSampler = m_Sampler->Clone((pass * numTiles.y + tile.y) * numTiles.x + tile.x);
+                MemoryArena arena;
+                Scope<FilmTile> filmTile = film.GetFilmTile(tileBounds);
+                RenderTile(scene, tileBounds, passSamples, pixelActive, &pixelSamples, *tileSampler, arena, *filmTile);
+                film.MergeFilmTile(std::move(filmTile));
+            }, numTiles);
+            // clang-format on
+
+            // Every pixel still sampled is tested against a copy of the luminance the film holds after the pass, and the
+            // samples taken and pixels left active are counted along the way
+            std::vector<VarianceEstimator> luminances;
+            if (adaptive)
+                luminances = film.GetPixelLuminances();
+            const i64 previousNumSamples = numSamples;
+            // clang-format off
+            std::pair<i64, i64> counts = ParallelReduce(numPixels, 4096, std::pair<i64, i64>{0, 0}, [&](i64 i) {
+                if (pixelActive[i] && (pixelSamples[i] >= maxSamplesPerPixel ||
+                                       (adaptive && pixelSamples[i] >= minSamplesPerPixel &&
+                                        HasConverged(luminances[i], m_Adaptive))))
+                    pixelActive[i] = false;
+                return std::pair<i64, i64>{pixelSamples[i], pixelActive[i]};
+            }, [](const std::pair<i64, i64>& a, const std::pair<i64, i64>& b) {
+                return std::pair<i64, i64>{a.first + b.first, a.second + b.second};
+            });
+            // clang-format on
+            numSamples = counts.first;
+            numActivePixels = counts.second;
+
+            const i64 nextPassSamples =
+                numActivePixels > 0 ? std::min(samplesPerPass, (sampleBudget - numSamples) / numActivePixels) : 0;
+            if (nextPassSamples == 0 || numSamples == previousNumSamples)
+                break;
+
+            if (m_Progressive.m_SamplesPerPass > 0 && m_Progressive.m_WritePasses)
+                film.WriteImage();
+
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed = now - startTime;
+            std::chrono::duration<double> passTime = now - passStartTime;
+            LOG_INFO("Rendered {:.2f} samples per pixel in {:.2f}s, {} of {} pixels are still sampled",
+                     (double)numSamples / numPixels, elapsed.count(), numActivePixels, numPixels);
+
+            // Samples are expected to take as long in the next pass as they did in this one
+            const double expectedTime = elapsed.count() + passTime.count() * (nextPassSamples * numActivePixels) /
+                                                              (numSamples - previousNumSamples);
+            if (m_Progressive.m_TimeBudget > 0 && expectedTime > m_Progressive.m_TimeBudget)
             {
-                CameraSample cameraSample = m_Sampler->GetCameraSample(pixel);
+                LOG_INFO("Stopping at {:.2f} samples per pixel to stay within the time budget of {:.2f}s",
+                         (double)numSamples / numPixels, m_Progressive.m_TimeBudget);
+                break;
+            }
+            passSamples = nextPassSamples;
+        }
+        m_SamplesPerPixelTaken = (double)numSamples / numPixels;
+
+        film.WriteImage();
+
+        if (m_WriteStatistics)
+        {
+            std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - startTime;
+            WriteRenderStatistics(film.m_Filename, scene.ReportStatistics(), renderTime.count(), m_SamplesPerPixelTaken);
+        }
+    }
+
+    template <typename Spectrum>
+    inline void SamplerIntegrator<Spectrum>::RenderTile(const Scene& scene, const Bounds2i& tileBounds, i64 passSamples,
+                                                        const std::vector<u8>& pixelActive, std::vector<i64>* pixelSamples,
+                                                        AbstractSampler& sampler, MemoryArena& arena, FilmTile& filmTile) const
+    {
+        const Bounds2i& pixelBounds = m_Camera->m_Film->m_CroppedPixelBounds;
+        for (Vector2i pixel : tileBounds)
+        {
+            const Vector2i offset = pixel - pixelBounds.m_MinBound;
+            const i64 pixelIndex = (i64)offset.y * pixelBounds.Diagonal().x + offset.x;
+            if (!pixelActive[pixelIndex])
+                continue;
+
+            const i64 firstSample = (*pixelSamples)[pixelIndex];
+            sampler.StartPixel(pixel);
+            bool hasSample = sampler.SetSampleIndex(firstSample);
+            i64 sampleIndex = firstSample;
+            for (; hasSample && sampleIndex < firstSample + passSamples; sampleIndex++)
+            {
+                CameraSample cameraSample = sampler.GetCameraSample(pixel);
                 Ray cameraRay;
                 real rayWeight = m_Camera->GenerateRay(cameraSample, &cameraRay);
 
-                Spectrum L = Li(cameraRay, scene, *m_Sampler, arena);
+                Spectrum L = Li(cameraRay, scene, sampler, arena);
                 if (L.HasNaNs())
                 {
                     LOG_ERROR("NaN radiance value returned for pixel ({}, {})", pixel.x, pixel.y);
                     L = Spectrum{0};
                 }
-                m_Camera->m_Film->AddSample(cameraSample.m_FilmPoint, L, rayWeight);
+                filmTile.AddSample(cameraSample.m_FilmPoint, L, rayWeight);
                 arena.Reset();
-            } while (m_Sampler->StartNextSample());
+                hasSample = sampler.StartNextSample();
+            }
+            (*pixelSamples)[pixelIndex] = sampleIndex;
         }
-
-        m_Camera->m_Film->WriteImage();
     }
 }
\ No newline at end of file
@@ -1,7 +1,882 @@
 #include "accelerators/bvh.h"
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <queue>
+#include <thread>
+
+// The SIMD slab tests operate on single precision bounds, double precision builds use the scalar version
+#if !defined(USE_DOUBLE_PRECISION_FLOAT) && (defined(__SSE2__) || defined(_M_X64))
+    #define YART_BVH_SSE
+    #include <immintrin.h>
+#endif
+#if defined(YART_BVH_SSE) && defined(__AVX__)
+    #define YART_BVH_AVX
+#endif
 
 namespace yart
 {
-    const char* const SplitMethodNames[] = {"Middle", "EqualCounts"};
+    const char* const SplitMethodNames[] = {"SAH", "HLBVH", "Middle", "EqualCounts", "SBVH"};
     static_assert((sizeof(SplitMethodNames) / sizeof(const char*)) == static_cast<i32>(SplitMethod::COUNT));
+
+    const char* const BVHLayoutNames[] = {"Binary", "Wide4", "Wide8", "Compressed", "Clustered"};
+    static_assert((sizeof(BVHLayoutNames) / sizeof(const char*)) == static_cast<i32>(BVHLayout::COUNT));
+
+    // Spreads the lower 10 bits of x out so that there are two zero bits between each of them
+    static u32 LeftShift3(u32 x)
+    {
+        ASSERT(x <= (1 << 10));
+        if (x == (1 << 10))
+            x--;
+
+        x = (x | (x << 16)) & 0b00000011000000000000000011111111;
+        x = (x | (x << 8)) & 0b00000011000000001111000000001111;
+        x = (x | (x << 4)) & 0b00000011000011000011000011000011;
+        x = (x | (x << 2)) & 0b00001001001001001001001001001001;
+        return x;
+    }
+
+    u32 EncodeMorton3(const Vector3f& v)
+    {
+        ASSERT(v.x >= 0 && v.y >= 0 && v.z >= 0);
+        return (LeftShift3((u32)v.z) << 2) | (LeftShift3((u32)v.y) << 1) | LeftShift3((u32)v.x);
+    }
+
+    void RadixSort(std::vector<MortonPrimitive>* v)
+    {
+        constexpr i32 bitsPerPass = 6;
+        constexpr i32 numBits = 30;
+        static_assert((numBits % bitsPerPass) == 0, "Radix sort bitsPerPass must evenly divide numBits");
+        constexpr i32 numPasses = numBits / bitsPerPass;
+        constexpr i32 numBuckets = 1 << bitsPerPass;
+        constexpr u32 bitMask = numBuckets - 1;
+
+        const i64 size = v->size();
+        const i64 blockSize = std::max((i64)4096, size / (4 * NumThreads()));
+        const i64 numBlocks = (size + blockSize - 1) / blockSize;
+
+        std::vector<MortonPrimitive> tempVector(size);
+        std::vector<std::array<i64, numBuckets>> blockOffsets(numBlocks);
+
+        for (i32 pass = 0; pass < numPasses; pass++)
+        {
+            i32 lowBit = pass * bitsPerPass;
+            std::vector<MortonPrimitive>& in = (pass & 1) ? tempVector : *v;
+            std::vector<MortonPrimitive>& out = (pass & 1) ? *v : tempVector;
+
+            // clang-format off
+            ParallelFor([&](i64 block) {
+                std::array<i64, numBuckets>& bucketCount = blockOffsets[block];
+                bucketCount.fill(0);
+                for (i64 i = block * blockSize; i < std::min(size, (block + 1) * blockSize); i++)
+                    bucketCount[(in[i].m_MortonCode >> lowBit) & bitMask]++;
+            }, numBlocks);
+            // clang-format on
+
+            // An exclusive prefix sum in (bucket, block) order gives every block the position of its first element in
+            // each bucket, scattering blocks in that order keeps the sort stable
+            i64 offset = 0;
+            for (i32 bucket = 0; bucket < numBuckets; bucket++)
+            {
+                for (i64 block = 0; block < numBlocks; block++)
+                {
+                    i64 count = blockOffsets[block][bucket];
+                    blockOffsets[block][bucket] = offset;
+                    offset += count;
+                }
+            }
+
+            // clang-format off
+            ParallelFor([&](i64 block) {
+                std::array<i64, numBuckets>& bucketOffset = blockOffsets[block];
+                for (i64 i = block * blockSize; i < std::min(size, (block + 1) * blockSize); i++)
+                    out[bucketOffset[(in[i].m_MortonCode >> lowBit) & bitMask]++] = in[i];
+            }, numBlocks);
+            // clang-format on
+        }
+
+        // Copy the final result out of the temporary buffer if there were an odd number of passes
+        if (numPasses & 1)
+            std::swap(*v, tempVector);
+    }
+
+    struct BVHSubtreeCost
+    {
+        real m_Cost; // Expected cost of a ray that hits the bounds of the subtree root
+        i32 m_FirstPrimOffset, m_NumPrimitives;
+        bool m_Contiguous;
+    };
+
+    static BVHSubtreeCost CollapseSubtree(BVHBuildNode* node, i32 maxPrimsInNode, real traversalCost, real intersectionCost)
+    {
+        if (!node->IsInteriorNode())
+            return {intersectionCost * node->m_NumPrimitives, node->m_FirstPrimOffset, node->m_NumPrimitives, true};
+
+        BVHSubtreeCost children[2];
+        for (i32 i = 0; i < 2; i++)
+            children[i] = CollapseSubtree(node->m_Children[i], maxPrimsInNode, traversalCost, intersectionCost);
+        node->m_NumNodes = 1 + node->m_Children[0]->m_NumNodes + node->m_Children[1]->m_NumNodes;
+
+        BVHSubtreeCost subtree;
+        subtree.m_Cost = traversalCost;
+        const real area = node->m_Bounds.SurfaceArea();
+        for (i32 i = 0; i < 2; i++)
+            subtree.m_Cost += children[i].m_Cost * (area > 0 ? node->m_Children[i]->m_Bounds.SurfaceArea() / area : 1);
+
+        subtree.m_FirstPrimOffset = std::min(children[0].m_FirstPrimOffset, children[1].m_FirstPrimOffset);
+        subtree.m_NumPrimitives = children[0].m_NumPrimitives + children[1].m_NumPrimitives;
+        subtree.m_Contiguous = children[0].m_Contiguous && children[1].m_Contiguous &&
+                               (children[0].m_FirstPrimOffset + children[0].m_NumPrimitives == children[1].m_FirstPrimOffset ||
+                                children[1].m_FirstPrimOffset + children[1].m_NumPrimitives == children[0].m_FirstPrimOffset);
+
+        real leafCost = intersectionCost * subtree.m_NumPrimitives;
+        if (subtree.m_Contiguous && subtree.m_NumPrimitives <= maxPrimsInNode && leafCost <= subtree.m_Cost)
+        {
+            node->InitLeaf(subtree.m_FirstPrimOffset, subtree.m_NumPrimitives, node->m_Bounds);
+            subtree.m_Cost = leafCost;
+        }
+
+        return subtree;
+    }
+
+    i32 CollapseBVHLeaves(BVHBuildNode* root, i32 maxPrimsInNode, real traversalCost, real intersectionCost)
+    {
+        i32 numNodes = root->m_NumNodes;
+        CollapseSubtree(root, maxPrimsInNode, traversalCost, intersectionCost);
+        return numNodes - root->m_NumNodes;
+    }
+
+    // Finds the smallest range of quantized values whose decoded bounds contain child
+    static void QuantizeBounds(const Bounds3f& parent, const Bounds3f& child, u8 quantized[2][3])
+    {
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            const real min = parent.m_MinBound[axis];
+            const real max = parent.m_MaxBound[axis];
+            const real extent = max - min;
+
+            i32 quantizedMin = 0, quantizedMax = 255;
+            if (extent > 0)
+            {
+                quantizedMin = Clamp((i32)std::floor((child.m_MinBound[axis] - min) / extent * 255), 0, 255);
+                quantizedMax = Clamp((i32)std::ceil((child.m_MaxBound[axis] - min) / extent * 255), 0, 255);
+            }
+
+            // Rounding in the division and in DequantizeBound() can still leave a decoded bound inside the child
+            while (quantizedMin > 0 && DequantizeBound(quantizedMin, min, max) > child.m_MinBound[axis])
+                quantizedMin--;
+            while (quantizedMax < 255 && DequantizeBound(quantizedMax, min, max) < child.m_MaxBound[axis])
+                quantizedMax++;
+
+            quantized[0][axis] = quantizedMin;
+            quantized[1][axis] = quantizedMax;
+        }
+    }
+
+    std::vector<BVHCompressedNode> CompressBVH(const BVHLinearNode* tree, i32 numNodes)
+    {
+        struct UncompressedNode
+        {
+            i32 offset;
+            Bounds3f decodedBounds;
+        };
+
+        std::vector<BVHCompressedNode> compressedTree(numNodes);
+        std::vector<UncompressedNode> uncompressedNodes;
+        uncompressedNodes.push_back({0, tree[0].m_Bounds});
+
+        // Children are quantized relative to the decoded bounds of their parent rather than its exact bounds, since those are
+        // the bounds traversal will have available
+        while (uncompressedNodes.size() != 0)
+        {
+            UncompressedNode current = uncompressedNodes.back();
+            uncompressedNodes.pop_back();
+
+            const BVHLinearNode& node = tree[current.offset];
+            BVHCompressedNode& compressedNode = compressedTree[current.offset];
+            if (!node.IsInteriorNode())
+            {
+                ASSERT(node.m_FirstPrimOffset < (1 << 30));
+                compressedNode.m_NumPrimitives = node.m_NumPrimitives;
+                compressedNode.m_Offset = node.m_FirstPrimOffset;
+                compressedNode.m_SplitAxis = 3;
+                continue;
+            }
+
+            ASSERT(node.m_SecondChildOffset < (1 << 30));
+            compressedNode.m_Offset = node.m_SecondChildOffset;
+            compressedNode.m_SplitAxis = node.m_SplitAxis;
+
+            const i32 childOffsets[2] = {current.offset + 1, node.m_SecondChildOffset};
+            for (i32 i = 0; i < 2; i++)
+            {
+                QuantizeBounds(current.decodedBounds, tree[childOffsets[i]].m_Bounds, compressedNode.m_ChildBounds[i]);
+                uncompressedNodes.push_back(
+                    {childOffsets[i], DequantizeBounds(current.decodedBounds, compressedNode.m_ChildBounds[i])});
+            }
+        }
+
+        return compressedTree;
+    }
+
+    std::vector<BVHLinearNode> DecompressBVH(const std::vector<BVHCompressedNode>& compressedTree, const Bounds3f& rootBounds)
+    {
+        std::vector<BVHLinearNode> tree(compressedTree.size());
+        if (tree.empty())
+            return tree;
+
+        // Parents are stored before their children, so the bounds of every node are decoded before it is reached
+        tree[0].m_Bounds = rootBounds;
+        for (u64 i = 0; i < compressedTree.size(); i++)
+        {
+            const BVHCompressedNode& compressedNode = compressedTree[i];
+            BVHLinearNode& node = tree[i];
+            node.m_LargerChild = 0;
+            if (!compressedNode.IsInteriorNode())
+            {
+                node.m_FirstPrimOffset = compressedNode.m_Offset;
+                node.m_NumPrimitives = compressedNode.m_NumPrimitives;
+                node.m_SplitAxis = 0;
+                continue;
+            }
+
+            node.m_SecondChildOffset = compressedNode.m_Offset;
+            node.m_NumPrimitives = 0;
+            node.m_SplitAxis = compressedNode.m_SplitAxis;
+
+            Bounds3f& firstBounds = tree[i + 1].m_Bounds;
+            Bounds3f& secondBounds = tree[node.m_SecondChildOffset].m_Bounds;
+            firstBounds = DequantizeBounds(node.m_Bounds, compressedNode.m_ChildBounds[0]);
+            secondBounds = DequantizeBounds(node.m_Bounds, compressedNode.m_ChildBounds[1]);
+            node.m_LargerChild = secondBounds.SurfaceArea() > firstBounds.SurfaceArea();
+        }
+
+        return tree;
+    }
+
+    BVHClusteredNodePair* ClusterBVH(const BVHLinearNode* tree, i32 blockSize, i32* numPairs)
+    {
+        ASSERT(blockSize > 0 && (blockSize & (blockSize - 1)) == 0);
+
+        // An interior node whose children have not been placed yet
+        struct PendingNode
+        {
+            i32 binaryOffset;
+            i32 clusteredOffset;
+            real surfaceArea;
+
+            bool operator<(const PendingNode& other) const
+            {
+                return surfaceArea < other.surfaceArea;
+            }
+        };
+
+        auto initNode = [](BVHClusteredNode& node, const BVHLinearNode& binaryNode) {
+            node.m_Bounds = binaryNode.m_Bounds;
+            node.m_FirstPrimOffset = binaryNode.m_FirstPrimOffset;
+            node.m_NumPrimitives = binaryNode.m_NumPrimitives;
+            node.m_SplitAxis = binaryNode.m_SplitAxis;
+        };
+
+        std::vector<BVHClusteredNodePair> clusteredTree;
+        clusteredTree.emplace_back();
+        initNode(clusteredTree[0].m_Nodes[0], tree[0]);
+        clusteredTree[0].m_Nodes[1] = clusteredTree[0].m_Nodes[0];
+
+        const i32 pairsPerBlock = std::max(1, blockSize / (i32)sizeof(BVHClusteredNodePair));
+        std::vector<PendingNode> treeletRoots;
+        if (tree[0].IsInteriorNode())
+            treeletRoots.push_back({0, 0, tree[0].m_Bounds.SurfaceArea()});
+
+        // Treelets are started in the order their roots were left over, so the blocks near the root of the tree stay together.
+        // A treelet that runs out of nodes leaves the rest of its block to the next one
+        std::priority_queue<PendingNode> frontier;
+        for (u64 root = 0; root < treeletRoots.size(); root++)
+        {
+            frontier.push(treeletRoots[root]);
+            i32 blockPairsLeft = pairsPerBlock - clusteredTree.size() % pairsPerBlock;
+            while (!frontier.empty() && blockPairsLeft > 0)
+            {
+                PendingNode pending = frontier.top();
+                frontier.pop();
+
+                const i32 pairOffset = clusteredTree.size();
+                clusteredTree.emplace_back();
+                blockPairsLeft--;
+                clusteredTree[pending.clusteredOffset / 2].m_Nodes[pending.clusteredOffset % 2].m_ChildOffset = 2 * pairOffset;
+
+                const i32 childOffsets[2] = {pending.binaryOffset + 1, tree[pending.binaryOffset].m_SecondChildOffset};
+                for (i32 i = 0; i < 2; i++)
+                {
+                    const BVHLinearNode& child = tree[childOffsets[i]];
+                    initNode(clusteredTree[pairOffset].m_Nodes[i], child);
+                    if (child.IsInteriorNode())
+                        frontier.push({childOffsets[i], 2 * pairOffset + i, child.m_Bounds.SurfaceArea()});
+                }
+            }
+
+            for (; !frontier.empty(); frontier.pop())
+                treeletRoots.push_back(frontier.top());
+        }
+
+        // The blocks were laid out relative to the start of the array, which only puts them on block boundaries in memory
+        // once the array itself is aligned to the block size
+        const u64 alignment = std::max<u64>(blockSize, alignof(BVHClusteredNodePair));
+        BVHClusteredNodePair* alignedTree = AllocAligned<BVHClusteredNodePair>(clusteredTree.size(), alignment);
+        std::uninitialized_copy(clusteredTree.begin(), clusteredTree.end(), alignedTree);
+        *numPairs = clusteredTree.size();
+        return alignedTree;
+    }
+
+    std::vector<BVHLinearNode> DeclusterBVH(const BVHClusteredNodePair* clusteredTree, i32 numNodes)
+    {
+        // A clustered node still to be placed, and the binary parent it is the second child of, -1 if it is a first child
+        struct PendingNode
+        {
+            i32 clusteredOffset;
+            i32 parentOffset;
+        };
+
+        std::vector<BVHLinearNode> tree(numNodes);
+        std::vector<PendingNode> pendingNodes;
+        pendingNodes.push_back({0, -1});
+
+        // Placing first children right after their parent and the second children once their sibling's subtree is done gives
+        // back the depth first order ClusterBVH() started from
+        i32 offset = 0;
+        while (pendingNodes.size() != 0)
+        {
+            PendingNode pending = pendingNodes.back();
+            pendingNodes.pop_back();
+
+            ASSERT(offset < numNodes);
+            const BVHClusteredNode& clusteredNode =
+                clusteredTree[pending.clusteredOffset / 2].m_Nodes[pending.clusteredOffset % 2];
+            if (pending.parentOffset >= 0)
+                tree[pending.parentOffset].m_SecondChildOffset = offset;
+
+            BVHLinearNode& node = tree[offset];
+            node.m_Bounds = clusteredNode.m_Bounds;
+            node.m_NumPrimitives = clusteredNode.m_NumPrimitives;
+            node.m_SplitAxis = clusteredNode.m_SplitAxis;
+            node.m_LargerChild = 0;
+            if (!clusteredNode.IsInteriorNode())
+                node.m_FirstPrimOffset = clusteredNode.m_FirstPrimOffset;
+            else
+            {
+                const BVHClusteredNodePair& children = clusteredTree[clusteredNode.m_ChildOffset / 2];
+                node.m_LargerChild = children.m_Nodes[1].m_Bounds.SurfaceArea() > children.m_Nodes[0].m_Bounds.SurfaceArea();
+                pendingNodes.push_back({clusteredNode.m_ChildOffset + 1, offset});
+                pendingNodes.push_back({clusteredNode.m_ChildOffset, -1});
+            }
+            offset++;
+        }
+
+        ASSERT(offset == numNodes);
+        return tree;
+    }
+
+    BVHLastOccluder& LastOccluder()
+    {
+        thread_local BVHLastOccluder lastOccluder;
+        return lastOccluder;
+    }
+
+    std::vector<i32> BVHParentOffsets(const BVHLinearNode* tree, i32 numNodes, i32* depth)
+    {
+        // Parents precede their children in depth first order, so the depth of a parent is known before its children are seen
+        std::vector<i32> parentOffsets(numNodes, -1);
+        std::vector<i32> nodeDepths(numNodes, 1);
+        *depth = 1;
+        for (i32 i = 0; i < numNodes; i++)
+        {
+            if (i != 0)
+                nodeDepths[i] = nodeDepths[parentOffsets[i]] + 1;
+            *depth = std::max(*depth, nodeDepths[i]);
+
+            if (tree[i].IsInteriorNode())
+                parentOffsets[i + 1] = parentOffsets[tree[i].m_SecondChildOffset] = i;
+        }
+
+        return parentOffsets;
+    }
+
+    BVHStatistics BVHTreeStatistics(const BVHLinearNode* tree, i32 numNodes)
+    {
+        BVHStatistics statistics;
+        statistics.m_NumNodes = numNodes;
+        if (numNodes == 0)
+            return statistics;
+
+        BVHParentOffsets(tree, numNodes, &statistics.m_Depth);
+        for (i32 i = 0; i < numNodes; i++)
+        {
+            if (tree[i].IsInteriorNode())
+                continue;
+
+            i32 numPrimitives = tree[i].m_NumPrimitives;
+            if (numPrimitives >= (i32)statistics.m_LeafSizeHistogram.size())
+                statistics.m_LeafSizeHistogram.resize(numPrimitives + 1, 0);
+            statistics.m_LeafSizeHistogram[numPrimitives]++;
+            statistics.m_NumLeaves++;
+            statistics.m_NumReferences += numPrimitives;
+        }
+
+        return statistics;
+    }
+
+    std::string ToJSON(const BVHStatistics& statistics)
+    {
+        std::string leafSizeHistogram;
+        for (u64 i = 0; i < statistics.m_LeafSizeHistogram.size(); i++)
+            leafSizeHistogram += (i == 0 ? "" : ", ") + std::to_string(statistics.m_LeafSizeHistogram[i]);
+
+        return fmt::format("{{\"type\": \"BVH\", \"splitMethod\": \"{}\", \"layout\": \"{}\", \"nodes\": {}, "
+                           "\"interiorNodes\": {}, \"leaves\": {}, \"primitiveReferences\": {}, \"depth\": {}, "
+                           "\"leafSizeHistogram\": [{}], \"sahCost\": {:.4f}, \"nodeBytes\": {}, \"binaryNodeBytes\": {}, "
+                           "\"totalBytes\": {}}}",
+                           SplitMethodNames[static_cast<i32>(statistics.m_SplitMethod)],
+                           BVHLayoutNames[static_cast<i32>(statistics.m_Layout)], statistics.m_NumNodes,
+                           statistics.m_NumNodes - statistics.m_NumLeaves, statistics.m_NumLeaves, statistics.m_NumReferences,
+                           statistics.m_Depth, leafSizeHistogram, statistics.m_SAHCost, statistics.m_NodeBytes,
+                           statistics.m_BinaryNodeBytes, statistics.m_TotalBytes);
+    }
+
+    template <i32 Width>
+    std::vector<BVHWideNode<Width>> CollapseBVH(const BVHLinearNode* tree)
+    {
+        struct UncollapsedNode
+        {
+            i32 binaryOffset;
+            i32 wideOffset;
+        };
+
+        std::vector<BVHWideNode<Width>> wideTree(1);
+        std::vector<UncollapsedNode> uncollapsedNodes;
+        uncollapsedNodes.push_back({0, 0});
+
+        while (uncollapsedNodes.size() != 0)
+        {
+            UncollapsedNode current = uncollapsedNodes.back();
+            uncollapsedNodes.pop_back();
+
+            // A leaf at the root becomes the only child of the root wide node
+            i32 children[Width];
+            i32 numChildren = 0;
+            const BVHLinearNode& binaryNode = tree[current.binaryOffset];
+            if (!binaryNode.IsInteriorNode())
+            {
+                children[numChildren++] = current.binaryOffset;
+            }
+            else
+            {
+                children[numChildren++] = current.binaryOffset + 1;
+                children[numChildren++] = binaryNode.m_SecondChildOffset;
+            }
+
+            // Replace the interior child with the largest surface area by its own two children until the node is full
+            while (numChildren < Width)
+            {
+                i32 largestChild = -1;
+                real largestArea = -1;
+                for (i32 i = 0; i < numChildren; i++)
+                {
+                    const BVHLinearNode& child = tree[children[i]];
+                    if (child.IsInteriorNode() && child.m_Bounds.SurfaceArea() > largestArea)
+                    {
+                        largestChild = i;
+                        largestArea = child.m_Bounds.SurfaceArea();
+                    }
+                }
+
+                if (largestChild == -1)
+                    break;
+
+                const i32 openedOffset = children[largestChild];
+                children[largestChild] = openedOffset + 1;
+                children[numChildren++] = tree[openedOffset].m_SecondChildOffset;
+            }
+
+            // Unused slots get empty bounds and are masked out by m_NumChildren
+            BVHWideNode<Width> wideNode;
+            wideNode.m_NumChildren = numChildren;
+            for (i32 i = 0; i < Width; i++)
+            {
+                Bounds3f bounds = i < numChildren ? tree[children[i]].m_Bounds : Bounds3f{};
+                for (i32 axis = 0; axis < 3; axis++)
+                {
+                    wideNode.m_Bounds[0][axis][i] = bounds.m_MinBound[axis];
+                    wideNode.m_Bounds[1][axis][i] = bounds.m_MaxBound[axis];
+                }
+
+                wideNode.m_NumPrimitives[i] = 0;
+                wideNode.m_ChildOffset[i] = -1;
+                if (i >= numChildren)
+                    continue;
+
+                const BVHLinearNode& child = tree[children[i]];
+                if (child.IsInteriorNode())
+                {
+                    wideNode.m_ChildOffset[i] = wideTree.size();
+                    uncollapsedNodes.push_back({children[i], (i32)wideTree.size()});
+                    wideTree.emplace_back();
+                }
+                else
+                {
+                    wideNode.m_FirstPrimOffset[i] = child.m_FirstPrimOffset;
+                    wideNode.m_NumPrimitives[i] = child.m_NumPrimitives;
+                }
+            }
+
+            wideTree[current.wideOffset] = wideNode;
+        }
+
+        return wideTree;
+    }
+
+    template std::vector<BVHWideNode<4>> CollapseBVH<4>(const BVHLinearNode* tree);
+    template std::vector<BVHWideNode<8>> CollapseBVH<8>(const BVHLinearNode* tree);
+
+    std::vector<i32> SortRayStream(const Ray* rays, i32 numRays, const Bounds3f& bounds, std::array<i32, 9>* octantOffsets)
+    {
+        struct RayKey
+        {
+            u64 key;
+            i32 rayIndex;
+        };
+
+        std::vector<RayKey> keys(numRays);
+        octantOffsets->fill(0);
+        for (i32 i = 0; i < numRays; i++)
+        {
+            const Ray& ray = rays[i];
+            u32 octant = (1 / ray.d.x < 0) | ((1 / ray.d.y < 0) << 1) | ((1 / ray.d.z < 0) << 2);
+            (*octantOffsets)[octant + 1]++;
+
+            // Origins outside the bounds are clamped onto them
+            Vector3f offset = bounds.Offset(ray.o);
+            for (i32 axis = 0; axis < 3; axis++)
+                offset[axis] = Clamp(offset[axis], (real)0, (real)1);
+
+            keys[i] = {((u64)octant << 32) | EncodeMorton3(offset * 1024), i};
+        }
+
+        for (i32 octant = 0; octant < 8; octant++)
+            (*octantOffsets)[octant + 1] += (*octantOffsets)[octant];
+
+        std::sort(keys.begin(), keys.end(), [](const RayKey& a, const RayKey& b) { return a.key < b.key; });
+
+        std::vector<i32> rayIndices(numRays);
+        for (i32 i = 0; i < numRays; i++)
+            rayIndices[i] = keys[i].rayIndex;
+
+        return rayIndices;
+    }
+
+    static constexpr u64 BVHCacheMagic = 0x4548434143485642; // "BVHCACHE"
+    static constexpr u32 BVHCacheVersion = 4;
+
+    // Followed by the nodes and then the primitive order
+    struct BVHCacheHeader
+    {
+        u64 m_Magic;
+        u32 m_Version;
+        u32 m_NodeSize;
+        u64 m_Key;
+        i32 m_NumNodes;
+        i32 m_NumReferences;
+    };
+
+    static_assert(sizeof(BVHCacheHeader) == 32, "Nodes following the header should not straddle cache lines");
+
+    // 64 bit FNV-1a
+    static void HashBytes(u64* hash, const void* data, u64 size)
+    {
+        const u8* bytes = (const u8*)data;
+        for (u64 i = 0; i < size; i++)
+        {
+            *hash ^= bytes[i];
+            *hash *= 0x100000001b3;
+        }
+    }
+
+    template <typename T>
+    static void HashValue(u64* hash, const T& value)
+    {
+        HashBytes(hash, &value, sizeof(T));
+    }
+
+    u64 BVHCacheKey(const std::vector<BVHPrimitiveInfo>& primitiveInfo, i32 maxPrimsInNode, SplitMethod splitMethod,
+                    const BVHBuildParameters& parameters)
+    {
+        u64 hash = 0xcbf29ce484222325;
+        HashValue(&hash, BVHCacheVersion);
+        HashValue(&hash, (u32)sizeof(real));
+        HashValue(&hash, maxPrimsInNode);
+        HashValue(&hash, (i32)splitMethod);
+        HashValue(&hash, parameters.m_NumBuckets);
+        HashValue(&hash, parameters.m_TraversalCost);
+        HashValue(&hash, parameters.m_IntersectionCost);
+        HashValue(&hash, parameters.m_SpatialSplitBudget);
+        HashValue(&hash, parameters.m_SpatialSplitOverlap);
+        HashValue(&hash, (u64)primitiveInfo.size());
+        for (const BVHPrimitiveInfo& info : primitiveInfo)
+        {
+            HashValue(&hash, info.m_Bounds.m_MinBound);
+            HashValue(&hash, info.m_Bounds.m_MaxBound);
+        }
+
+        return hash;
+    }
+
+    std::string BVHCachePath(const std::string& directory, u64 key)
+    {
+        std::stringstream fileName;
+        fileName << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+        return (std::filesystem::path(directory) / fileName.str()).string();
+    }
+
+    Scope<MappedFile> LoadBVHCache(const std::string& path, u64 key, i32 numPrimitives, BVHLinearNode** nodes, i32* numNodes,
+                                   const u32** primitiveOrder, i32* numReferences)
+    {
+        Scope<MappedFile> file = MappedFile::Open(path);
+        if (!file || file->Size() < sizeof(BVHCacheHeader))
+            return nullptr;
+
+        const BVHCacheHeader* header = (const BVHCacheHeader*)file->Data();
+        if (header->m_Magic != BVHCacheMagic || header->m_Version != BVHCacheVersion ||
+            header->m_NodeSize != sizeof(BVHLinearNode) || header->m_Key != key || header->m_NumReferences < numPrimitives ||
+            header->m_NumNodes <= 0)
+            return nullptr;
+
+        const u64 nodesSize = (u64)header->m_NumNodes * sizeof(BVHLinearNode);
+        if (file->Size() != sizeof(BVHCacheHeader) + nodesSize + (u64)header->m_NumReferences * sizeof(u32))
+            return nullptr;
+
+        BVHLinearNode* fileNodes = (BVHLinearNode*)(file->Data() + sizeof(BVHCacheHeader));
+        const u32* filePrimitiveOrder = (const u32*)(file->Data() + sizeof(BVHCacheHeader) + nodesSize);
+        for (i32 i = 0; i < header->m_NumReferences; i++)
+            if (filePrimitiveOrder[i] >= (u32)numPrimitives)
+                return nullptr;
+
+        // Traversal follows the offsets without any checks, so a single corrupt node rejects the whole file. Both children of
+        // an interior node come after it, the first one immediately
+        for (i32 i = 0; i < header->m_NumNodes; i++)
+        {
+            const BVHLinearNode& node = fileNodes[i];
+            if (node.IsInteriorNode())
+            {
+                if (node.m_SecondChildOffset <= i + 1 || node.m_SecondChildOffset >= header->m_NumNodes || node.m_SplitAxis > 2)
+                    return nullptr;
+            }
+            else if (node.m_FirstPrimOffset < 0 || (i64)node.m_FirstPrimOffset + node.m_NumPrimitives > header->m_NumReferences)
+                return nullptr;
+        }
+
+        *nodes = fileNodes;
+        *numNodes = header->m_NumNodes;
+        *primitiveOrder = filePrimitiveOrder;
+        *numReferences = header->m_NumReferences;
+        return file;
+    }
+
+    bool SaveBVHCache(const std::string& path, u64 key, const BVHLinearNode* nodes, i32 numNodes,
+                      const std::vector<u32>& primitiveOrder)
+    {
+        BVHCacheHeader header{BVHCacheMagic, BVHCacheVersion, sizeof(BVHLinearNode), key, numNodes, (i32)primitiveOrder.size()};
+
+        // Write to a temporary file first, so that concurrent renders never map a partially written cache file. The name is
+        // unique to the writing process and thread, so renders of the same scene never write the same temporary file
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::string temporaryPath = path + ".tmp" + std::to_string(ProcessId()) + "_" +
+                                    std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream file(temporaryPath, std::ios::binary);
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)nodes, (u64)numNodes * sizeof(BVHLinearNode));
+            file.write((const char*)primitiveOrder.data(), primitiveOrder.size() * sizeof(u32));
+            if (!file)
+            {
+                file.close();
+                std::filesystem::remove(temporaryPath, error);
+                return false;
+            }
+        }
+
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+
+        return true;
+    }
+
+    BVHRayPacket::BVHRayPacket(const Ray* rays, i32 numRays)
+    {
+        // Unused lanes are filled with a ray that misses everything, they are masked out in any case
+        for (i32 i = 0; i < MaxRayPacketSize; i++)
+        {
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                m_Origin[axis][i] = i < numRays ? rays[i].o[axis] : 0;
+                m_InvDir[axis][i] = i < numRays ? 1 / rays[i].d[axis] : 1;
+            }
+            m_Tmax[i] = i < numRays ? rays[i].m_Tmax : -1;
+        }
+    }
+
+    u32 IntersectPacketBounds(const Bounds3f& bounds, const BVHRayPacket& packet, u32 activeMask)
+    {
+        u32 hitMask = 0;
+#if defined(YART_BVH_SSE)
+        const __m128 scale = _mm_set1_ps(1 + 2 * gamma(3));
+        for (i32 lane = 0; lane < MaxRayPacketSize; lane += 4)
+        {
+            if (!((activeMask >> lane) & 0b1111))
+                continue;
+
+            __m128 tMin = _mm_setzero_ps();
+            __m128 tMax = _mm_load_ps(&packet.m_Tmax[lane]);
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                const __m128 origin = _mm_load_ps(&packet.m_Origin[axis][lane]);
+                const __m128 invDir = _mm_load_ps(&packet.m_InvDir[axis][lane]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.m_MinBound[axis]), origin), invDir);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.m_MaxBound[axis]), origin), invDir);
+                // A ray lying in a slab plane gets a NaN from 0 * inf. The SSE min/max return their second operand when either
+                // is NaN, so like the unswapped scalar test t0 is kept as the near and t1 as the far distance, and the NaN is
+                // then dropped in favour of the running interval
+                tMin = _mm_max_ps(_mm_min_ps(t1, t0), tMin);
+                tMax = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t0, t1), scale), tMax);
+            }
+
+            hitMask |= _mm_movemask_ps(_mm_cmple_ps(tMin, tMax)) << lane;
+        }
+#else
+        for (i32 i = 0; i < MaxRayPacketSize; i++)
+        {
+            if (!(activeMask & (1u << i)))
+                continue;
+
+            real tMin = 0;
+            real tMax = packet.m_Tmax[i];
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                real t0 = (bounds.m_MinBound[axis] - packet.m_Origin[axis][i]) * packet.m_InvDir[axis][i];
+                real t1 = (bounds.m_MaxBound[axis] - packet.m_Origin[axis][i]) * packet.m_InvDir[axis][i];
+                if (t0 > t1)
+                    std::swap(t0, t1);
+
+                t1 *= 1 + 2 * gamma(3);
+                tMin = t0 > tMin ? t0 : tMin;
+                tMax = t1 < tMax ? t1 : tMax;
+            }
+
+            if (tMin <= tMax)
+                hitMask |= 1u << i;
+        }
+#endif
+
+        return hitMask & activeMask;
+    }
+
+    // Each helper tests the lanes [lane, lane + SIMD width) of a node. Like Bounds3::IntersectRay() the far distances are
+    // scaled up to stay conservative, and NaNs from rays lying in a slab plane are ignored by keeping the running interval as
+    // the second operand of min/max
+#if defined(YART_BVH_AVX)
+    template <i32 Width>
+    static u32 IntersectLanesAVX(const BVHWideNode<Width>& node, i32 lane, const BVHWideRay& ray, real tMax, real* tNear)
+    {
+        const __m256 scale = _mm256_set1_ps(1 + 2 * gamma(3));
+        __m256 tMin = _mm256_setzero_ps();
+        __m256 tMaxLanes = _mm256_set1_ps(tMax);
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            const __m256 origin = _mm256_set1_ps(ray.m_Origin[axis]);
+            const __m256 invDir = _mm256_set1_ps(ray.m_InvDir[axis]);
+            const real* nearBound = &node.m_Bounds[ray.m_DirIsNeg[axis]][axis][lane];
+            const real* farBound = &node.m_Bounds[1 - ray.m_DirIsNeg[axis]][axis][lane];
+            __m256 tNearAxis = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearBound), origin), invDir);
+            __m256 tFarAxis = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farBound), origin), invDir), scale);
+            tMin = _mm256_max_ps(tNearAxis, tMin);
+            tMaxLanes = _mm256_min_ps(tFarAxis, tMaxLanes);
+        }
+
+        _mm256_store_ps(tNear + lane, tMin);
+        return _mm256_movemask_ps(_mm256_cmp_ps(tMin, tMaxLanes, _CMP_LE_OQ));
+    }
+#endif
+
+#if defined(YART_BVH_SSE)
+    template <i32 Width>
+    static u32 IntersectLanesSSE(const BVHWideNode<Width>& node, i32 lane, const BVHWideRay& ray, real tMax, real* tNear)
+    {
+        const __m128 scale = _mm_set1_ps(1 + 2 * gamma(3));
+        __m128 tMin = _mm_setzero_ps();
+        __m128 tMaxLanes = _mm_set1_ps(tMax);
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            const __m128 origin = _mm_set1_ps(ray.m_Origin[axis]);
+            const __m128 invDir = _mm_set1_ps(ray.m_InvDir[axis]);
+            const real* nearBound = &node.m_Bounds[ray.m_DirIsNeg[axis]][axis][lane];
+            const real* farBound = &node.m_Bounds[1 - ray.m_DirIsNeg[axis]][axis][lane];
+            __m128 tNearAxis = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearBound), origin), invDir);
+            __m128 tFarAxis = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farBound), origin), invDir), scale);
+            tMin = _mm_max_ps(tNearAxis, tMin);
+            tMaxLanes = _mm_min_ps(tFarAxis, tMaxLanes);
+        }
+
+        _mm_store_ps(tNear + lane, tMin);
+        return _mm_movemask_ps(_mm_cmple_ps(tMin, tMaxLanes));
+    }
+#else
+    template <i32 Width>
+    static u32 IntersectLanesScalar(const BVHWideNode<Width>& node, i32 lane, const BVHWideRay& ray, real tMax, real* tNear)
+    {
+        real tMin = 0;
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            real tNearAxis = (node.m_Bounds[ray.m_DirIsNeg[axis]][axis][lane] - ray.m_Origin[axis]) * ray.m_InvDir[axis];
+            real tFarAxis = (node.m_Bounds[1 - ray.m_DirIsNeg[axis]][axis][lane] - ray.m_Origin[axis]) * ray.m_InvDir[axis];
+            tFarAxis *= 1 + 2 * gamma(3);
+            tMin = tNearAxis > tMin ? tNearAxis : tMin;
+            tMax = tFarAxis < tMax ? tFarAxis : tMax;
+        }
+
+        tNear[lane] = tMin;
+        return tMin <= tMax;
+    }
+#endif
+
+    template <i32 Width>
+    u32 IntersectWideNode(const BVHWideNode<Width>& node, const BVHWideRay& ray, real tMax, real* tNear)
+    {
+        const u32 childMask = (1u << node.m_NumChildren) - 1;
+        u32 hitMask = 0;
+
+#if defined(YART_BVH_AVX)
+        if constexpr ((Width % 8) == 0)
+        {
+            for (i32 lane = 0; lane < Width; lane += 8)
+                hitMask |= IntersectLanesAVX(node, lane, ray, tMax, tNear) << lane;
+            return hitMask & childMask;
+        }
+#endif
+
+#if defined(YART_BVH_SSE)
+        for (i32 lane = 0; lane < Width; lane += 4)
+            hitMask |= IntersectLanesSSE(node, lane, ray, tMax, tNear) << lane;
+#else
+        for (i32 lane = 0; lane < Width; lane++)
+            hitMask |= IntersectLanesScalar(node, lane, ray, tMax, tNear) << lane;
+#endif
+
+        return hitMask & childMask;
+    }
+
+    template u32 IntersectWideNode<4>(const BVHWideNode<4>& node, const BVHWideRay& ray, real tMax, real* tNear);
+    template u32 IntersectWideNode<8>(const BVHWideNode<8>& node, const BVHWideRay& ray, real tMax, real* tNear);
 }
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include "accelerators/dynamicbvh.h"
+#include <queue>
+
+namespace yart
+{
+    i32 DynamicBVHTree::AllocateNode()
+    {
+        if (m_FreeList == -1)
+        {
+            m_Nodes.emplace_back();
+            return (i32)m_Nodes.size() - 1;
+        }
+
+        i32 index = m_FreeList;
+        m_FreeList = m_Nodes[index].m_Parent;
+        m_Nodes[index] = DynamicBVHNode{};
+        return index;
+    }
+
+    void DynamicBVHTree::FreeNode(i32 index)
+    {
+        m_Nodes[index].m_Parent = m_FreeList;
+        m_Nodes[index].m_Height = -1;
+        m_FreeList = index;
+    }
+
+    i32 DynamicBVHTree::Insert(const Bounds3f& bounds)
+    {
+        i32 leaf = AllocateNode();
+        m_Nodes[leaf].m_Bounds = bounds;
+        InsertLeaf(leaf);
+        m_NumLeaves++;
+        return leaf;
+    }
+
+    void DynamicBVHTree::Remove(i32 leaf)
+    {
+        ASSERT(m_Nodes[leaf].IsLeaf() && m_Nodes[leaf].m_Height == 0);
+        RemoveLeaf(leaf);
+        FreeNode(leaf);
+        m_NumLeaves--;
+    }
+
+    void DynamicBVHTree::Move(i32 leaf, const Bounds3f& bounds)
+    {
+        ASSERT(m_Nodes[leaf].IsLeaf() && m_Nodes[leaf].m_Height == 0);
+        RemoveLeaf(leaf);
+        m_Nodes[leaf].m_Bounds = bounds;
+        InsertLeaf(leaf);
+    }
+
+    void DynamicBVHTree::InsertLeaf(i32 leaf)
+    {
+        if (m_Root == -1)
+        {
+            m_Root = leaf;
+            m_Nodes[leaf].m_Parent = -1;
+            return;
+        }
+
+        // The sibling and the new leaf get a new common parent in place of the sibling
+        i32 sibling = FindBestSibling(m_Nodes[leaf].m_Bounds);
+        i32 oldParent = m_Nodes[sibling].m_Parent;
+        i32 newParent = AllocateNode();
+        m_Nodes[newParent].m_Parent = oldParent;
+        m_Nodes[newParent].m_Children[0] = sibling;
+        m_Nodes[newParent].m_Children[1] = leaf;
+        m_Nodes[sibling].m_Parent = newParent;
+        m_Nodes[leaf].m_Parent = newParent;
+
+        if (oldParent == -1)
+            m_Root = newParent;
+        else
+        {
+            DynamicBVHNode& parent = m_Nodes[oldParent];
+            parent.m_Children[parent.m_Children[0] == sibling ? 0 : 1] = newParent;
+        }
+
+        RefitAncestors(newParent);
+    }
+
+    void DynamicBVHTree::RemoveLeaf(i32 leaf)
+    {
+        if (leaf == m_Root)
+        {
+            m_Root = -1;
+            return;
+        }
+
+        // The sibling takes the place of the parent, which is no longer needed
+        i32 parent = m_Nodes[leaf].m_Parent;
+        i32 grandParent = m_Nodes[parent].m_Parent;
+        i32 sibling = m_Nodes[parent].m_Children[m_Nodes[parent].m_Children[0] == leaf ? 1 : 0];
+        m_Nodes[sibling].m_Parent = grandParent;
+        FreeNode(parent);
+
+        if (grandParent == -1)
+        {
+            m_Root = sibling;
+            return;
+        }
+
+        DynamicBVHNode& node = m_Nodes[grandParent];
+        node.m_Children[node.m_Children[0] == parent ? 0 : 1] = sibling;
+        RefitAncestors(grandParent);
+    }
+
+    // Pairing the leaf with a node grows the surface area of that node to the union with the leaf, and the area of all of its
+    // ancestors by however much they have to grow to contain the leaf. Since ancestors only grow, a subtree can be skipped as
+    // soon as the growth inherited from its ancestors plus the area of the leaf exceeds the best cost found so far
+    i32 DynamicBVHTree::FindBestSibling(const Bounds3f& bounds) const
+    {
+        struct Candidate
+        {
+            i32 index;
+            real inheritedCost;
+
+            bool operator<(const Candidate& other) const
+            {
+                return inheritedCost > other.inheritedCost;
+            }
+        };
+
+        const real leafArea = bounds.SurfaceArea();
+        i32 bestSibling = m_Root;
+        real bestCost = Union(m_Nodes[m_Root].m_Bounds, bounds).SurfaceArea();
+
+        std::priority_queue<Candidate> candidates;
+        candidates.push({m_Root, 0});
+        while (!candidates.empty())
+        {
+            Candidate candidate = candidates.top();
+            candidates.pop();
+
+            const DynamicBVHNode& node = m_Nodes[candidate.index];
+            real unionArea = Union(node.m_Bounds, bounds).SurfaceArea();
+            real cost = unionArea + candidate.inheritedCost;
+            if (cost < bestCost)
+            {
+                bestSibling = candidate.index;
+                bestCost = cost;
+            }
+
+            if (node.IsLeaf())
+                continue;
+
+            real childInheritedCost = candidate.inheritedCost + unionArea - node.m_Bounds.SurfaceArea();
+            if (leafArea + childInheritedCost < bestCost)
+            {
+                candidates.push({node.m_Children[0], childInheritedCost});
+                candidates.push({node.m_Children[1], childInheritedCost});
+            }
+        }
+
+        return bestSibling;
+    }
+
+    void DynamicBVHTree::RefitAncestors(i32 index)
+    {
+        while (index != -1)
+        {
+            UpdateNode(index);
+            Rotate(index);
+            index = m_Nodes[index].m_Parent;
+        }
+    }
+
+    void DynamicBVHTree::UpdateNode(i32 index)
+    {
+        DynamicBVHNode& node = m_Nodes[index];
+        const DynamicBVHNode& first = m_Nodes[node.m_Children[0]];
+        const DynamicBVHNode& second = m_Nodes[node.m_Children[1]];
+        node.m_Bounds = Union(first.m_Bounds, second.m_Bounds);
+        node.m_Height = 1 + std::max(first.m_Height, second.m_Height);
+
+        // Traversal visits the first child first unless the ray points towards negative m_SplitAxis, so the children are
+        // ordered along the axis their centroids are furthest apart on
+        Vector3f centroidOffset = (second.m_Bounds.m_MinBound + second.m_Bounds.m_MaxBound) -
+                                  (first.m_Bounds.m_MinBound + first.m_Bounds.m_MaxBound);
+        Vector3f distance{std::abs(centroidOffset.x), std::abs(centroidOffset.y), std::abs(centroidOffset.z)};
+        node.m_SplitAxis = distance.x > distance.y ? (distance.x > distance.z ? 0 : 2) : (distance.y > distance.z ? 1 : 2);
+        if (centroidOffset[node.m_SplitAxis] < 0)
+            std::swap(node.m_Children[0], node.m_Children[1]);
+    }
+
+    // Swapping a child of the node with a grandchild below its sibling leaves the bounds of the node as they are but changes
+    // the bounds of the sibling. The swap that shrinks the sibling the most is made, if any shrinks it at all
+    void DynamicBVHTree::Rotate(i32 index)
+    {
+        const DynamicBVHNode& node = m_Nodes[index];
+        if (node.m_Height < 2)
+            return;
+
+        real bestAreaChange = 0;
+        i32 bestChild = -1, bestGrandChild = -1;
+        for (i32 child = 0; child < 2; child++)
+        {
+            const DynamicBVHNode& sibling = m_Nodes[node.m_Children[1 - child]];
+            if (sibling.IsLeaf())
+                continue;
+
+            const Bounds3f& childBounds = m_Nodes[node.m_Children[child]].m_Bounds;
+            for (i32 grandChild = 0; grandChild < 2; grandChild++)
+            {
+                const Bounds3f& remainingBounds = m_Nodes[sibling.m_Children[1 - grandChild]].m_Bounds;
+                real areaChange = Union(childBounds, remainingBounds).SurfaceArea() - sibling.m_Bounds.SurfaceArea();
+                if (areaChange < bestAreaChange)
+                {
+                    bestAreaChange = areaChange;
+                    bestChild = child;
+                    bestGrandChild = grandChild;
+                }
+            }
+        }
+
+        if (bestChild == -1)
+            return;
+
+        i32 child = node.m_Children[bestChild];
+        i32 sibling = node.m_Children[1 - bestChild];
+        i32 grandChild = m_Nodes[sibling].m_Children[bestGrandChild];
+
+        m_Nodes[index].m_Children[bestChild] = grandChild;
+        m_Nodes[grandChild].m_Parent = index;
+        m_Nodes[sibling].m_Children[bestGrandChild] = child;
+        m_Nodes[child].m_Parent = sibling;
+
+        UpdateNode(sibling);
+        UpdateNode(index);
+    }
+
+    real DynamicBVHTree::SAHCost(real traversalCost, real intersectionCost) const
+    {
+        if (m_Root == -1)
+            return 0;
+
+        const real rootArea = m_Nodes[m_Root].m_Bounds.SurfaceArea();
+        real cost = 0;
+        std::vector<i32> unvisitedNodes{m_Root};
+        while (!unvisitedNodes.empty())
+        {
+            const DynamicBVHNode& node = m_Nodes[unvisitedNodes.back()];
+            unvisitedNodes.pop_back();
+
+            real nodeCost = node.IsLeaf() ? intersectionCost : traversalCost;
+            cost += nodeCost * (rootArea > 0 ? node.m_Bounds.SurfaceArea() / rootArea : 1);
+            if (!node.IsLeaf())
+            {
+                unvisitedNodes.push_back(node.m_Children[0]);
+                unvisitedNodes.push_back(node.m_Children[1]);
+            }
+        }
+
+        return cost;
+    }
+}
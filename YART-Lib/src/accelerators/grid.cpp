@@ -0,0 +1,242 @@
+#include "accelerators/grid.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace yart
+{
+    namespace
+    {
+        // Picks the resolution giving close to numCells cubic cells over the bounds
+        Vector3i GridResolution(const Bounds3f& bounds, real numCells, i32 maxResolution)
+        {
+            const Vector3f diagonal = bounds.Diagonal();
+            const real maxExtent = std::max(diagonal.x, std::max(diagonal.y, diagonal.z));
+            if (maxExtent <= 0)
+                return {1, 1, 1};
+
+            // Flat bounds have no volume, so every axis is taken to be at least as wide as the finest cell along the longest
+            Vector3f extent;
+            for (i32 axis = 0; axis < 3; axis++)
+                extent[axis] = std::max(diagonal[axis], maxExtent / maxResolution);
+
+            const real cellsPerUnit = std::cbrt(std::max(numCells, (real)1) / (extent.x * extent.y * extent.z));
+            Vector3i resolution;
+            for (i32 axis = 0; axis < 3; axis++)
+                resolution[axis] = Clamp((i32)std::round(extent[axis] * cellsPerUnit), 1, maxResolution);
+            return resolution;
+        }
+
+        GridLevel MakeGridLevel(const Bounds3f& bounds, const Vector3i& resolution, i32 firstCell)
+        {
+            GridLevel grid;
+            grid.m_Bounds = bounds;
+            grid.m_Resolution = resolution;
+            grid.m_FirstCell = firstCell;
+
+            const Vector3f diagonal = bounds.Diagonal();
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                grid.m_CellSize[axis] = diagonal[axis] / resolution[axis];
+                grid.m_InvCellSize[axis] = diagonal[axis] > 0 ? resolution[axis] / diagonal[axis] : 0;
+            }
+            return grid;
+        }
+
+        i32 NumCells(const GridLevel& grid)
+        {
+            return grid.m_Resolution.x * grid.m_Resolution.y * grid.m_Resolution.z;
+        }
+
+        i32 CellIndex(const GridLevel& grid, i32 x, i32 y, i32 z)
+        {
+            return (z * grid.m_Resolution.y + y) * grid.m_Resolution.x + x;
+        }
+
+        // Range of cells, inclusive, overlapped by bounds
+        void OverlappedCells(const GridLevel& grid, const Bounds3f& bounds, Vector3i* first, Vector3i* last)
+        {
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                real minOffset = (bounds.m_MinBound[axis] - grid.m_Bounds.m_MinBound[axis]) * grid.m_InvCellSize[axis];
+                real maxOffset = (bounds.m_MaxBound[axis] - grid.m_Bounds.m_MinBound[axis]) * grid.m_InvCellSize[axis];
+                (*first)[axis] = Clamp((i32)std::floor(minOffset), 0, grid.m_Resolution[axis] - 1);
+                (*last)[axis] = Clamp((i32)std::floor(maxOffset), 0, grid.m_Resolution[axis] - 1);
+            }
+        }
+
+        // Counting sort of the given primitives into the cells of the grid: every primitive is counted in the cells it
+        // overlaps, the counts are turned into offsets with a prefix sum and the primitives are scattered to those offsets.
+        // In parallel, the order primitives are scattered in varies between runs, so every cell is sorted afterwards to keep
+        // the grid the same for every build
+        void BinPrimitives(const GridLevel& grid, const std::vector<Bounds3f>& primitiveBounds, const i32* primitives,
+                           i32 numPrimitives, bool parallel, GridCell* cells, std::vector<i32>* primitiveIndices)
+        {
+            const i32 numCells = NumCells(grid);
+            const i64 primitiveChunkSize = parallel ? 4096 : numPrimitives;
+            const i64 cellChunkSize = parallel ? 1024 : numCells;
+            std::vector<std::atomic<i32>> cellCounters(numCells);
+
+            auto forEachOverlappedCell = [&](i32 primitive, auto func) {
+                Vector3i first, last;
+                OverlappedCells(grid, primitiveBounds[primitive], &first, &last);
+                for (i32 z = first.z; z <= last.z; z++)
+                    for (i32 y = first.y; y <= last.y; y++)
+                        for (i32 x = first.x; x <= last.x; x++)
+                            func(CellIndex(grid, x, y, z));
+            };
+
+            // clang-format off
+            ParallelFor([&](i64 i) {
+                forEachOverlappedCell(primitives[i], [&](i32 cell) {
+                    cellCounters[cell].fetch_add(1, std::memory_order_relaxed);
+                });
+            }, numPrimitives, primitiveChunkSize);
+            // clang-format on
+
+            i32 offset = (i32)primitiveIndices->size();
+            for (i32 cell = 0; cell < numCells; cell++)
+            {
+                cells[cell].m_Offset = offset;
+                cells[cell].m_NumPrimitives = cellCounters[cell].load(std::memory_order_relaxed);
+                cellCounters[cell].store(offset, std::memory_order_relaxed);
+                offset += cells[cell].m_NumPrimitives;
+            }
+            primitiveIndices->resize(offset);
+
+            i32* indices = primitiveIndices->data();
+            // clang-format off
+            ParallelFor([&](i64 i) {
+                forEachOverlappedCell(primitives[i], [&](i32 cell) {
+                    indices[cellCounters[cell].fetch_add(1, std::memory_order_relaxed)] = primitives[i];
+                });
+            }, numPrimitives, primitiveChunkSize);
+
+            ParallelFor([&](i64 cell) {
+                std::sort(indices + cells[cell].m_Offset, indices + cells[cell].m_Offset + cells[cell].m_NumPrimitives);
+            }, numCells, cellChunkSize);
+            // clang-format on
+        }
+
+        struct NestedGrid
+        {
+            i32 m_TopCell;
+            GridLevel m_Grid;
+            std::vector<GridCell> m_Cells;
+            std::vector<i32> m_PrimitiveIndices;
+        };
+    }
+
+    void BuildGrid(const std::vector<Bounds3f>& primitiveBounds, const GridBuildParameters& parameters,
+                   std::vector<GridLevel>* grids, std::vector<GridCell>* cells, std::vector<i32>* primitiveIndices)
+    {
+        const i32 numPrimitives = (i32)primitiveBounds.size();
+        grids->clear();
+        cells->clear();
+        primitiveIndices->clear();
+
+        Bounds3f bounds;
+        for (const Bounds3f& primitiveBound : primitiveBounds)
+            bounds = Union(bounds, primitiveBound);
+
+        std::vector<i32> allPrimitives(numPrimitives);
+        for (i32 i = 0; i < numPrimitives; i++)
+            allPrimitives[i] = i;
+
+        const real topDensity = parameters.m_TwoLevel ? parameters.m_TopDensity : parameters.m_Density;
+        Vector3i topResolution = GridResolution(bounds, topDensity * numPrimitives, parameters.m_MaxResolution);
+        GridLevel topGrid = MakeGridLevel(bounds, topResolution, 0);
+        cells->resize(NumCells(topGrid));
+        BinPrimitives(topGrid, primitiveBounds, allPrimitives.data(), numPrimitives, true, cells->data(), primitiveIndices);
+        grids->push_back(topGrid);
+
+        if (!parameters.m_TwoLevel)
+            return;
+
+        std::vector<NestedGrid> nestedGrids;
+        for (i32 cell = 0; cell < (i32)cells->size(); cell++)
+        {
+            if ((*cells)[cell].m_NumPrimitives > parameters.m_MaxPrimsInCell)
+            {
+                nestedGrids.emplace_back();
+                nestedGrids.back().m_TopCell = cell;
+            }
+        }
+
+        // Nested grids are fitted to the part of their cell covered by primitives and are built in parallel, each on a
+        // single thread. Their cells are kept at least as large as the average primitive in them, since smaller cells only
+        // add references to primitives that already overlap many of them
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            NestedGrid& nestedGrid = nestedGrids[i];
+            const GridCell& topCell = (*cells)[nestedGrid.m_TopCell];
+            const i32* primitives = primitiveIndices->data() + topCell.m_Offset;
+
+            Bounds3f primitivesBounds;
+            Vector3f averageDiagonal{0, 0, 0};
+            for (i32 j = 0; j < topCell.m_NumPrimitives; j++)
+            {
+                primitivesBounds = Union(primitivesBounds, primitiveBounds[primitives[j]]);
+                averageDiagonal += primitiveBounds[primitives[j]].Diagonal() / topCell.m_NumPrimitives;
+            }
+
+            const i32 x = nestedGrid.m_TopCell % topGrid.m_Resolution.x;
+            const i32 y = (nestedGrid.m_TopCell / topGrid.m_Resolution.x) % topGrid.m_Resolution.y;
+            const i32 z = nestedGrid.m_TopCell / (topGrid.m_Resolution.x * topGrid.m_Resolution.y);
+            const Vector3f cellMin = topGrid.m_Bounds.m_MinBound + Vector3f(x, y, z) * topGrid.m_CellSize;
+            const Bounds3f cellBounds = Intersect(Bounds3f(cellMin, cellMin + topGrid.m_CellSize), primitivesBounds);
+
+            Vector3i resolution =
+                GridResolution(cellBounds, parameters.m_Density * topCell.m_NumPrimitives, parameters.m_MaxResolution);
+            const Vector3f cellDiagonal = cellBounds.Diagonal();
+            for (i32 axis = 0; axis < 3; axis++)
+            {
+                if (averageDiagonal[axis] > 0)
+                    resolution[axis] = Clamp((i32)(cellDiagonal[axis] / averageDiagonal[axis]), 1, resolution[axis]);
+            }
+            nestedGrid.m_Grid = MakeGridLevel(cellBounds, resolution, 0);
+            if (NumCells(nestedGrid.m_Grid) == 1)
+                return;
+
+            nestedGrid.m_Cells.resize(NumCells(nestedGrid.m_Grid));
+            BinPrimitives(nestedGrid.m_Grid, primitiveBounds, primitives, topCell.m_NumPrimitives, false,
+                          nestedGrid.m_Cells.data(), &nestedGrid.m_PrimitiveIndices);
+        }, nestedGrids.size());
+        // clang-format on
+
+        // Cells that would not be subdivided any further keep their primitives
+        nestedGrids.erase(std::remove_if(nestedGrids.begin(), nestedGrids.end(),
+                                         [](const NestedGrid& nestedGrid) { return nestedGrid.m_Cells.empty(); }),
+                          nestedGrids.end());
+        for (const NestedGrid& nestedGrid : nestedGrids)
+            (*cells)[nestedGrid.m_TopCell].m_NumPrimitives = -1;
+
+        // The references of the top level cells that were subdivided are replaced by those of their nested grids
+        std::vector<i32> topPrimitiveIndices;
+        topPrimitiveIndices.swap(*primitiveIndices);
+        for (GridCell& cell : *cells)
+        {
+            if (cell.HasNestedGrid())
+                continue;
+
+            i32 offset = (i32)primitiveIndices->size();
+            primitiveIndices->insert(primitiveIndices->end(), topPrimitiveIndices.begin() + cell.m_Offset,
+                                     topPrimitiveIndices.begin() + cell.m_Offset + cell.m_NumPrimitives);
+            cell.m_Offset = offset;
+        }
+
+        for (NestedGrid& nestedGrid : nestedGrids)
+        {
+            const i32 indicesOffset = (i32)primitiveIndices->size();
+            for (GridCell& cell : nestedGrid.m_Cells)
+                cell.m_Offset += indicesOffset;
+
+            nestedGrid.m_Grid.m_FirstCell = (i32)cells->size();
+            (*cells)[nestedGrid.m_TopCell].m_Offset = (i32)grids->size();
+            grids->push_back(nestedGrid.m_Grid);
+            cells->insert(cells->end(), nestedGrid.m_Cells.begin(), nestedGrid.m_Cells.end());
+            primitiveIndices->insert(primitiveIndices->end(), nestedGrid.m_PrimitiveIndices.begin(),
+                                     nestedGrid.m_PrimitiveIndices.end());
+        }
+    }
+}
@@ -0,0 +1,191 @@
+#include "accelerators/kdtree.h"
+#include <cmath>
+
+namespace yart
+{
+    namespace
+    {
+        // Where the bounds of a primitive start or end along an axis
+        struct BoundEdge
+        {
+            real m_Position;
+            i32 m_PrimitiveNumber;
+            bool m_Start;
+
+            // Edges at the same position are ordered starts first, so flat primitives lying in a split plane end up on
+            // both sides of it
+            bool operator<(const BoundEdge& other) const
+            {
+                if (m_Position == other.m_Position)
+                    return m_Start && !other.m_Start;
+                return m_Position < other.m_Position;
+            }
+        };
+
+        class KdTreeBuilder
+        {
+        public:
+            KdTreeBuilder(const std::vector<Bounds3f>& primitiveBounds, const KdTreeBuildParameters& parameters,
+                          std::vector<KdTreeNode>* nodes, std::vector<i32>* primitiveIndices)
+                : m_PrimitiveBounds(primitiveBounds), m_Parameters(parameters), m_Nodes(*nodes),
+                  m_PrimitiveIndices(*primitiveIndices)
+            {
+            }
+
+            void Build()
+            {
+                const i32 numPrimitives = (i32)m_PrimitiveBounds.size();
+                i32 maxDepth = m_Parameters.m_MaxDepth;
+                if (maxDepth < 0)
+                    maxDepth = (i32)std::round(8 + 1.3f * std::log2((real)numPrimitives));
+                maxDepth = std::min(maxDepth, MaxKdTreeDepth - 1);
+
+                Bounds3f bounds;
+                for (const Bounds3f& primitiveBound : m_PrimitiveBounds)
+                    bounds = Union(bounds, primitiveBound);
+
+                // The primitives below a split are written over those of the node being split, the ones above go to a
+                // new range for every level
+                for (i32 axis = 0; axis < 3; axis++)
+                    m_Edges[axis].resize(2 * numPrimitives);
+                m_PrimitivesBelow.resize(numPrimitives);
+                m_PrimitivesAbove.resize((u64)(maxDepth + 1) * numPrimitives);
+                for (i32 i = 0; i < numPrimitives; i++)
+                    m_PrimitivesBelow[i] = i;
+
+                m_Nodes.clear();
+                m_PrimitiveIndices.clear();
+                BuildNode(bounds, m_PrimitivesBelow.data(), numPrimitives, maxDepth, m_PrimitivesAbove.data(), 0);
+            }
+
+        private:
+            void InitLeaf(i32 nodeNumber, const i32* primitiveNumbers, i32 numPrimitives)
+            {
+                KdTreeNode& node = m_Nodes[nodeNumber];
+                node.m_Flags = 3 | ((u32)numPrimitives << 2);
+                if (numPrimitives == 0)
+                    node.m_OnePrimitive = 0;
+                else if (numPrimitives == 1)
+                    node.m_OnePrimitive = primitiveNumbers[0];
+                else
+                {
+                    node.m_PrimitiveIndicesOffset = (i32)m_PrimitiveIndices.size();
+                    m_PrimitiveIndices.insert(m_PrimitiveIndices.end(), primitiveNumbers, primitiveNumbers + numPrimitives);
+                }
+            }
+
+            void BuildNode(const Bounds3f& nodeBounds, i32* primitiveNumbers, i32 numPrimitives, i32 depth,
+                           i32* primitivesAbove, i32 badRefines)
+            {
+                const i32 nodeNumber = (i32)m_Nodes.size();
+                m_Nodes.emplace_back();
+
+                if (numPrimitives <= m_Parameters.m_MaxPrimsInNode || depth == 0)
+                {
+                    InitLeaf(nodeNumber, primitiveNumbers, numPrimitives);
+                    return;
+                }
+
+                // Splits are tried along the axis of largest extent first, and along the other two if no position along
+                // it lies inside the node
+                i32 bestAxis = -1, bestOffset = -1;
+                real bestCost = Infinity;
+                const real leafCost = m_Parameters.m_IntersectionCost * numPrimitives;
+                const real invTotalArea = 1 / nodeBounds.SurfaceArea();
+                const Vector3f diagonal = nodeBounds.Diagonal();
+                i32 axis = nodeBounds.MaximumExtent();
+                for (i32 retries = 0; retries < 3 && bestAxis == -1; retries++, axis = (axis + 1) % 3)
+                {
+                    std::vector<BoundEdge>& edges = m_Edges[axis];
+                    for (i32 i = 0; i < numPrimitives; i++)
+                    {
+                        const Bounds3f& bounds = m_PrimitiveBounds[primitiveNumbers[i]];
+                        edges[2 * i] = {bounds.m_MinBound[axis], primitiveNumbers[i], true};
+                        edges[2 * i + 1] = {bounds.m_MaxBound[axis], primitiveNumbers[i], false};
+                    }
+                    std::sort(edges.begin(), edges.begin() + 2 * numPrimitives);
+
+                    i32 numBelow = 0, numAbove = numPrimitives;
+                    const i32 otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+                    for (i32 i = 0; i < 2 * numPrimitives; i++)
+                    {
+                        if (!edges[i].m_Start)
+                            numAbove--;
+
+                        const real position = edges[i].m_Position;
+                        if (position > nodeBounds.m_MinBound[axis] && position < nodeBounds.m_MaxBound[axis])
+                        {
+                            const real sideArea = diagonal[otherAxis0] * diagonal[otherAxis1];
+                            const real perimeter = diagonal[otherAxis0] + diagonal[otherAxis1];
+                            real belowArea = 2 * (sideArea + (position - nodeBounds.m_MinBound[axis]) * perimeter);
+                            real aboveArea = 2 * (sideArea + (nodeBounds.m_MaxBound[axis] - position) * perimeter);
+
+                            real emptyBonus = (numAbove == 0 || numBelow == 0) ? m_Parameters.m_EmptyBonus : 0;
+                            real cost = m_Parameters.m_TraversalCost +
+                                        m_Parameters.m_IntersectionCost * (1 - emptyBonus) *
+                                            (belowArea * invTotalArea * numBelow + aboveArea * invTotalArea * numAbove);
+                            if (cost < bestCost)
+                            {
+                                bestCost = cost;
+                                bestAxis = axis;
+                                bestOffset = i;
+                            }
+                        }
+
+                        if (edges[i].m_Start)
+                            numBelow++;
+                    }
+                }
+
+                // A few splits that do not pay off are tolerated, since later splits may still make up for them
+                if (bestCost > leafCost)
+                    badRefines++;
+                if ((bestCost > 4 * leafCost && numPrimitives < 16) || bestAxis == -1 || badRefines == 3)
+                {
+                    InitLeaf(nodeNumber, primitiveNumbers, numPrimitives);
+                    return;
+                }
+
+                const std::vector<BoundEdge>& edges = m_Edges[bestAxis];
+                i32 numBelow = 0, numAbove = 0;
+                for (i32 i = 0; i < bestOffset; i++)
+                    if (edges[i].m_Start)
+                        primitiveNumbers[numBelow++] = edges[i].m_PrimitiveNumber;
+                for (i32 i = bestOffset + 1; i < 2 * numPrimitives; i++)
+                    if (!edges[i].m_Start)
+                        primitivesAbove[numAbove++] = edges[i].m_PrimitiveNumber;
+
+                const real split = edges[bestOffset].m_Position;
+                Bounds3f boundsBelow = nodeBounds, boundsAbove = nodeBounds;
+                boundsBelow.m_MaxBound[bestAxis] = boundsAbove.m_MinBound[bestAxis] = split;
+
+                // The primitives below overwrite those of this node, which is fine as they are no longer needed. The ones
+                // above are kept in their own range while the subtree below is built
+                BuildNode(boundsBelow, primitiveNumbers, numBelow, depth - 1, primitivesAbove + numPrimitives, badRefines);
+
+                const i32 aboveChild = (i32)m_Nodes.size();
+                KdTreeNode& node = m_Nodes[nodeNumber];
+                node.m_Split = split;
+                node.m_Flags = (u32)bestAxis | ((u32)aboveChild << 2);
+
+                BuildNode(boundsAbove, primitivesAbove, numAbove, depth - 1, primitivesAbove + numPrimitives, badRefines);
+            }
+
+        private:
+            const std::vector<Bounds3f>& m_PrimitiveBounds;
+            const KdTreeBuildParameters& m_Parameters;
+            std::vector<KdTreeNode>& m_Nodes;
+            std::vector<i32>& m_PrimitiveIndices;
+            std::vector<BoundEdge> m_Edges[3];
+            std::vector<i32> m_PrimitivesBelow;
+            std::vector<i32> m_PrimitivesAbove;
+        };
+    }
+
+    void BuildKdTree(const std::vector<Bounds3f>& primitiveBounds, const KdTreeBuildParameters& parameters,
+                     std::vector<KdTreeNode>* nodes, std::vector<i32>* primitiveIndices)
+    {
+        KdTreeBuilder builder(primitiveBounds, parameters, nodes, primitiveIndices);
+        builder.Build();
+    }
+}
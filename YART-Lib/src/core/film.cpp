@@ -4,6 +4,13 @@
 
 namespace yart
 {
+    FilmTile::FilmTile(const Bounds2i& pixelBounds, const Vector2f& filterRadius, const real* filterTable, i32 filterTableWidth)
+        : m_PixelBounds(pixelBounds), m_FilterRadius(filterRadius),
+          m_InvFilterRadius(Vector2f{1 / filterRadius.x, 1 / filterRadius.y}), m_FilterTable(filterTable),
+          m_FilterTableWidth(filterTableWidth), m_Pixels(std::max(0, pixelBounds.Area()))
+    {
+    }
+
     Film::Film(const Vector2i& resolution, const Bounds2f& cropWindow, Scope<Filter> filter, real physicalDiagonal,
                const std::string& filename, real scale)
         : m_Resolution(resolution), m_PhysicalDiagonal(physicalDiagonal), m_Filter(std::move(filter)), m_Filename(filename),
@@ -47,43 +54,97 @@ namespace yart
         return Bounds2f{{-x / 2, -y / 2}, {x / 2, y / 2}};
     }
 
+    Scope<FilmTile> Film::GetFilmTile(const Bounds2i& sampleBounds) const
+    {
+        // Samples in sampleBounds reach every pixel within the filter radius of their discrete coordinates
+        Vector2f halfPixel{0.5, 0.5};
+        Vector2i p0 = Vector2i(Ceil(Vector2f(sampleBounds.m_MinBound) - halfPixel - m_Filter->m_Radius));
+        Vector2i p1 = Vector2i(Floor(Vector2f(sampleBounds.m_MaxBound) - halfPixel + m_Filter->m_Radius)) + Vector2i{1, 1};
+        p0 = Max(p0, m_CroppedPixelBounds.m_MinBound);
+        p1 = Max(Min(p1, m_CroppedPixelBounds.m_MaxBound), p0);
+        Bounds2i tilePixelBounds(p0, p1);
+        return CreateScope<FilmTile>(tilePixelBounds, m_Filter->m_Radius, m_FilterTable, s_FilterTableWidth);
+    }
+
+    void Film::MergeFilmTile(Scope<FilmTile> tile)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (Vector2i point : tile->GetPixelBounds())
+        {
+            const FilmTile::Pixel& tilePixel = tile->GetPixel(point);
+            Pixel& pixel = GetPixel(point);
+            pixel.xyz[0] += tilePixel.xyz[0];
+            pixel.xyz[1] += tilePixel.xyz[1];
+            pixel.xyz[2] += tilePixel.xyz[2];
+            pixel.FilterWeightSum += tilePixel.FilterWeightSum;
+            pixel.Luminance.Merge(tilePixel.Luminance);
+        }
+    }
+
+    std::array<real, 3> Film::GetPixelRGB(const Vector2i& point) const
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return PixelRGB(GetPixel(point));
+    }
+
+    VarianceEstimator Film::GetPixelLuminance(const Vector2i& point) const
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return GetPixel(point).Luminance;
+    }
+
+    std::vector<VarianceEstimator> Film::GetPixelLuminances() const
+    {
+        const i64 numPixels = m_CroppedPixelBounds.Area();
+        std::vector<VarianceEstimator> luminances(numPixels);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::transform(m_Pixels, m_Pixels + numPixels, luminances.begin(), [](const Pixel& pixel) { return pixel.Luminance; });
+        return luminances;
+    }
+
+    std::array<real, 3> Film::PixelRGB(const Pixel& pixel)
+    {
+        std::array<real, 3> rgb = XYZToRGB(pixel.xyz);
+        if (pixel.FilterWeightSum != 0)
+        {
+            real invWt = 1 / pixel.FilterWeightSum;
+            rgb[0] = std::max((real)0, rgb[0] * invWt);
+            rgb[1] = std::max((real)0, rgb[1] * invWt);
+            rgb[2] = std::max((real)0, rgb[2] * invWt);
+        }
+        return rgb;
+    }
+
     void Film::WriteImage(bool normalize) const
     {
-        Scope<real[]> pixels(new real[3 * m_CroppedPixelBounds.Area()]);
-        i32 offset = 0;
-        for (Vector2i point : m_CroppedPixelBounds)
+        // The pixels are copied before converting them, so tiles merged meanwhile only wait for the copy. Each copy holds
+        // whole tiles, as merges are done under the same lock
+        const i64 numPixels = m_CroppedPixelBounds.Area();
+        Scope<Pixel[]> snapshot(new Pixel[numPixels]);
         {
-            const Pixel& pixel = GetPixel(point);
-            std::array<real, 3> xyz;
-            xyz[0] = pixel.xyz[0];
-            xyz[1] = pixel.xyz[1];
-            xyz[2] = pixel.xyz[2];
-            std::array<real, 3> rgb = XYZToRGB(xyz);
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            std::copy(m_Pixels, m_Pixels + numPixels, snapshot.get());
+        }
+
+        Scope<real[]> pixels(new real[3 * numPixels]);
+        // clang-format off
+        ParallelFor([&](i64 offset) {
+            std::array<real, 3> rgb = PixelRGB(snapshot[offset]);
             pixels[3 * offset + 0] = rgb[0];
             pixels[3 * offset + 1] = rgb[1];
             pixels[3 * offset + 2] = rgb[2];
-
-            real filterWeightSum = pixel.FilterWeightSum;
-            if (filterWeightSum != 0)
-            {
-                real invWt = 1 / filterWeightSum;
-                pixels[3 * offset + 0] = std::max((real)0, pixels[3 * offset + 0] * invWt);
-                pixels[3 * offset + 1] = std::max((real)0, pixels[3 * offset + 1] * invWt);
-                pixels[3 * offset + 2] = std::max((real)0, pixels[3 * offset + 2] * invWt);
-            }
-            offset++;
-        }
+        }, numPixels, 4096);
+        // clang-format on
 
         if (normalize)
         {
             u64 length = 3 * m_CroppedPixelBounds.Area();
             real* begin = pixels.get();
-            real* end = pixels.get() + length;
 
-            real max = *std::max_element(begin, end);
+            real max = ParallelReduce(
+                length, 4096, (real)0, [&](i64 i) { return begin[i]; }, [](real a, real b) { return std::max(a, b); });
             if (max != 0)
-                for (u64 i = 0; i < length; i++)
-                    pixels[i] /= max;
+                ParallelFor([&](i64 i) { begin[i] /= max; }, length, 4096);
         }
         yart::WriteImage(m_Filename, pixels.get(), m_CroppedPixelBounds, m_Resolution);
     }
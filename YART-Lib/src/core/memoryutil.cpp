@@ -1,17 +1,30 @@
 #include "core/memoryutil.h"
 
-#if defined(PLATFORM_LINUX)
+#if defined(PLATFORM_WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(PLATFORM_LINUX)
+#include <fcntl.h>
 #include <malloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 namespace yart
 {
     void* AllocAligned(u64 size)
+    {
+        return AllocAligned(size, YART_L1_CACHE_SIZE);
+    }
+
+    void* AllocAligned(u64 size, u64 alignment)
     {
 #if defined(PLATFORM_WINDOWS)
-        return _aligned_malloc(size, YART_L1_CACHE_SIZE);
+        return _aligned_malloc(size, alignment);
 #elif defined(PLATFORM_LINUX)
-        return memalign(YART_L1_CACHE_SIZE, size);
+        return memalign(alignment, size);
 #endif
     }
 
@@ -28,6 +41,65 @@ namespace yart
 #endif
     }
 
+    u32 ProcessId()
+    {
+#if defined(PLATFORM_WINDOWS)
+        return (u32)GetCurrentProcessId();
+#elif defined(PLATFORM_LINUX)
+        return (u32)getpid();
+#endif
+    }
+
+    Scope<MappedFile> MappedFile::Open(const std::string& path)
+    {
+#if defined(PLATFORM_WINDOWS)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return nullptr;
+
+        void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (!data)
+        {
+            CloseHandle(mapping);
+            return nullptr;
+        }
+
+        return Scope<MappedFile>(new MappedFile((u8*)data, size.QuadPart, mapping));
+#elif defined(PLATFORM_LINUX)
+        int file = open(path.c_str(), O_RDONLY);
+        if (file == -1)
+            return nullptr;
+
+        struct stat status;
+        void* data = MAP_FAILED;
+        if (fstat(file, &status) == 0 && status.st_size > 0)
+            data = mmap(nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        close(file);
+        if (data == MAP_FAILED)
+            return nullptr;
+
+        return Scope<MappedFile>(new MappedFile((u8*)data, status.st_size, nullptr));
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+#if defined(PLATFORM_WINDOWS)
+        UnmapViewOfFile(m_Data);
+        CloseHandle(m_Mapping);
+#elif defined(PLATFORM_LINUX)
+        munmap(m_Data, m_Size);
+#endif
+    }
+
     void* MemoryArena::Alloc(u64 nBytes)
     {
         // Round up nBytes to closest multiple of 16
@@ -0,0 +1,262 @@
+#include "core/parallel.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace yart
+{
+    namespace
+    {
+        struct ParallelLoop
+        {
+            const std::function<void(i64)>& m_Func;
+            const i64 m_ChunkSize;
+            std::atomic<i64> m_RemainingIterations;
+        };
+
+        // A range of iterations of a loop, split in halves until it is a single chunk
+        struct Task
+        {
+            ParallelLoop* m_Loop;
+            i64 m_Begin, m_End;
+        };
+
+        // Every thread owns a deque of tasks. Owners push and pop at the back, so they keep working on the small ranges they
+        // split off most recently, while idle threads steal from the front, where the largest ranges are
+        struct TaskQueue
+        {
+            std::mutex m_Mutex;
+            std::deque<Task> m_Tasks;
+        };
+
+        class ThreadPool
+        {
+        public:
+            explicit ThreadPool(i32 numThreads) : m_Queues(numThreads)
+            {
+                for (i32 i = 1; i < numThreads; i++)
+                    m_Workers.emplace_back(&ThreadPool::Worker, this, i);
+            }
+
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_SleepMutex);
+                    m_Shutdown = true;
+                }
+                m_WakeUp.notify_all();
+
+                for (std::thread& worker : m_Workers)
+                    worker.join();
+            }
+
+            i32 NumThreads() const
+            {
+                return (i32)m_Queues.size();
+            }
+
+            void ParallelFor(const std::function<void(i64)>& func, i64 count, i64 chunkSize)
+            {
+                ParallelLoop loop{func, chunkSize, {count}};
+                const i32 queue = QueueIndex();
+                Execute({&loop, 0, count}, queue);
+
+                // Chunks of this loop may still be queued here or running on other threads, until they are done this thread
+                // helps with whatever work there is. Once there is nothing left to take it sleeps until the thread finishing
+                // the last chunk wakes it, or until new tasks are queued, such as the chunks of a nested loop
+                while (loop.m_RemainingIterations.load(std::memory_order_acquire) > 0)
+                {
+                    Task task;
+                    if (PopTask(queue, &task) || StealTask(queue, &task))
+                    {
+                        Execute(task, queue);
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(m_SleepMutex);
+                    m_WakeUp.wait(lock, [&]() {
+                        return loop.m_RemainingIterations.load(std::memory_order_acquire) == 0 || m_NumQueuedTasks.load() > 0;
+                    });
+                }
+            }
+
+        private:
+            // Threads that are not part of the pool share the first queue
+            i32 QueueIndex() const
+            {
+                return s_WorkerPool == this ? s_WorkerQueue : 0;
+            }
+
+            void Worker(i32 queue)
+            {
+                s_WorkerPool = this;
+                s_WorkerQueue = queue;
+                while (true)
+                {
+                    Task task;
+                    if (PopTask(queue, &task) || StealTask(queue, &task))
+                    {
+                        Execute(task, queue);
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(m_SleepMutex);
+                    m_WakeUp.wait(lock, [&]() { return m_Shutdown || m_NumQueuedTasks.load() > 0; });
+                    if (m_Shutdown)
+                        return;
+                }
+            }
+
+            void Execute(Task task, i32 queue)
+            {
+                ParallelLoop& loop = *task.m_Loop;
+                while (task.m_End - task.m_Begin > loop.m_ChunkSize)
+                {
+                    i64 numChunks = (task.m_End - task.m_Begin + loop.m_ChunkSize - 1) / loop.m_ChunkSize;
+                    i64 middle = task.m_Begin + numChunks / 2 * loop.m_ChunkSize;
+                    PushTask(queue, {&loop, middle, task.m_End});
+                    task.m_End = middle;
+                }
+
+                for (i64 i = task.m_Begin; i < task.m_End; i++)
+                    loop.m_Func(i);
+
+                // The loop lives on the stack of the thread waiting for it, which may return as soon as the last iterations
+                // are counted, so only the pool is touched afterwards
+                const i64 numIterations = task.m_End - task.m_Begin;
+                if (loop.m_RemainingIterations.fetch_sub(numIterations, std::memory_order_acq_rel) == numIterations)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(m_SleepMutex);
+                    }
+                    m_WakeUp.notify_all();
+                }
+            }
+
+            void PushTask(i32 queue, const Task& task)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_Queues[queue].m_Mutex);
+                    m_Queues[queue].m_Tasks.push_back(task);
+                }
+                m_NumQueuedTasks++;
+
+                // Taking the lock makes sure a worker that just found no tasks is already waiting when notified
+                {
+                    std::lock_guard<std::mutex> lock(m_SleepMutex);
+                }
+                m_WakeUp.notify_one();
+            }
+
+            bool PopTask(i32 queue, Task* task)
+            {
+                std::lock_guard<std::mutex> lock(m_Queues[queue].m_Mutex);
+                if (m_Queues[queue].m_Tasks.empty())
+                    return false;
+
+                *task = m_Queues[queue].m_Tasks.back();
+                m_Queues[queue].m_Tasks.pop_back();
+                m_NumQueuedTasks--;
+                return true;
+            }
+
+            bool StealTask(i32 thief, Task* task)
+            {
+                if (m_NumQueuedTasks.load() == 0)
+                    return false;
+
+                for (i32 i = 1; i < NumThreads(); i++)
+                {
+                    TaskQueue& victim = m_Queues[(thief + i) % NumThreads()];
+                    std::lock_guard<std::mutex> lock(victim.m_Mutex);
+                    if (victim.m_Tasks.empty())
+                        continue;
+
+                    *task = victim.m_Tasks.front();
+                    victim.m_Tasks.pop_front();
+                    m_NumQueuedTasks--;
+                    return true;
+                }
+                return false;
+            }
+
+        private:
+            std::vector<TaskQueue> m_Queues;
+            std::vector<std::thread> m_Workers;
+            std::atomic<i32> m_NumQueuedTasks{0};
+
+            std::mutex m_SleepMutex;
+            std::condition_variable m_WakeUp;
+            bool m_Shutdown = false;
+
+            static thread_local ThreadPool* s_WorkerPool;
+            static thread_local i32 s_WorkerQueue;
+        };
+
+        thread_local ThreadPool* ThreadPool::s_WorkerPool = nullptr;
+        thread_local i32 ThreadPool::s_WorkerQueue = 0;
+
+        std::mutex s_ThreadPoolMutex;
+        Scope<ThreadPool> s_ThreadPool;
+        i32 s_NumThreads = 0;
+
+        ThreadPool& GetThreadPool()
+        {
+            std::lock_guard<std::mutex> lock(s_ThreadPoolMutex);
+            if (!s_ThreadPool)
+                s_ThreadPool = CreateScope<ThreadPool>(s_NumThreads > 0 ? s_NumThreads : NumSystemCores());
+            return *s_ThreadPool;
+        }
+    }
+
+    i32 NumSystemCores()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    void SetNumThreads(i32 numThreads)
+    {
+        std::lock_guard<std::mutex> lock(s_ThreadPoolMutex);
+        s_NumThreads = std::max(0, numThreads);
+        s_ThreadPool.reset();
+    }
+
+    i32 NumThreads()
+    {
+        return GetThreadPool().NumThreads();
+    }
+
+    void ParallelFor(const std::function<void(i64)>& func, i64 count, i64 chunkSize)
+    {
+        chunkSize = std::max((i64)1, chunkSize);
+
+        // Run loops of a single chunk on the calling thread without involving the pool
+        if (count <= chunkSize)
+        {
+            for (i64 i = 0; i < count; i++)
+                func(i);
+            return;
+        }
+
+        ThreadPool& threadPool = GetThreadPool();
+        if (threadPool.NumThreads() == 1)
+        {
+            for (i64 i = 0; i < count; i++)
+                func(i);
+            return;
+        }
+
+        threadPool.ParallelFor(func, count, chunkSize);
+    }
+
+    void ParallelFor2D(const std::function<void(Vector2i)>& func, const Vector2i& count, i64 chunkSize)
+    {
+        // clang-format off
+        ParallelFor([&](i64 i) {
+            func(Vector2i{(i32)(i % count.x), (i32)(i / count.x)});
+        }, (i64)std::max(count.x, 0) * std::max(count.y, 0), chunkSize);
+        // clang-format on
+    }
+}
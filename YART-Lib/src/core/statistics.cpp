@@ -0,0 +1,95 @@
+#include "core/statistics.h"
+#include "core/log.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace yart
+{
+    namespace
+    {
+        struct CounterRegistry
+        {
+            std::mutex m_Mutex;
+            std::vector<TraversalCounters*> m_ThreadCounters;
+            TraversalCounters m_ExitedThreadCounters; // Counts of threads that exited since the last reset
+        };
+
+        // Never destroyed, the workers of the persistent thread pool only exit while statics are being destroyed and still
+        // unregister their counters then
+        CounterRegistry& Registry()
+        {
+            static CounterRegistry* registry = new CounterRegistry;
+            return *registry;
+        }
+
+        void Accumulate(TraversalCounters& total, const TraversalCounters& counters)
+        {
+            total.m_RayQueries += counters.m_RayQueries;
+            total.m_NodesVisited += counters.m_NodesVisited;
+            total.m_BoxesTested += counters.m_BoxesTested;
+            total.m_PrimitivesTested += counters.m_PrimitivesTested;
+        }
+
+        // Registers the counters of a thread for as long as the thread lives
+        struct ThreadCounters
+        {
+            ThreadCounters()
+            {
+                CounterRegistry& registry = Registry();
+                std::lock_guard<std::mutex> lock(registry.m_Mutex);
+                registry.m_ThreadCounters.push_back(&m_Counters);
+            }
+
+            ~ThreadCounters()
+            {
+                CounterRegistry& registry = Registry();
+                std::lock_guard<std::mutex> lock(registry.m_Mutex);
+                Accumulate(registry.m_ExitedThreadCounters, m_Counters);
+                registry.m_ThreadCounters.erase(
+                    std::find(registry.m_ThreadCounters.begin(), registry.m_ThreadCounters.end(), &m_Counters));
+            }
+
+            TraversalCounters m_Counters;
+        };
+    }
+
+    TraversalCounters& LocalTraversalCounters()
+    {
+        thread_local ThreadCounters counters;
+        return counters.m_Counters;
+    }
+
+    TraversalCounters GatherTraversalCounters()
+    {
+        CounterRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.m_Mutex);
+        TraversalCounters total = registry.m_ExitedThreadCounters;
+        for (const TraversalCounters* counters : registry.m_ThreadCounters)
+            Accumulate(total, *counters);
+
+        return total;
+    }
+
+    void ResetTraversalCounters()
+    {
+        CounterRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.m_Mutex);
+        registry.m_ExitedThreadCounters = TraversalCounters{};
+        for (TraversalCounters* counters : registry.m_ThreadCounters)
+            *counters = TraversalCounters{};
+    }
+
+    std::string ToJSON(const TraversalCounters& counters)
+    {
+        auto perQuery = [&](u64 count) { return counters.m_RayQueries ? (double)count / counters.m_RayQueries : 0.0; };
+
+        return fmt::format("{{\"rayQueries\": {}, \"nodesVisited\": {}, \"boxesTested\": {}, \"primitivesTested\": {}, "
+                           "\"nodesVisitedPerQuery\": {:.3f}, \"boxesTestedPerQuery\": {:.3f}, "
+                           "\"primitivesTestedPerQuery\": {:.3f}}}",
+                           counters.m_RayQueries, counters.m_NodesVisited, counters.m_BoxesTested, counters.m_PrimitivesTested,
+                           perQuery(counters.m_NodesVisited), perQuery(counters.m_BoxesTested),
+                           perQuery(counters.m_PrimitivesTested));
+    }
+}
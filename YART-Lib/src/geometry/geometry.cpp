@@ -15,4 +15,9 @@ namespace yart
     {
         return IntersectRay(ray, nullptr, nullptr, testAlphaTexture);
     }
+
+    bool AbstractGeometry::WorldSphere(Vector3f*, real*) const
+    {
+        return false;
+    }
 }
\ No newline at end of file
@@ -9,6 +9,31 @@ namespace yart
         return Bounds3f(Vector3f(-m_Radius, -m_Radius, m_zMin), Vector3f(m_Radius, m_Radius, m_zMax));
     }
 
+    bool Sphere::WorldSphere(Vector3f* center, real* radius) const
+    {
+        if (m_zMin > -m_Radius || m_zMax < m_Radius || m_PhiMax < Radians((real)360))
+            return false;
+
+        // The transform has to be affine, with orthogonal axes of equal length
+        Vector3f origin = m_ObjectToWorld->AppPoint(Vector3f{0, 0, 0});
+        Vector3f axes[3] = {m_ObjectToWorld->AppVec(Vector3f{1, 0, 0}), m_ObjectToWorld->AppVec(Vector3f{0, 1, 0}),
+                            m_ObjectToWorld->AppVec(Vector3f{0, 0, 1})};
+        real scale = Norm(axes[0]);
+        const real tolerance = 1e-5 * scale;
+        for (i32 i = 0; i < 3; i++)
+        {
+            Vector3f unit{0, 0, 0};
+            unit[i] = 1;
+            if (Norm(m_ObjectToWorld->AppPoint(unit) - origin - axes[i]) > tolerance ||
+                std::abs(Norm(axes[i]) - scale) > tolerance || std::abs(Dot(axes[i], axes[(i + 1) % 3])) > tolerance * scale)
+                return false;
+        }
+
+        *center = origin;
+        *radius = m_Radius * scale;
+        return true;
+    }
+
     bool Sphere::IntersectRay(const Ray& ray, real* tHit, SurfaceInteraction* surfaceInteraction, bool testAlphaTexture) const
     {
         IntersectionData isect;
@@ -16,25 +41,48 @@ namespace yart
         if (!hit)
             return false;
 
+        if (surfaceInteraction)
+            *surfaceInteraction = ObjectInteraction(isect.pHit, isect.phi, ray);
+        if (tHit)
+            *tHit = isect.tShapeHit;
+
+        return true;
+    }
+
+    SurfaceInteraction Sphere::WorldInteraction(const Vector3f& pHit, const Ray& ray) const
+    {
+        // Project the point back onto the sphere, since it was found without this sphere's transform
+        Vector3f pObject = m_WorldToObject->AppPoint(pHit);
+        pObject = pObject * (m_Radius / Norm(pObject));
+
+        real phi = std::atan2(pObject.y, pObject.x);
+        if (phi < 0)
+            phi += 2 * Pi;
+
+        return ObjectInteraction(pObject, phi, ray);
+    }
+
+    SurfaceInteraction Sphere::ObjectInteraction(const Vector3f& pHit, real phi, const Ray& ray) const
+    {
         // Find parametric (u,v) representation of hit point
-        real u = isect.phi / m_PhiMax;
-        real theta = std::acos(isect.pHit.z / m_Radius);
+        real u = phi / m_PhiMax;
+        real theta = std::acos(Clamp(pHit.z / m_Radius, (real)-1, (real)1));
         real deltaTheta = m_ThetaMax - m_ThetaMin;
         real v = (theta - m_ThetaMin) / deltaTheta;
 
         // Compute partial derivates dpdu and dpdv
-        real zRadius = std::sqrt(isect.pHit.x * isect.pHit.x + isect.pHit.y * isect.pHit.y);
+        real zRadius = std::sqrt(pHit.x * pHit.x + pHit.y * pHit.y);
         real invZRadius = 1 / zRadius;
-        real cosPhi = isect.pHit.x * invZRadius;
-        real sinPhi = isect.pHit.y * invZRadius;
-        Vector3f dpdu(-m_PhiMax * isect.pHit.y, m_PhiMax * isect.pHit.x, 0);
-        Vector3f dpdv = deltaTheta * Vector3f(isect.pHit.z * cosPhi, isect.pHit.z * sinPhi, -m_Radius * std::sin(theta));
+        real cosPhi = pHit.x * invZRadius;
+        real sinPhi = pHit.y * invZRadius;
+        Vector3f dpdu(-m_PhiMax * pHit.y, m_PhiMax * pHit.x, 0);
+        Vector3f dpdv = deltaTheta * Vector3f(pHit.z * cosPhi, pHit.z * sinPhi, -m_Radius * std::sin(theta));
 
         // Compute partial derivates dndu and dndv
 
-        Vector3f dpdu2 = -m_PhiMax * m_PhiMax * Vector3f(isect.pHit.x, isect.pHit.y, 0);
-        Vector3f dpduv = deltaTheta * isect.pHit.z * m_PhiMax * Vector3f(-sinPhi, cosPhi, 0);
-        Vector3f dpdv2 = -deltaTheta * deltaTheta * isect.pHit;
+        Vector3f dpdu2 = -m_PhiMax * m_PhiMax * Vector3f(pHit.x, pHit.y, 0);
+        Vector3f dpduv = deltaTheta * pHit.z * m_PhiMax * Vector3f(-sinPhi, cosPhi, 0);
+        Vector3f dpdv2 = -deltaTheta * deltaTheta * pHit;
 
         // First fundamental forms
         real E = NormSquared(dpdu);
@@ -51,13 +99,8 @@ namespace yart
         Vector3f dndu = (f * F - e * G) * invEGF2 * dpdu + (e * F - f * E) * invEGF2 * dpdv;
         Vector3f dndv = (g * F - f * G) * invEGF2 * dpdu + (f * F - g * E) * invEGF2 * dpdv;
 
-        if (surfaceInteraction)
-            *surfaceInteraction = m_ObjectToWorld->AppSI(
-                SurfaceInteraction(isect.pHit, Vector3f{}, Vector2f(u, v), -ray.d, dpdu, dpdv, dndu, dndv, ray.m_Time, this));
-        if (tHit)
-            *tHit = isect.tShapeHit;
-
-        return true;
+        return m_ObjectToWorld->AppSI(
+            SurfaceInteraction(pHit, Vector3f{}, Vector2f(u, v), -ray.d, dpdu, dpdv, dndu, dndv, ray.m_Time, this));
     }
 
     bool Sphere::IntersectRay(const Ray& ray, bool testAlphaTexture) const
@@ -1,5 +1,70 @@
 #include "integrators/integrator.h"
+#include <filesystem>
+#include <fstream>
 
 namespace yart
 {
-}
\ No newline at end of file
+    static std::string EscapeJSONString(const std::string& string)
+    {
+        std::string escaped;
+        for (char c : string)
+        {
+            switch (c)
+            {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\b':
+                escaped += "\\b";
+                break;
+            case '\f':
+                escaped += "\\f";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if ((unsigned char)c < 0x20)
+                    escaped += fmt::format("\\u{:04x}", (i32)c);
+                else
+                    escaped += c;
+            }
+        }
+
+        return escaped;
+    }
+
+    void WriteRenderStatistics(const std::string& imageFilename, const std::string& aggregateStatistics, double renderSeconds,
+                               double samplesPerPixel)
+    {
+#if defined(YART_TRAVERSAL_STATISTICS)
+        std::string traversal = ToJSON(GatherTraversalCounters());
+#else
+        std::string traversal = "null";
+#endif
+        std::string statistics =
+            fmt::format("{{\"image\": \"{}\", \"renderSeconds\": {:.3f}, \"samplesPerPixel\": {}, \"aggregate\": {}, "
+                        "\"traversal\": {}}}\n",
+                        EscapeJSONString(std::filesystem::path(imageFilename).generic_string()), renderSeconds, samplesPerPixel,
+                        aggregateStatistics.empty() ? "null" : aggregateStatistics, traversal);
+
+        std::string path = std::filesystem::path(imageFilename).replace_extension(".stats.json").string();
+        std::ofstream file(path);
+        if (!(file << statistics))
+        {
+            LOG_WARN("Failed to write render statistics to {}", path);
+            return;
+        }
+
+        LOG_INFO("Wrote render statistics to {}", path);
+    }
+}
@@ -178,7 +178,7 @@ namespace yart
     Bounds3f Transform::AppBB(const Bounds3f& bb) const
     {
         const Transform& M = *this;
-        Vector3f base = M.AppVec(bb.m_MinBound);
+        Vector3f base = M.AppPoint(bb.m_MinBound);
 
         Vector3f x = M.AppVec(bb.Diagonal() * Vector3f{1, 0, 0});
         Vector3f y = M.AppVec(bb.Diagonal() * Vector3f{0, 1, 0});
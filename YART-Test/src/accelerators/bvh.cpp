@@ -1,5 +1,7 @@
 #include "testutil.h"
 #include <catch_amalgamated.hpp>
+#include <filesystem>
+#include <fstream>
 #include <yart.h>
 
 using namespace yart;
@@ -28,7 +30,7 @@ public:
     {
         real tHit2;
         bool ret = m_Bounds.IntersectRay(ray, tHit, &tHit2);
-        if (surfaceInt && tHit)
+        if (ret && surfaceInt && tHit)
         {
             if (*tHit != 0)
                 surfaceInt->m_Point = ray(*tHit);
@@ -37,6 +39,9 @@ public:
                 surfaceInt->m_Point = ray(tHit2);
                 *tHit = tHit2;
             }
+
+            // Not the normal of the face that was hit, but enough for the interaction to be transformable
+            surfaceInt->m_Normal = surfaceInt->m_Shading.m_Normal = Normalize(-ray.d);
         }
 
         return ret;
@@ -52,6 +57,11 @@ public:
         return m_Bounds.SurfaceArea();
     }
 
+    void SetBounds(const Bounds3f& bounds)
+    {
+        m_Bounds = bounds;
+    }
+
 private:
     Bounds3f m_Bounds;
 };
@@ -62,6 +72,21 @@ inline Ref<AbstractPrimitive<RGBSpectrum>> CreatePrimitive(const Bounds3f& bound
     return CreateRef<GeometricPrimitive<RGBSpectrum>>(geometry);
 }
 
+inline std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> CreatePrimitives(const std::vector<Bounds3f>& bounds)
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (const Bounds3f& bound : bounds)
+        primitives.push_back(CreatePrimitive(bound));
+
+    return primitives;
+}
+
+// Ray origins around boxes from RandomBoxes(), some of them outside the scene bounds
+inline Bounds3f AroundRandomBoxes(real extent)
+{
+    return Bounds3f{{-5, -5, -5}, {extent + 5, extent + 5, extent + 5}};
+}
+
 TEST_CASE("Intersect with one primitive", "[accelerators][bvh]")
 {
     Bounds3f bound({0, 0, 0}, {3, 4, 5});
@@ -138,7 +163,9 @@ TEST_CASE("All Primitive Centers in one spot", "[accelerators][bvh]")
     primitives.push_back(primitive1);
     primitives.push_back(primitive2);
 
-    BVHAccelerator bvh(primitives, 1, SplitMethod::Middle);
+    SplitMethod splitMethod = GENERATE(SplitMethod::SAH, SplitMethod::HLBVH, SplitMethod::Middle, SplitMethod::EqualCounts);
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, splitMethod);
 
     Ray miss({3, 0, 0}, {1, 0, 0});
 
@@ -196,7 +223,13 @@ TEST_CASE("End to End", "[accelerators][bvh]")
             }
 
     MaterialInteraction<RGBSpectrum> materialInteraction;
-    BVHAccelerator bvh(primitives, 1, SplitMethod::Middle);
+    SplitMethod splitMethod = GENERATE(SplitMethod::SAH, SplitMethod::HLBVH, SplitMethod::Middle, SplitMethod::EqualCounts);
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    BVHBuildParameters parameters;
+    parameters.m_Layout =
+        GENERATE(BVHLayout::Binary, BVHLayout::Wide4, BVHLayout::Wide8, BVHLayout::Compressed, BVHLayout::Clustered);
+    CAPTURE(SplitMethodNames[(i32)splitMethod], maxPrimsInNode, BVHLayoutNames[(i32)parameters.m_Layout]);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, splitMethod, parameters);
 
     SECTION("From inside primitives")
     {
@@ -284,3 +317,835 @@ TEST_CASE("End to End", "[accelerators][bvh]")
         CHECK(allMissedP);
     }
 }
+
+TEST_CASE("SAH build on clustered primitives", "[accelerators][bvh]")
+{
+    // A dense cluster next to a few large, sparse primitives, where splitting at the middle of the centroid bounds is poor
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 10; i++)
+        for (int j = 0; j < 10; j++)
+        {
+            Vector3f lowerBound = Vector3f(0.5f * i, 0.5f * j, 0);
+            primitives.push_back(CreatePrimitive(Bounds3f{lowerBound, lowerBound + Vector3f{0.25, 0.25, 0.25}}));
+        }
+    for (int i = 1; i <= 3; i++)
+    {
+        Vector3f lowerBound = Vector3f(100 * i, 0, 0);
+        primitives.push_back(CreatePrimitive(Bounds3f{lowerBound, lowerBound + Vector3f{10, 10, 10}}));
+    }
+
+    BVHBuildParameters parameters;
+    parameters.m_NumBuckets = GENERATE(2, 12, 32);
+    i32 maxPrimsInNode = GENERATE(1, 4, 255);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+
+    CHECK(Bounds3fAreEqual(Bounds3f({0, 0, 0}, {310, 10, 10}), bvh.WorldBound()));
+
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    bool allHit = true;
+    bool allHitP = true;
+    bool allIntersectionsCorrect = true;
+    for (int i = 0; i < 10; i++)
+        for (int j = 0; j < 10; j++)
+        {
+            Ray ray(Vector3f(0.5f * i + 0.125f, 0.5f * j + 0.125f, -1), {0, 0, 1});
+            Vector3f intersection = Vector3f(0.5f * i + 0.125f, 0.5f * j + 0.125f, 0);
+
+            bool hit = bvh.IntersectRay(ray, &materialInteraction);
+            ray.m_Tmax = Infinity;
+            bool hitP = bvh.IntersectRay(ray);
+
+            if (!hit)
+                allHit = false;
+            if (!hitP)
+                allHitP = false;
+            if (!Vector3fAreEqual(intersection, materialInteraction.m_Point))
+                allIntersectionsCorrect = false;
+        }
+
+    CHECK(allHit);
+    CHECK(allHitP);
+    CHECK(allIntersectionsCorrect);
+
+    Ray alongLargePrimitives({-1, 5, 5}, {1, 0, 0});
+    CHECK(bvh.IntersectRay(alongLargePrimitives, &materialInteraction));
+    CHECK(Vector3fAreEqual(Vector3f{100, 5, 5}, materialInteraction.m_Point));
+
+    Ray betweenLargePrimitives({115, 5, -1}, {0, 0, 1});
+    CHECK(!bvh.IntersectRay(betweenLargePrimitives, &materialInteraction));
+    CHECK(!bvh.IntersectRay(betweenLargePrimitives));
+}
+
+TEST_CASE("Parallel build", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < 16; j++)
+            for (int k = 0; k < 4; k++)
+            {
+                Vector3f lowerBound = Vector3f(2 * i, 2 * j, 2 * k);
+                primitives.push_back(CreatePrimitive(Bounds3f{lowerBound, lowerBound + Vector3f{1, 1, 1}}));
+            }
+
+    // Fork at every interior node so that both the parallel build and the parallel flattening are exercised
+    BVHBuildParameters parameters;
+    parameters.m_ParallelBuildThreshold = 2;
+    SplitMethod splitMethod = GENERATE(SplitMethod::SAH, SplitMethod::Middle, SplitMethod::EqualCounts);
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    CAPTURE(SplitMethodNames[(i32)splitMethod], maxPrimsInNode);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, splitMethod, parameters);
+
+    CHECK(Bounds3fAreEqual(Bounds3f({0, 0, 0}, {31, 31, 7}), bvh.WorldBound()));
+
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    bool allHit = true;
+    bool allIntersectionsCorrect = true;
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < 16; j++)
+        {
+            Ray ray(Vector3f(2 * i + 0.5f, 2 * j + 0.5f, -1), {0, 0, 1});
+            if (!bvh.IntersectRay(ray, &materialInteraction))
+                allHit = false;
+            else if (!Vector3fAreEqual(Vector3f(2 * i + 0.5f, 2 * j + 0.5f, 0), materialInteraction.m_Point))
+                allIntersectionsCorrect = false;
+        }
+
+    CHECK(allHit);
+    CHECK(allIntersectionsCorrect);
+
+    Ray betweenPrimitives({1.5f, 1.5f, -1}, {0, 0, 1});
+    CHECK(!bvh.IntersectRay(betweenPrimitives));
+}
+
+TEST_CASE("Alternate layouts match the binary layout", "[accelerators][bvh]")
+{
+    // Overlapping boxes of varying size, so that closest hit ordering matters
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(500, 50, 0, 5, 7));
+
+    BVHBuildParameters parameters;
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    BVHAccelerator binary(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+    parameters.m_Layout = GENERATE(BVHLayout::Wide4, BVHLayout::Wide8, BVHLayout::Compressed, BVHLayout::Clustered);
+    CAPTURE(maxPrimsInNode, BVHLayoutNames[(i32)parameters.m_Layout]);
+    BVHAccelerator wide(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+
+    CHECK(Bounds3fAreEqual(binary.WorldBound(), wide.WorldBound()));
+    CHECK(MatchesReference(wide, binary, AroundRandomBoxes(50)));
+}
+
+TEST_CASE("Leaf collapsing", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(500, 50, 4, 4, 11));
+
+    // Overlapping primitives and expensive traversal steps make small leaves worth it for every split method
+    BVHBuildParameters parameters;
+    parameters.m_TraversalCost = 1;
+    SplitMethod splitMethod = GENERATE(SplitMethod::Middle, SplitMethod::EqualCounts, SplitMethod::HLBVH, SplitMethod::SBVH);
+    i32 maxPrimsInNode = GENERATE(2, 4, 8);
+    CAPTURE(SplitMethodNames[(i32)splitMethod], maxPrimsInNode);
+    BVHAccelerator reference(primitives, 1, splitMethod, parameters);
+    BVHAccelerator collapsed(primitives, maxPrimsInNode, splitMethod, parameters);
+
+    BVHStatistics statistics = collapsed.Statistics();
+    CHECK(statistics.m_NumNodes < reference.Statistics().m_NumNodes);
+    CHECK((i32)statistics.m_LeafSizeHistogram.size() <= maxPrimsInNode + 1);
+    CHECK(statistics.m_LeafSizeHistogram.size() > 2);
+    CHECK(collapsed.SAHCost() <= reference.SAHCost() * 1.0001f);
+
+    CHECK(MatchesReference(collapsed, reference, AroundRandomBoxes(50)));
+}
+
+TEST_CASE("Collapsing a whole tree", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(200, 50, 1, 1, 13));
+
+    // Traversal steps cost more than intersecting every primitive and a leaf can hold all of them, so the tree collapses into
+    // a single leaf if the leaves of every subtree cover a contiguous range of the primitive order
+    BVHBuildParameters parameters;
+    parameters.m_TraversalCost = 1e6;
+    SplitMethod splitMethod = GENERATE(SplitMethod::SAH, SplitMethod::HLBVH, SplitMethod::Middle, SplitMethod::EqualCounts,
+                                       SplitMethod::SBVH);
+    CAPTURE(SplitMethodNames[(i32)splitMethod]);
+    BVHAccelerator bvh(primitives, 255, splitMethod, parameters);
+
+    CHECK(bvh.Statistics().m_NumNodes == 1);
+    CHECK(MatchesBruteForce(bvh, primitives, 51));
+}
+
+TEST_CASE("Clustered layout", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(1000, 50, 1, 1, 5));
+
+    BVHBuildParameters parameters;
+    BVHAccelerator binary(primitives, 1, SplitMethod::SAH, parameters);
+    parameters.m_Layout = BVHLayout::Clustered;
+    parameters.m_ClusterBlockSize = GENERATE(64, 256, 4096);
+    parameters.m_PrefetchFarChild = GENERATE(false, true);
+    CAPTURE(parameters.m_ClusterBlockSize, parameters.m_PrefetchFarChild);
+    BVHAccelerator clustered(primitives, 1, SplitMethod::SAH, parameters);
+
+    // A pair for each of the 999 interior nodes plus the pair holding the root, which replace the binary nodes
+    CHECK(clustered.NodeMemoryUsage() == primitives.size() * sizeof(BVHClusteredNodePair));
+    CHECK(Bounds3fAreEqual(binary.WorldBound(), clustered.WorldBound()));
+    CHECK(clustered.SAHCost() == binary.SAHCost());
+
+    CHECK(MatchesReference(clustered, binary, AroundRandomBoxes(50)));
+}
+
+TEST_CASE("Clustered node order", "[accelerators][bvh]")
+{
+    // A root with a small and a large subtree, each holding two leaves
+    BVHLinearNode tree[7];
+    Bounds3f bounds[7] = {{{0, 0, 0}, {10, 10, 10}}, {{0, 0, 0}, {1, 1, 1}}, {{0, 0, 0}, {1, 1, 0.5}},
+                          {{0, 0, 0.5}, {1, 1, 1}},  {{2, 2, 2}, {10, 10, 10}}, {{2, 2, 2}, {10, 10, 6}},
+                          {{2, 2, 6}, {10, 10, 10}}};
+    for (int i = 0; i < 7; i++)
+    {
+        tree[i].m_Bounds = bounds[i];
+        tree[i].m_NumPrimitives = 1;
+        tree[i].m_FirstPrimOffset = i;
+        tree[i].m_SplitAxis = 0;
+    }
+    tree[0].m_NumPrimitives = tree[1].m_NumPrimitives = tree[4].m_NumPrimitives = 0;
+    tree[0].m_SecondChildOffset = 4;
+    tree[1].m_SecondChildOffset = 3;
+    tree[4].m_SecondChildOffset = 6;
+
+    i32 blockSize = GENERATE(64, 4096);
+    i32 numPairs;
+    BVHClusteredNodePair* clustered = ClusterBVH(tree, blockSize, &numPairs);
+    REQUIRE(numPairs == 4);
+
+    // Blocks are laid out from the start of the array, so it has to start on a block boundary
+    CHECK((u64)clustered % blockSize == 0);
+
+    // The children of the larger subtree come first, whether it is placed within the first block or starts a block of its own
+    CHECK(clustered[0].m_Nodes[0].m_ChildOffset == 2);
+    CHECK(clustered[1].m_Nodes[0].m_ChildOffset == 6);
+    CHECK(clustered[1].m_Nodes[1].m_ChildOffset == 4);
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK(Bounds3fAreEqual(bounds[5 + i], clustered[2].m_Nodes[i].m_Bounds));
+        CHECK(clustered[2].m_Nodes[i].m_FirstPrimOffset == 5 + i);
+        CHECK(Bounds3fAreEqual(bounds[2 + i], clustered[3].m_Nodes[i].m_Bounds));
+    }
+
+    // Declustering gives back the depth first order
+    std::vector<BVHLinearNode> declustered = DeclusterBVH(clustered, 7);
+    for (int i = 0; i < 7; i++)
+    {
+        CHECK(Bounds3fAreEqual(bounds[i], declustered[i].m_Bounds));
+        CHECK(declustered[i].m_NumPrimitives == tree[i].m_NumPrimitives);
+        CHECK(declustered[i].m_SecondChildOffset == tree[i].m_SecondChildOffset);
+    }
+
+    FreeAligned(clustered);
+}
+
+TEST_CASE("Stackless traversal", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(500, 50, 0, 5, 13));
+
+    BVHBuildParameters parameters;
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    CAPTURE(maxPrimsInNode);
+    BVHAccelerator stack(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+    parameters.m_StacklessTraversal = true;
+    BVHAccelerator stackless(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+
+    CHECK(MatchesReference(stackless, stack, AroundRandomBoxes(50)));
+}
+
+TEST_CASE("Trees deeper than the traversal stack", "[accelerators][bvh]")
+{
+    // Splitting at the middle of the centroid bounds only ever separates the last of these exponentially spaced primitives
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 120; i++)
+    {
+        real x = std::ldexp((real)1, i);
+        primitives.push_back(CreatePrimitive(Bounds3f{{x, 0, 0}, {1.5f * x, 1, 1}}));
+    }
+
+    BVHBuildParameters parameters;
+    parameters.m_Layout = GENERATE(BVHLayout::Binary, BVHLayout::Wide4, BVHLayout::Compressed, BVHLayout::Clustered);
+    CAPTURE(BVHLayoutNames[(i32)parameters.m_Layout]);
+    BVHAccelerator bvh(primitives, 1, SplitMethod::Middle, parameters);
+
+    // Only the binary nodes are built and kept, whichever layout was selected
+    BVHStatistics statistics = bvh.Statistics();
+    CHECK(statistics.m_Layout == BVHLayout::Binary);
+    CHECK(statistics.m_NodeBytes == statistics.m_BinaryNodeBytes);
+
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    bool allHit = true;
+    bool allIntersectionsCorrect = true;
+    Ray rays[MaxRayPacketSize];
+    for (int i = 0; i < 120; i++)
+    {
+        real x = 1.25f * std::ldexp((real)1, i);
+        Ray ray({x, 0.5, -1}, {0, 0, 1});
+        rays[i % MaxRayPacketSize] = ray;
+        if (!bvh.IntersectRay(ray, &materialInteraction) || !bvh.IntersectRay(Ray({x, 0.5, -1}, {0, 0, 1})))
+            allHit = false;
+        else if (!Vector3fAreEqual(Vector3f(x, 0.5, 0), materialInteraction.m_Point))
+            allIntersectionsCorrect = false;
+    }
+
+    CHECK(allHit);
+    CHECK(allIntersectionsCorrect);
+    CHECK(bvh.IntersectPacket(rays, MaxRayPacketSize) == (1u << MaxRayPacketSize) - 1);
+    CHECK(!bvh.IntersectRay(Ray({1.75f, 0.5, -1}, {0, 0, 1})));
+}
+
+TEST_CASE("Occlusion queries", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(500, 50, 0, 5, 17));
+
+    BVHBuildParameters parameters;
+    parameters.m_Layout = GENERATE(BVHLayout::Binary, BVHLayout::Wide8, BVHLayout::Compressed, BVHLayout::Clustered);
+    CAPTURE(BVHLayoutNames[(i32)parameters.m_Layout]);
+    BVHAccelerator cached(primitives, 4, SplitMethod::SAH, parameters);
+    parameters.m_CacheLastOccluder = false;
+    BVHAccelerator uncached(primitives, 4, SplitMethod::SAH, parameters);
+
+    // Short rays from a small region, so that the last occluder blocks some of the following queries but not all of them
+    CHECK(MatchesReference(cached, uncached, Bounds3f{{20, 20, 20}, {30, 30, 30}}, 25));
+
+    Vector3f center = primitives[0]->WorldBound().Lerp(Vector3f{0.5, 0.5, 0.5});
+    CHECK(cached.IntersectRay(Ray(center - Vector3f{0, 0, 100}, {0, 0, 1})));
+    CHECK(LastOccluder().m_Accelerator == &cached);
+}
+
+TEST_CASE("Inline spheres", "[accelerators][bvh]")
+{
+    // Complete spheres, which are stored inline, mixed with partial and non-uniformly scaled spheres and boxes, which are
+    // intersected through their primitives
+    PCG32Random rng(19);
+    std::vector<Scope<Transform>> transforms;
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 1000; i++)
+    {
+        Vector3f center = Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * 50;
+        if (i % 10 == 9)
+        {
+            primitives.push_back(CreatePrimitive(Bounds3f{center, center + Vector3f{1, 1, 1}}));
+            continue;
+        }
+
+        Transform objectToWorld = Translate(center) * Rotate(360 * rng.UniformFloat(), Vector3f{1, 1, 0});
+        if (i % 10 == 8)
+            objectToWorld = objectToWorld * Scale(Vector3f{1, 2, 1});
+        transforms.push_back(CreateScope<Transform>(objectToWorld));
+        transforms.push_back(CreateScope<Transform>(Inverse(objectToWorld)));
+        real radius = 0.2f + rng.UniformFloat();
+        real zMax = i % 10 == 7 ? 0 : radius;
+        auto sphere = CreateRef<Sphere>(transforms[transforms.size() - 2].get(), transforms.back().get(), false, radius,
+                                        -radius, zMax, 360.0f);
+        primitives.push_back(CreateRef<GeometricPrimitive<RGBSpectrum>>(sphere));
+    }
+
+    BVHBuildParameters parameters;
+    i32 maxPrimsInNode = GENERATE(1, 4, 16);
+    CAPTURE(maxPrimsInNode);
+    BVHAccelerator primitiveLeaves(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+    parameters.m_InlineSpheres = true;
+    parameters.m_Layout =
+        GENERATE(BVHLayout::Binary, BVHLayout::Wide4, BVHLayout::Wide8, BVHLayout::Compressed, BVHLayout::Clustered);
+    parameters.m_StacklessTraversal = GENERATE(false, true);
+    CAPTURE(BVHLayoutNames[(i32)parameters.m_Layout], parameters.m_StacklessTraversal);
+    BVHAccelerator inlined(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+
+    // Sphere::IntersectRay() solves its quadratic without guarding against cancellation, so points found through the
+    // primitives are only accurate to about 1e-4 of the distance to the sphere
+    Bounds3f origins = AroundRandomBoxes(50);
+    CHECK(MatchesReference(inlined, primitiveLeaves, origins, Infinity, 1e-3));
+    CHECK(MatchesReference(inlined, primitiveLeaves, origins, 10, 1e-3));
+}
+
+TEST_CASE("Spatial splits", "[accelerators][bvh]")
+{
+    // Long, thin bars along all three axes, whose bounds overlap heavily under any object partition
+    std::vector<Bounds3f> bars = RandomBoxes(300, 50, 0.5, 0.5, 11);
+    std::vector<Vector3f> lengths = RandomPoints(300, 30, 12);
+    for (int i = 0; i < 300; i++)
+        bars[i].m_MaxBound[i % 3] += 5 + lengths[i][i % 3];
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(bars);
+
+    BVHBuildParameters parameters;
+    parameters.m_SpatialSplitBudget = GENERATE(0.0, 0.3, 4.0);
+    parameters.m_Layout = GENERATE(BVHLayout::Binary, BVHLayout::Wide4, BVHLayout::Compressed);
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    CAPTURE(parameters.m_SpatialSplitBudget, BVHLayoutNames[(i32)parameters.m_Layout], maxPrimsInNode);
+    BVHAccelerator objectSplits(primitives, maxPrimsInNode, SplitMethod::SAH);
+    BVHAccelerator spatialSplits(primitives, maxPrimsInNode, SplitMethod::SBVH, parameters);
+
+    CHECK(Bounds3fAreEqual(objectSplits.WorldBound(), spatialSplits.WorldBound()));
+    if (parameters.m_SpatialSplitBudget > 0)
+        CHECK(spatialSplits.SAHCost() < objectSplits.SAHCost());
+
+    CHECK(MatchesReference(spatialSplits, objectSplits, AroundRandomBoxes(50)));
+}
+
+TEST_CASE("Compressed layout", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 64; i++)
+    {
+        Vector3f lowerBound = Vector3f(1.1f * i, 0.3f * i, -0.7f * i);
+        primitives.push_back(CreatePrimitive(Bounds3f{lowerBound, lowerBound + Vector3f{0.3f, 0.1f, 0.9f}}));
+    }
+
+    BVHBuildParameters parameters;
+    BVHAccelerator binary(primitives, 1, SplitMethod::SAH, parameters);
+    parameters.m_Layout = BVHLayout::Compressed;
+    BVHAccelerator compressed(primitives, 1, SplitMethod::SAH, parameters);
+
+    // Compressed nodes replace the binary nodes and are half their size, which the statistics report as the saving
+    CHECK(compressed.NodeMemoryUsage() * 2 == binary.NodeMemoryUsage());
+    BVHStatistics statistics = compressed.Statistics();
+    CHECK(statistics.m_BinaryNodeBytes == binary.NodeMemoryUsage());
+    CHECK(statistics.m_BinaryNodeBytes - statistics.m_NodeBytes == statistics.m_NodeBytes);
+    CHECK(Bounds3fAreEqual(compressed.WorldBound(), binary.WorldBound()));
+    CHECK(compressed.Statistics().m_NumNodes == binary.Statistics().m_NumNodes);
+
+    // Rays just inside the edges of every primitive still hit it, so no decoded bounds were rounded inwards
+    const real inset = 1e-3f;
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    bool allHit = true;
+    for (int i = 0; i < 64; i++)
+    {
+        Vector3f lowerBound = Vector3f(1.1f * i, 0.3f * i, -0.7f * i);
+        Vector3f upperBound = lowerBound + Vector3f{0.3f, 0.1f, 0.9f};
+        Ray nearMinCorner(Vector3f(lowerBound.x + inset, lowerBound.y + inset, lowerBound.z - 1), {0, 0, 1});
+        Ray nearMaxCorner(Vector3f(upperBound.x - inset, upperBound.y - inset, upperBound.z + 1), {0, 0, -1});
+        if (!compressed.IntersectRay(nearMinCorner, &materialInteraction) || !compressed.IntersectRay(nearMaxCorner))
+            allHit = false;
+    }
+
+    CHECK(allHit);
+}
+
+TEST_CASE("Ray packets", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(300, 40, 0, 4, 3));
+
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    i32 packetSize = GENERATE(1, 4, 7, 8, 16);
+    bool coherent = GENERATE(true, false);
+    CAPTURE(maxPrimsInNode, packetSize, coherent);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, SplitMethod::SAH);
+
+    PCG32Random rng(3);
+    bool allHitsMatch = true;
+    bool allIntersectionsMatch = true;
+    for (int packet = 0; packet < 100; packet++)
+    {
+        // Coherent packets are neighbouring parallel rays, like camera rays of a small tile
+        Ray rays[MaxRayPacketSize];
+        Vector3f o = Vector3f(rng.UniformFloat(), rng.UniformFloat(), 0) * 40 - Vector3f{0, 0, 5};
+        Vector3f d = Normalize(Vector3f(rng.UniformFloat() - 0.5f, rng.UniformFloat() - 0.5f, 1));
+        for (i32 i = 0; i < packetSize; i++)
+        {
+            if (coherent)
+                rays[i] = Ray(o + Vector3f((i % 4) * 0.5f, (i / 4) * 0.5f, 0), d);
+            else
+                rays[i] = Ray(Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * 40,
+                              Normalize(Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) -
+                                        Vector3f{0.5, 0.5, 0.5}));
+        }
+
+        Ray singleRays[MaxRayPacketSize];
+        std::copy(rays, rays + packetSize, singleRays);
+        MaterialInteraction<RGBSpectrum> packetInteractions[MaxRayPacketSize], singleInteraction;
+
+        u32 anyHitMask = bvh.IntersectPacket(rays, packetSize);
+        u32 hitMask = bvh.IntersectPacket(rays, packetSize, packetInteractions);
+        for (i32 i = 0; i < packetSize; i++)
+        {
+            bool anyHit = bvh.IntersectRay(singleRays[i]);
+            bool hit = bvh.IntersectRay(singleRays[i], &singleInteraction);
+            if (hit != (bool)(hitMask & (1u << i)) || anyHit != (bool)(anyHitMask & (1u << i)))
+                allHitsMatch = false;
+            else if (hit && !Vector3fAreEqual(singleInteraction.m_Point, packetInteractions[i].m_Point))
+                allIntersectionsMatch = false;
+        }
+    }
+
+    CHECK(allHitsMatch);
+    CHECK(allIntersectionsMatch);
+}
+
+TEST_CASE("Packet bounds test on box faces", "[accelerators][bvh]")
+{
+    // Axis aligned rays lying in the plane of a face give 0 * inf = NaN slab distances, which must be treated like the
+    // scalar Bounds3::IntersectRay() does
+    const Bounds3f bounds{{0, 0, 0}, {1, 1, 1}};
+    const i32 axis = GENERATE(0, 1, 2);
+    const real face = GENERATE(0.0f, 1.0f);
+    CAPTURE(axis, face);
+
+    Ray rays[MaxRayPacketSize];
+    for (i32 i = 0; i < MaxRayPacketSize; i++)
+    {
+        // Rays travel along one of the other two axes in either direction, starting inside or outside the box
+        const i32 directionAxis = (axis + 1 + i % 2) % 3;
+        Vector3f o{0.5, 0.5, 0.5};
+        o[axis] = face;
+        o[directionAxis] = (i / 2) % 2 ? -1 : 0.25f;
+        Vector3f d{0, 0, 0};
+        d[directionAxis] = (i / 4) % 2 ? -1 : 1;
+        rays[i] = Ray(o, d);
+    }
+
+    BVHRayPacket packet(rays, MaxRayPacketSize);
+    u32 expectedMask = 0;
+    for (i32 i = 0; i < MaxRayPacketSize; i++)
+        if (bounds.IntersectRay(rays[i], nullptr, nullptr))
+            expectedMask |= 1u << i;
+
+    CHECK(expectedMask != 0);
+    CHECK(IntersectPacketBounds(bounds, packet, (u32)-1 >> (32 - MaxRayPacketSize)) == expectedMask);
+}
+
+TEST_CASE("Ray packets with the default implementation", "[accelerators][bvh]")
+{
+    auto primitive = CreatePrimitive(Bounds3f{{0, 0, 0}, {1, 1, 1}});
+    Ray rays[3] = {Ray({0.5, 0.5, -1}, {0, 0, 1}), Ray({2, 0.5, -1}, {0, 0, 1}), Ray({0.5, 0.25, -1}, {0, 0, 1})};
+    MaterialInteraction<RGBSpectrum> materialInteractions[3];
+
+    CHECK(primitive->IntersectPacket(rays, 3) == 0b101);
+    CHECK(primitive->IntersectPacket(rays, 3, materialInteractions) == 0b101);
+    CHECK(Vector3fAreEqual(Vector3f{0.5, 0.25, 0}, materialInteractions[2].m_Point));
+}
+
+TEST_CASE("Ray streams", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(300, 40, 0, 4, 5));
+
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    CAPTURE(maxPrimsInNode);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, SplitMethod::SAH);
+
+    // Streams are checked against single rays through the same tree. Some origins lie outside the scene bounds
+    CHECK(MatchesReference(bvh, bvh, AroundRandomBoxes(40)));
+}
+
+TEST_CASE("Ray stream sorting", "[accelerators][bvh]")
+{
+    Bounds3f bounds{{0, 0, 0}, {1, 1, 1}};
+    std::vector<Ray> rays = {Ray({0.9, 0.9, 0.9}, {1, 1, 1}), Ray({0.1, 0.1, 0.1}, {-1, 1, 1}),
+                             Ray({0.1, 0.1, 0.1}, {1, 1, 1}), Ray({5, 5, 5}, {1, -1, -1})};
+    std::array<i32, 9> octantOffsets;
+    std::vector<i32> order = SortRayStream(rays.data(), rays.size(), bounds, &octantOffsets);
+
+    CHECK(order == std::vector<i32>{2, 0, 1, 3});
+    CHECK(octantOffsets == std::array<i32, 9>{0, 2, 3, 3, 3, 3, 3, 4, 4});
+}
+
+TEST_CASE("Refit", "[accelerators][bvh]")
+{
+    std::vector<Ref<TestGeometry>> geometries;
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+        {
+            Vector3f lowerBound = Vector3f(2 * i, 2 * j, 0);
+            geometries.push_back(CreateRef<TestGeometry>(Bounds3f{lowerBound, lowerBound + Vector3f{1, 1, 1}}));
+            primitives.push_back(CreateRef<GeometricPrimitive<RGBSpectrum>>(geometries.back()));
+        }
+
+    BVHBuildParameters parameters;
+    parameters.m_Layout =
+        GENERATE(BVHLayout::Binary, BVHLayout::Wide4, BVHLayout::Wide8, BVHLayout::Compressed, BVHLayout::Clustered);
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    CAPTURE(BVHLayoutNames[(i32)parameters.m_Layout], maxPrimsInNode);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+
+    auto allHit = [&](const Vector3f& offset) {
+        bool hit = true;
+        MaterialInteraction<RGBSpectrum> materialInteraction;
+        for (int i = 0; i < 8; i++)
+            for (int j = 0; j < 8; j++)
+            {
+                Ray ray(Vector3f(2 * i + 0.5f, 2 * j + 0.5f, -1) + offset, {0, 0, 1});
+                if (!bvh.IntersectRay(ray, &materialInteraction) ||
+                    !Vector3fAreEqual(Vector3f(2 * i + 0.5f, 2 * j + 0.5f, 0) + offset, materialInteraction.m_Point))
+                    hit = false;
+            }
+        return hit;
+    };
+
+    SECTION("Translated primitives")
+    {
+        const Vector3f offset{100, 0, 50};
+        for (auto& geometry : geometries)
+        {
+            Bounds3f bounds = geometry->WorldBound();
+            geometry->SetBounds({bounds.m_MinBound + offset, bounds.m_MaxBound + offset});
+        }
+
+        CHECK(!allHit({0, 0, 0}));
+        CHECK(bvh.Refit() == Catch::Approx(1));
+        CHECK(Bounds3fAreEqual(Bounds3f({100, 0, 50}, {115, 15, 51}), bvh.WorldBound()));
+        CHECK(allHit(offset));
+    }
+
+    SECTION("Scattered primitives")
+    {
+        // Swapping the far corners of the grid makes the bounds of every subtree that contains them span the whole grid
+        Bounds3f first = geometries.front()->WorldBound();
+        geometries.front()->SetBounds(geometries.back()->WorldBound());
+        geometries.back()->SetBounds(first);
+
+        CHECK(bvh.Refit() > 1);
+        CHECK(allHit({0, 0, 0}));
+    }
+}
+
+TEST_CASE("Statistics", "[accelerators][bvh]")
+{
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives;
+    for (int i = 0; i < 10; i++)
+        for (int j = 0; j < 10; j++)
+        {
+            Vector3f lowerBound = Vector3f(i, j, 0);
+            primitives.push_back(CreatePrimitive(Bounds3f{lowerBound, lowerBound + Vector3f{0.5, 0.5, 0.5}}));
+        }
+
+    BVHBuildParameters parameters;
+    parameters.m_Layout = GENERATE(BVHLayout::Binary, BVHLayout::Wide4, BVHLayout::Compressed);
+    i32 maxPrimsInNode = GENERATE(1, 4);
+    BVHAccelerator bvh(primitives, maxPrimsInNode, SplitMethod::SAH, parameters);
+    BVHStatistics statistics = bvh.Statistics();
+
+    CHECK(statistics.m_Layout == parameters.m_Layout);
+    CHECK(statistics.m_NumReferences == 100);
+    CHECK(statistics.m_NumNodes == 2 * statistics.m_NumLeaves - 1);
+    CHECK(statistics.m_Depth >= 8); // At least log2(100 / maxPrimsInNode) levels below the root
+    CHECK(statistics.m_SAHCost == Catch::Approx(bvh.SAHCost()));
+    CHECK(statistics.m_NodeBytes == bvh.NodeMemoryUsage());
+    CHECK(statistics.m_TotalBytes > statistics.m_NodeBytes);
+
+    i32 numLeaves = 0, numReferences = 0;
+    for (u64 i = 0; i < statistics.m_LeafSizeHistogram.size(); i++)
+    {
+        numLeaves += statistics.m_LeafSizeHistogram[i];
+        numReferences += (i32)i * statistics.m_LeafSizeHistogram[i];
+    }
+    CHECK(statistics.m_LeafSizeHistogram[0] == 0);
+    CHECK((i32)statistics.m_LeafSizeHistogram.size() <= maxPrimsInNode + 1);
+    CHECK(numLeaves == statistics.m_NumLeaves);
+    CHECK(numReferences == statistics.m_NumReferences);
+
+    std::string json = bvh.ReportStatistics();
+    CHECK(json.front() == '{');
+    CHECK(json.back() == '}');
+    CHECK(json.find("\"nodes\": " + std::to_string(statistics.m_NumNodes)) != std::string::npos);
+    CHECK(json.find("\"binaryNodeBytes\": " + std::to_string(statistics.m_BinaryNodeBytes)) != std::string::npos);
+    CHECK(json.find(std::string("\"layout\": \"") + BVHLayoutNames[(i32)parameters.m_Layout] + "\"") != std::string::npos);
+
+#if defined(YART_TRAVERSAL_STATISTICS)
+    ResetTraversalCounters();
+    Ray ray({0.25, 0.25, -1}, {0, 0, 1});
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    CHECK(bvh.IntersectRay(ray, &materialInteraction));
+
+    TraversalCounters counters = GatherTraversalCounters();
+    CHECK(counters.m_RayQueries == 1);
+    CHECK(counters.m_NodesVisited > 1);
+    CHECK(counters.m_BoxesTested >= counters.m_NodesVisited);
+    CHECK(counters.m_PrimitivesTested >= 1);
+
+    ResetTraversalCounters();
+    CHECK(GatherTraversalCounters().m_NodesVisited == 0);
+#endif
+}
+
+TEST_CASE("Instanced BVHs", "[accelerators][bvh]")
+{
+    // A 4x4 grid of unit boxes shared by every instance
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> assetPrimitives;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+        {
+            Vector3f lowerBound = Vector3f(2 * i, 2 * j, 0);
+            assetPrimitives.push_back(CreatePrimitive(Bounds3f{lowerBound, lowerBound + Vector3f{1, 1, 1}}));
+        }
+    Ref<AbstractPrimitive<RGBSpectrum>> asset = CreateRef<BVHAccelerator<RGBSpectrum>>(assetPrimitives, 1, SplitMethod::SAH);
+
+    // Instances are translated along x and every other one is scaled by 2
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> instances;
+    for (int i = 0; i < 10; i++)
+    {
+        Transform primitiveToWorld = Translate(Vector3f(100 * i, 0, 0)) * Scale(Vector3f(1, 1, 1) * (real)(1 + (i % 2)));
+        instances.push_back(CreateRef<TransformPrimitive<RGBSpectrum>>(asset, primitiveToWorld));
+    }
+
+    CHECK(Bounds3fAreEqual(Bounds3f({100, 0, 0}, {114, 14, 2}), instances[1]->WorldBound()));
+
+    BVHAccelerator topLevel(instances, 1, SplitMethod::SAH);
+    CHECK(Bounds3fAreEqual(Bounds3f({0, 0, 0}, {914, 14, 2}), topLevel.WorldBound()));
+
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    bool allHit = true;
+    bool allHitP = true;
+    bool allIntersectionsCorrect = true;
+    for (int instance = 0; instance < 10; instance++)
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+            {
+                real scale = 1 + (instance % 2);
+                Vector3f intersection = Vector3f(100 * instance, 0, 0) + Vector3f(2 * i + 0.5f, 2 * j + 0.5f, 0) * scale;
+                Ray ray(intersection - Vector3f{0, 0, 10}, {0, 0, 1});
+
+                if (!topLevel.IntersectRay(ray, &materialInteraction))
+                    allHit = false;
+                else if (!Vector3fAreEqual(intersection, materialInteraction.m_Point) || ray.m_Tmax != Catch::Approx(10))
+                    allIntersectionsCorrect = false;
+
+                ray.m_Tmax = Infinity;
+                if (!topLevel.IntersectRay(ray))
+                    allHitP = false;
+            }
+
+    CHECK(allHit);
+    CHECK(allHitP);
+    CHECK(allIntersectionsCorrect);
+
+    Ray betweenInstances({50, 1, -10}, {0, 0, 1});
+    CHECK(!topLevel.IntersectRay(betweenInstances, &materialInteraction));
+    CHECK(!topLevel.IntersectRay(betweenInstances));
+}
+
+TEST_CASE("BVH cache", "[accelerators][bvh]")
+{
+    const std::filesystem::path cacheDirectory = std::filesystem::temp_directory_path() / "yart-bvh-cache-test";
+    std::filesystem::remove_all(cacheDirectory);
+
+    std::vector<Ref<AbstractPrimitive<RGBSpectrum>>> primitives = CreatePrimitives(RandomBoxes(200, 40, 1, 1, 11));
+
+    BVHBuildParameters parameters;
+    parameters.m_CacheDirectory = cacheDirectory.string();
+    parameters.m_Layout = GENERATE(BVHLayout::Binary, BVHLayout::Compressed);
+    SplitMethod splitMethod = GENERATE(SplitMethod::SAH, SplitMethod::HLBVH);
+    CAPTURE(BVHLayoutNames[(i32)parameters.m_Layout], SplitMethodNames[(i32)splitMethod]);
+
+    BVHAccelerator built(primitives, 4, splitMethod, parameters);
+    BVHAccelerator cached(primitives, 4, splitMethod, parameters);
+    CHECK(!built.LoadedFromCache());
+    CHECK(cached.LoadedFromCache());
+    CHECK(built.SAHCost() == cached.SAHCost());
+    CHECK(Bounds3fAreEqual(built.WorldBound(), cached.WorldBound()));
+
+    CHECK(MatchesReference(cached, built, Bounds3f{{0, 0, 0}, {40, 40, 40}}));
+
+    // Refitting a mapped tree must not modify the cache file
+    CHECK(cached.Refit() == Catch::Approx(1));
+    CHECK(BVHAccelerator(primitives, 4, splitMethod, parameters).LoadedFromCache());
+
+    SECTION("Different build settings miss the cache")
+    {
+        CHECK(!BVHAccelerator(primitives, 2, splitMethod, parameters).LoadedFromCache());
+    }
+
+    SECTION("Different primitives miss the cache")
+    {
+        primitives.pop_back();
+        CHECK(!BVHAccelerator(primitives, 4, splitMethod, parameters).LoadedFromCache());
+    }
+
+    SECTION("Truncated cache files are rebuilt")
+    {
+        std::vector<BVHPrimitiveInfo> primitiveInfo;
+        for (u64 i = 0; i < primitives.size(); i++)
+            primitiveInfo.push_back({i, primitives[i]->WorldBound()});
+        std::string path = BVHCachePath(parameters.m_CacheDirectory, BVHCacheKey(primitiveInfo, 4, splitMethod, parameters));
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+
+        CHECK(!BVHAccelerator(primitives, 4, splitMethod, parameters).LoadedFromCache());
+        CHECK(BVHAccelerator(primitives, 4, splitMethod, parameters).LoadedFromCache());
+    }
+
+    SECTION("Cache files with out of range offsets are rebuilt")
+    {
+        std::vector<BVHPrimitiveInfo> primitiveInfo;
+        for (u64 i = 0; i < primitives.size(); i++)
+            primitiveInfo.push_back({i, primitives[i]->WorldBound()});
+        std::string path = BVHCachePath(parameters.m_CacheDirectory, BVHCacheKey(primitiveInfo, 4, splitMethod, parameters));
+
+        // Corrupt the root, which is an interior node, or the last node, which is always a leaf
+        const bool corruptLeaf = GENERATE(false, true);
+        BVHLinearNode node;
+        u64 nodeFileOffset;
+        {
+            BVHLinearNode* nodes;
+            i32 numNodes, numReferences;
+            const u32* primitiveOrder;
+            Scope<MappedFile> file = LoadBVHCache(path, BVHCacheKey(primitiveInfo, 4, splitMethod, parameters),
+                                                  primitives.size(), &nodes, &numNodes, &primitiveOrder, &numReferences);
+            REQUIRE(file);
+
+            const i32 nodeIndex = corruptLeaf ? numNodes - 1 : 0;
+            nodeFileOffset = (const u8*)&nodes[nodeIndex] - file->Data();
+            node = nodes[nodeIndex];
+            if (corruptLeaf)
+                node.m_FirstPrimOffset = numReferences - node.m_NumPrimitives + 1;
+            else
+                node.m_SecondChildOffset = numNodes;
+        }
+
+        {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(nodeFileOffset);
+            file.write((const char*)&node, sizeof(BVHLinearNode));
+        }
+
+        CHECK(!BVHAccelerator(primitives, 4, splitMethod, parameters).LoadedFromCache());
+        CHECK(BVHAccelerator(primitives, 4, splitMethod, parameters).LoadedFromCache());
+    }
+
+    std::filesystem::remove_all(cacheDirectory);
+}
+
+TEST_CASE("Morton codes", "[accelerators][bvh]")
+{
+    CHECK(EncodeMorton3(Vector3f{0, 0, 0}) == 0);
+    CHECK(EncodeMorton3(Vector3f{1, 0, 0}) == 0b001);
+    CHECK(EncodeMorton3(Vector3f{0, 1, 0}) == 0b010);
+    CHECK(EncodeMorton3(Vector3f{0, 0, 1}) == 0b100);
+    CHECK(EncodeMorton3(Vector3f{3, 0, 5}) == 0b100001101);
+    CHECK(EncodeMorton3(Vector3f{1023, 1023, 1023}) == (1u << 30) - 1);
+
+    // Points on the upper boundary are clamped into the grid
+    CHECK(EncodeMorton3(Vector3f{1024, 1024, 1024}) == (1u << 30) - 1);
+}
+
+TEST_CASE("Radix sort", "[accelerators][bvh]")
+{
+    PCG32Random rng;
+    size_t size = GENERATE(0, 1, 1000, 100000);
+
+    std::vector<MortonPrimitive> mortonPrimitives(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        // Restrict the range of codes so that the input contains many duplicates
+        mortonPrimitives[i].m_PrimitiveIndex = i;
+        mortonPrimitives[i].m_MortonCode = rng.UniformUInt32(1 << 12) << 18;
+    }
+
+    std::vector<MortonPrimitive> expected = mortonPrimitives;
+    std::stable_sort(expected.begin(), expected.end(), [](const MortonPrimitive& a, const MortonPrimitive& b) {
+        return a.m_MortonCode < b.m_MortonCode;
+    });
+
+    RadixSort(&mortonPrimitives);
+
+    bool isStableSorted = true;
+    for (size_t i = 0; i < size; i++)
+        if (mortonPrimitives[i].m_MortonCode != expected[i].m_MortonCode ||
+            mortonPrimitives[i].m_PrimitiveIndex != expected[i].m_PrimitiveIndex)
+            isStableSorted = false;
+
+    CHECK(mortonPrimitives.size() == size);
+    CHECK(isStableSorted);
+}
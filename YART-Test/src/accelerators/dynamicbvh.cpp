@@ -0,0 +1,118 @@
+#include "testutil.h"
+#include <catch_amalgamated.hpp>
+#include <yart.h>
+
+using namespace yart;
+
+using Primitive = AbstractPrimitive<RGBSpectrum>;
+
+TEST_CASE("Dynamic BVH insertion", "[accelerators][dynamicbvh]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    for (const Vector3f& center : RandomPoints(1000, 100, 1))
+        primitives.push_back(factory.Create(center, 1));
+
+    DynamicBVHAccelerator<RGBSpectrum> bvh(primitives);
+    CHECK(bvh.NumPrimitives() == 1000);
+
+    Bounds3f expectedBounds;
+    for (const Ref<Primitive>& primitive : primitives)
+        expectedBounds = Union(expectedBounds, primitive->WorldBound());
+    CHECK(Bounds3fAreEqual(expectedBounds, bvh.WorldBound()));
+    CHECK(MatchesBruteForce(bvh, primitives, 100));
+
+    // Incremental insertion gives up some quality compared to a full SAH build, but not much
+    BVHAccelerator<RGBSpectrum> staticBVH(primitives, 1, SplitMethod::SAH);
+    CHECK(bvh.SAHCost() < 1.3f * staticBVH.SAHCost());
+}
+
+TEST_CASE("Dynamic BVH removal", "[accelerators][dynamicbvh]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    std::vector<i32> handles;
+    DynamicBVHAccelerator<RGBSpectrum> bvh;
+    for (const Vector3f& center : RandomPoints(500, 50, 2))
+    {
+        primitives.push_back(factory.Create(center, 1));
+        handles.push_back(bvh.Insert(primitives.back()));
+    }
+
+    for (u64 i = 0; i < primitives.size(); i += 2)
+    {
+        bvh.Remove(handles[i]);
+        primitives[i] = nullptr;
+    }
+    CHECK(bvh.NumPrimitives() == 250);
+    CHECK(MatchesBruteForce(bvh, primitives, 50));
+
+    // Nodes freed by the removals are reused
+    for (const Vector3f& center : RandomPoints(100, 50, 3))
+    {
+        primitives.push_back(factory.Create(center, 1));
+        bvh.Insert(primitives.back());
+    }
+    CHECK(bvh.NumPrimitives() == 350);
+    CHECK(MatchesBruteForce(bvh, primitives, 50));
+
+    for (u64 i = 1; i < handles.size(); i += 2)
+        bvh.Remove(handles[i]);
+    CHECK(bvh.NumPrimitives() == 100);
+
+    DynamicBVHAccelerator<RGBSpectrum> emptyBVH;
+    i32 handle = emptyBVH.Insert(primitives.back());
+    emptyBVH.Remove(handle);
+    CHECK(emptyBVH.NumPrimitives() == 0);
+    CHECK(!emptyBVH.IntersectRay(Ray({0, 0, -1}, {0, 0, 1})));
+}
+
+TEST_CASE("Dynamic BVH updates", "[accelerators][dynamicbvh]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    std::vector<i32> handles;
+    DynamicBVHAccelerator<RGBSpectrum> bvh;
+    std::vector<Vector3f> centers = RandomPoints(300, 50, 4);
+    for (const Vector3f& center : centers)
+    {
+        primitives.push_back(factory.Create(center, 1));
+        handles.push_back(bvh.Insert(primitives.back()));
+    }
+
+    std::vector<Vector3f> newCenters = RandomPoints(100, 50, 5);
+    for (i32 i = 0; i < 100; i++)
+    {
+        factory.Move(i, newCenters[i]);
+        bvh.Update(handles[i]);
+    }
+    CHECK(bvh.NumPrimitives() == 300);
+    CHECK(MatchesBruteForce(bvh, primitives, 50));
+
+    Ray ray({newCenters[0].x, newCenters[0].y, -100}, {0, 0, 1});
+    CHECK(bvh.IntersectRay(ray));
+}
+
+TEST_CASE("Dynamic BVH with sorted insertions", "[accelerators][dynamicbvh]")
+{
+    // Inserting along a line always extends the tree on the same side, which the rotations have to keep from degenerating
+    // into a list
+    SphereFactory factory;
+    DynamicBVHAccelerator<RGBSpectrum> bvh;
+    std::vector<Ref<Primitive>> primitives;
+    for (i32 i = 0; i < 1000; i++)
+    {
+        primitives.push_back(factory.Create(Vector3f(3 * i, 0, 0), 1));
+        bvh.Insert(primitives.back());
+    }
+
+    std::string statistics = bvh.ReportStatistics();
+    i32 depthBegin = (i32)statistics.find("\"depth\": ") + 9;
+    i32 depth = std::stoi(statistics.substr(depthBegin));
+    CHECK(depth < 40);
+
+    Ray ray({1500, 0.5, -10}, {0, 0, 1});
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    CHECK(bvh.IntersectRay(ray, &materialInteraction));
+    CHECK(Vector3fAreEqual(Vector3f{1500, 0.5, -std::sqrt(0.75f)}, materialInteraction.m_Point));
+}
@@ -0,0 +1,101 @@
+#include "testutil.h"
+#include <catch_amalgamated.hpp>
+#include <yart.h>
+
+using namespace yart;
+
+using Primitive = AbstractPrimitive<RGBSpectrum>;
+
+TEST_CASE("Grid matches brute force", "[accelerators][grid]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    real radius = GENERATE(0.5f, 3.0f); // Large spheres overlap many cells
+    for (const Vector3f& center : RandomPoints(1000, 50, 1))
+        primitives.push_back(factory.Create(center, radius));
+
+    GridBuildParameters parameters;
+    parameters.m_TwoLevel = GENERATE(false, true);
+    CAPTURE(radius, parameters.m_TwoLevel);
+    GridAccelerator<RGBSpectrum> grid(primitives, parameters);
+
+    Bounds3f expectedBounds;
+    for (const Ref<Primitive>& primitive : primitives)
+        expectedBounds = Union(expectedBounds, primitive->WorldBound());
+    CHECK(Bounds3fAreEqual(expectedBounds, grid.WorldBound()));
+    CHECK(grid.NumCells() > 1);
+    CHECK(MatchesBruteForce(grid, primitives, 50));
+}
+
+TEST_CASE("Grid matches the BVH", "[accelerators][grid]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    for (const Vector3f& center : RandomPoints(2000, 30, 2))
+        primitives.push_back(factory.Create(center, 0.4f));
+
+    GridBuildParameters parameters;
+    parameters.m_TwoLevel = GENERATE(false, true);
+    CAPTURE(parameters.m_TwoLevel);
+    GridAccelerator<RGBSpectrum> grid(primitives, parameters);
+    BVHAccelerator<RGBSpectrum> bvh(primitives, 1, SplitMethod::SAH);
+
+    // Rays starting inside and outside of the scene
+    CHECK(MatchesReference(grid, bvh, Bounds3f{{-15, -15, -15}, {45, 45, 45}}));
+}
+
+TEST_CASE("Two level grid over clusters", "[accelerators][grid]")
+{
+    // A dense cluster inside a sparse scene, which a single level grid would pile into a handful of cells
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    for (const Vector3f& center : RandomPoints(200, 100, 4))
+        primitives.push_back(factory.Create(center, 0.5f));
+    for (const Vector3f& center : RandomPoints(2000, 5, 5))
+        primitives.push_back(factory.Create(center + Vector3f{40, 40, 40}, 0.1f));
+
+    GridBuildParameters parameters;
+    parameters.m_TwoLevel = true;
+    GridAccelerator<RGBSpectrum> grid(primitives, parameters);
+    CHECK(grid.NumGrids() > 1);
+    CHECK(MatchesBruteForce(grid, primitives, 100));
+
+    // Without nested grids there is only the top level
+    parameters.m_TwoLevel = false;
+    GridAccelerator<RGBSpectrum> singleLevel(primitives, parameters);
+    CHECK(singleLevel.NumGrids() == 1);
+    CHECK(MatchesBruteForce(singleLevel, primitives, 100));
+}
+
+TEST_CASE("Grid resolution", "[accelerators][grid]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+
+    // Spheres along a line give a grid one cell wide across the line
+    for (i32 i = 0; i < 100; i++)
+        primitives.push_back(factory.Create(Vector3f(3 * i, 0, 0), 1));
+
+    GridBuildParameters parameters;
+    parameters.m_MaxResolution = 64;
+    GridAccelerator<RGBSpectrum> grid(primitives, parameters);
+    CHECK(grid.NumCells() <= 64);
+    CHECK(grid.NumCells() > 1);
+
+    Ray ray({150, 0.5, -10}, {0, 0, 1});
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    CHECK(grid.IntersectRay(ray, &materialInteraction));
+    CHECK(Vector3fAreEqual(Vector3f{150, 0.5, -std::sqrt(0.75f)}, materialInteraction.m_Point));
+    CHECK(grid.IntersectRay(Ray({-10, 0.5, 0}, {1, 0, 0})));
+    CHECK(!grid.IntersectRay(Ray({-10, 5, 0}, {1, 0, 0})));
+}
+
+TEST_CASE("Grid without primitives", "[accelerators][grid]")
+{
+    GridAccelerator<RGBSpectrum> grid({});
+    Ray ray({0, 0, -1}, {0, 0, 1});
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    CHECK(!grid.IntersectRay(ray, &materialInteraction));
+    CHECK(!grid.IntersectRay(ray));
+    CHECK(grid.NumCells() == 0);
+}
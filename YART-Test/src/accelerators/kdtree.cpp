@@ -0,0 +1,72 @@
+#include "testutil.h"
+#include <catch_amalgamated.hpp>
+#include <yart.h>
+
+using namespace yart;
+
+using Primitive = AbstractPrimitive<RGBSpectrum>;
+
+TEST_CASE("Kd-tree matches brute force", "[accelerators][kdtree]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    real radius = GENERATE(0.5f, 3.0f); // Large spheres straddle many split planes
+    for (const Vector3f& center : RandomPoints(1000, 50, 1))
+        primitives.push_back(factory.Create(center, radius));
+
+    KdTreeBuildParameters parameters;
+    parameters.m_MaxPrimsInNode = GENERATE(1, 4);
+    CAPTURE(radius, parameters.m_MaxPrimsInNode);
+    KdTreeAccelerator<RGBSpectrum> kdTree(primitives, parameters);
+
+    Bounds3f expectedBounds;
+    for (const Ref<Primitive>& primitive : primitives)
+        expectedBounds = Union(expectedBounds, primitive->WorldBound());
+    CHECK(Bounds3fAreEqual(expectedBounds, kdTree.WorldBound()));
+    CHECK(kdTree.NumNodes() > 1);
+    CHECK(MatchesBruteForce(kdTree, primitives, 50));
+}
+
+TEST_CASE("Kd-tree matches the BVH", "[accelerators][kdtree]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    for (const Vector3f& center : RandomPoints(2000, 30, 2))
+        primitives.push_back(factory.Create(center, 0.4f));
+
+    KdTreeAccelerator<RGBSpectrum> kdTree(primitives);
+    BVHAccelerator<RGBSpectrum> bvh(primitives, 1, SplitMethod::SAH);
+
+    // Rays starting inside the scene
+    CHECK(MatchesReference(kdTree, bvh, Bounds3f{{0, 0, 0}, {30, 30, 30}}));
+}
+
+TEST_CASE("Kd-tree depth limit", "[accelerators][kdtree]")
+{
+    SphereFactory factory;
+    std::vector<Ref<Primitive>> primitives;
+    for (const Vector3f& center : RandomPoints(500, 20, 4))
+        primitives.push_back(factory.Create(center, 0.5f));
+
+    // Without any levels there is only the root leaf, which holds every primitive
+    KdTreeBuildParameters parameters;
+    parameters.m_MaxDepth = 0;
+    KdTreeAccelerator<RGBSpectrum> rootOnly(primitives, parameters);
+    CHECK(rootOnly.NumNodes() == 1);
+    CHECK(MatchesBruteForce(rootOnly, primitives, 20));
+
+    parameters.m_MaxDepth = 3;
+    KdTreeAccelerator<RGBSpectrum> shallow(primitives, parameters);
+    CHECK(shallow.NumNodes() <= 15);
+    CHECK(MatchesBruteForce(shallow, primitives, 20));
+}
+
+TEST_CASE("Kd-tree without primitives", "[accelerators][kdtree]")
+{
+    KdTreeAccelerator<RGBSpectrum> kdTree({});
+    Ray ray({0, 0, -1}, {0, 0, 1});
+    MaterialInteraction<RGBSpectrum> materialInteraction;
+    CHECK(!kdTree.IntersectRay(ray, &materialInteraction));
+    CHECK(!kdTree.IntersectRay(ray));
+    CHECK(kdTree.NumNodes() == 0);
+}
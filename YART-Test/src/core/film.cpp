@@ -0,0 +1,155 @@
+#include "testutil.h"
+#include <catch_amalgamated.hpp>
+#include <yart.h>
+
+using namespace yart;
+using Catch::Approx;
+
+namespace
+{
+    struct FilmSample
+    {
+        Vector2f m_FilmPoint;
+        RGBSpectrum m_L;
+    };
+
+    std::vector<FilmSample> RandomFilmSamples(const Bounds2i& sampleBounds, i32 samplesPerPixel, u64 seed)
+    {
+        PCG32Random rng(seed);
+        std::vector<FilmSample> samples;
+        for (Vector2i pixel : sampleBounds)
+        {
+            for (i32 i = 0; i < samplesPerPixel; i++)
+            {
+                Vector2f filmPoint = Vector2f(pixel) + Vector2f{rng.UniformFloat(), rng.UniformFloat()};
+                RGBSpectrum L = RGBSpectrum::FromRGB({rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()});
+                samples.push_back({filmPoint, L});
+            }
+        }
+        return samples;
+    }
+
+    bool FilmsAreEqual(const Film& film1, const Film& film2)
+    {
+        for (Vector2i pixel : film1.m_CroppedPixelBounds)
+        {
+            std::array<real, 3> rgb1 = film1.GetPixelRGB(pixel);
+            std::array<real, 3> rgb2 = film2.GetPixelRGB(pixel);
+            for (i32 i = 0; i < 3; i++)
+                if (rgb1[i] != Approx(rgb2[i]).margin(1e-5))
+                    return false;
+        }
+        return true;
+    }
+}
+
+TEST_CASE("Merged film tiles match a single tile", "[film]")
+{
+    const Vector2i resolution{29, 19};
+    const Bounds2f cropWindow = GENERATE(Bounds2f{{0, 0}, {1, 1}}, Bounds2f{{0.2, 0.3}, {0.7, 0.9}});
+    const real radius = GENERATE(0.5f, 1.5f);
+    CAPTURE(cropWindow.m_MinBound.x, radius);
+
+    Film singleTileFilm(resolution, cropWindow, CreateScope<TriangleFilter>(Vector2f{radius, radius}), 0.1, "", 1);
+    Film tiledFilm(resolution, cropWindow, CreateScope<TriangleFilter>(Vector2f{radius, radius}), 0.1, "", 1);
+
+    const Bounds2i sampleBounds = singleTileFilm.GetSampleBounds();
+    std::vector<FilmSample> samples = RandomFilmSamples(sampleBounds, 4, 1);
+
+    Scope<FilmTile> singleTile = singleTileFilm.GetFilmTile(sampleBounds);
+    CHECK(singleTile->GetPixelBounds().m_MinBound == singleTileFilm.m_CroppedPixelBounds.m_MinBound);
+    CHECK(singleTile->GetPixelBounds().m_MaxBound == singleTileFilm.m_CroppedPixelBounds.m_MaxBound);
+    for (const FilmSample& sample : samples)
+        singleTile->AddSample(sample.m_FilmPoint, sample.m_L);
+    singleTileFilm.MergeFilmTile(std::move(singleTile));
+
+    // Tiles of 4x4 sample pixels overlap their neighbours by the filter radius and are merged concurrently
+    const i32 tileSize = 4;
+    const Vector2i sampleExtent = sampleBounds.Diagonal();
+    const Vector2i numTiles{(sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize};
+    // clang-format off
+    ParallelFor2D([&](Vector2i tile) {
+        Vector2i tileMin = sampleBounds.m_MinBound + tile * tileSize;
+        Bounds2i tileBounds = Intersect(Bounds2i{tileMin, tileMin + Vector2i{tileSize, tileSize}}, sampleBounds);
+        Scope<FilmTile> filmTile = tiledFilm.GetFilmTile(tileBounds);
+        for (const FilmSample& sample : samples)
+            if (InsideExclusive(Vector2i(Floor(sample.m_FilmPoint)), tileBounds))
+                filmTile->AddSample(sample.m_FilmPoint, sample.m_L);
+        tiledFilm.MergeFilmTile(std::move(filmTile));
+    }, numTiles);
+    // clang-format on
+
+    CHECK(FilmsAreEqual(singleTileFilm, tiledFilm));
+}
+
+TEST_CASE("Film pixel color", "[film]")
+{
+    Film film({8, 8}, Bounds2f{{0.5, 0.5}, {1, 1}}, CreateScope<BoxFilter>(Vector2f{0.5, 0.5}), 0.1, "", 1);
+    CHECK(film.m_CroppedPixelBounds.m_MinBound == Vector2i{4, 4});
+
+    // With a box filter only the pixel a sample falls in receives it, even when the tile is larger
+    Scope<FilmTile> filmTile = film.GetFilmTile(film.GetSampleBounds());
+    filmTile->AddSample(Vector2f{5.25, 6.75}, RGBSpectrum::FromRGB({0.25, 0.5, 1}));
+    filmTile->AddSample(Vector2f{5.75, 6.25}, RGBSpectrum::FromRGB({0.75, 0.5, 0}));
+    film.MergeFilmTile(std::move(filmTile));
+
+    std::array<real, 3> rgb = film.GetPixelRGB({5, 6});
+    CHECK(rgb[0] == Approx(0.5).margin(1e-4));
+    CHECK(rgb[1] == Approx(0.5).margin(1e-4));
+    CHECK(rgb[2] == Approx(0.5).margin(1e-4));
+
+    std::array<real, 3> black = film.GetPixelRGB({4, 4});
+    CHECK(black[0] == 0);
+    CHECK(black[1] == 0);
+    CHECK(black[2] == 0);
+}
+
+TEST_CASE("Film pixel luminance", "[film]")
+{
+    Film film({8, 8}, Bounds2f{{0, 0}, {1, 1}}, CreateScope<TriangleFilter>(Vector2f{2, 2}), 0.1, "", 1);
+
+    // Luminance is only tracked in the pixel a sample is taken in, however far the filter reaches, also across tiles
+    Bounds2i firstTileBounds{{0, 0}, {4, 8}};
+    Bounds2i secondTileBounds{{4, 0}, {8, 8}};
+    Scope<FilmTile> firstTile = film.GetFilmTile(firstTileBounds);
+    Scope<FilmTile> secondTile = film.GetFilmTile(secondTileBounds);
+    firstTile->AddSample(Vector2f{3.5, 3.5}, RGBSpectrum::FromRGB({1, 1, 1}));
+    firstTile->AddSample(Vector2f{3.2, 3.7}, RGBSpectrum::FromRGB({3, 3, 3}));
+    secondTile->AddSample(Vector2f{4.5, 3.5}, RGBSpectrum::FromRGB({1, 1, 1}));
+    film.MergeFilmTile(std::move(firstTile));
+    film.MergeFilmTile(std::move(secondTile));
+
+    VarianceEstimator luminance = film.GetPixelLuminance({3, 3});
+    CHECK(luminance.Count() == 2);
+    CHECK(luminance.Mean() == Approx(2).margin(1e-4));
+    CHECK(luminance.Variance() == Approx(2).margin(1e-3));
+    CHECK(film.GetPixelLuminance({4, 3}).Count() == 1);
+    CHECK(film.GetPixelLuminance({2, 3}).Count() == 0);
+}
+
+TEST_CASE("Film pixel luminances", "[film]")
+{
+    Film film({8, 8}, Bounds2f{{0.5, 0.25}, {1, 1}}, CreateScope<BoxFilter>(Vector2f{0.5, 0.5}), 0.1, "", 1);
+    Scope<FilmTile> filmTile = film.GetFilmTile(film.GetSampleBounds());
+    filmTile->AddSample(Vector2f{5.5, 3.5}, RGBSpectrum::FromRGB({1, 1, 1}));
+    filmTile->AddSample(Vector2f{7.5, 7.5}, RGBSpectrum::FromRGB({1, 1, 1}));
+    filmTile->AddSample(Vector2f{7.25, 7.75}, RGBSpectrum::FromRGB({3, 3, 3}));
+    film.MergeFilmTile(std::move(filmTile));
+
+    // The copy is laid out in rows of the cropped film and matches the luminance of every pixel
+    std::vector<VarianceEstimator> luminances = film.GetPixelLuminances();
+    REQUIRE(luminances.size() == (size_t)film.m_CroppedPixelBounds.Area());
+    const Vector2i extent = film.m_CroppedPixelBounds.Diagonal();
+    bool allMatch = true;
+    for (Vector2i pixel : film.m_CroppedPixelBounds)
+    {
+        Vector2i offset = pixel - film.m_CroppedPixelBounds.m_MinBound;
+        const VarianceEstimator& luminance = luminances[offset.y * extent.x + offset.x];
+        VarianceEstimator expected = film.GetPixelLuminance(pixel);
+        if (luminance.Count() != expected.Count() || luminance.Mean() != expected.Mean())
+            allMatch = false;
+    }
+    CHECK(allMatch);
+    CHECK(luminances[(7 - 2) * extent.x + (7 - 4)].Count() == 2);
+    CHECK(luminances[(3 - 2) * extent.x + (5 - 4)].Count() == 1);
+}
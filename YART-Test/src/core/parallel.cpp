@@ -0,0 +1,149 @@
+#include <catch_amalgamated.hpp>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <yart.h>
+
+using namespace yart;
+
+TEST_CASE("ParallelFor", "[parallel]")
+{
+    i64 count = GENERATE(0, 1, 7, 10000);
+    i64 chunkSize = GENERATE(1, 16, 100000);
+
+    std::vector<std::atomic<i32>> visited(count);
+    for (std::atomic<i32>& v : visited)
+        v = 0;
+
+    ParallelFor([&](i64 i) { visited[i]++; }, count, chunkSize);
+
+    bool allVisitedOnce = true;
+    for (const std::atomic<i32>& v : visited)
+        if (v != 1)
+            allVisitedOnce = false;
+
+    CHECK(allVisitedOnce);
+}
+
+TEST_CASE("AtomicReal", "[parallel]")
+{
+    AtomicReal sum;
+    ParallelFor([&](i64 i) { sum.Add(1); }, 1000);
+    CHECK((real)sum == 1000);
+}
+
+TEST_CASE("Thread pool sizes", "[parallel]")
+{
+    i32 numThreads = GENERATE(1, 2, 5);
+    SetNumThreads(numThreads);
+    CHECK(NumThreads() == numThreads);
+
+    std::vector<std::atomic<i32>> visited(1000);
+    for (std::atomic<i32>& v : visited)
+        v = 0;
+    ParallelFor([&](i64 i) { visited[i]++; }, 1000, 7);
+
+    bool allVisitedOnce = true;
+    for (const std::atomic<i32>& v : visited)
+        if (v != 1)
+            allVisitedOnce = false;
+    CHECK(allVisitedOnce);
+
+    SetNumThreads(0);
+    CHECK(NumThreads() == NumSystemCores());
+}
+
+TEST_CASE("Nested ParallelFor", "[parallel]")
+{
+    // Threads waiting for an inner loop run chunks of other loops, which must not keep any loop from completing
+    SetNumThreads(4);
+    std::vector<std::atomic<i32>> visited(64 * 64);
+    for (std::atomic<i32>& v : visited)
+        v = 0;
+
+    ParallelFor([&](i64 i) { ParallelFor([&](i64 j) { visited[i * 64 + j]++; }, 64, 3); }, 64);
+
+    bool allVisitedOnce = true;
+    for (const std::atomic<i32>& v : visited)
+        if (v != 1)
+            allVisitedOnce = false;
+    CHECK(allVisitedOnce);
+    SetNumThreads(0);
+}
+
+TEST_CASE("Waiting for other threads", "[parallel]")
+{
+    // The calling thread finishes its own chunks long before the other threads and has to sleep rather than spin until they
+    // are done, so the process uses hardly any CPU time
+    SetNumThreads(4);
+    const std::thread::id caller = std::this_thread::get_id();
+    std::clock_t start = std::clock();
+
+    // clang-format off
+    ParallelFor([&](i64) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::this_thread::get_id() == caller ? 5 : 200));
+    }, 8);
+    // clang-format on
+
+    CHECK((real)(std::clock() - start) / CLOCKS_PER_SEC < 0.05f);
+    SetNumThreads(0);
+}
+
+TEST_CASE("ParallelFor2D", "[parallel]")
+{
+    Vector2i count = GENERATE(Vector2i{0, 5}, Vector2i{1, 1}, Vector2i{17, 9});
+    std::vector<std::atomic<i32>> visited(count.x * count.y);
+    for (std::atomic<i32>& v : visited)
+        v = 0;
+
+    ParallelFor2D([&](Vector2i p) { visited[p.y * count.x + p.x]++; }, count, 4);
+
+    bool allVisitedOnce = true;
+    for (const std::atomic<i32>& v : visited)
+        if (v != 1)
+            allVisitedOnce = false;
+    CHECK(allVisitedOnce);
+}
+
+TEST_CASE("ParallelReduce", "[parallel]")
+{
+    i64 count = GENERATE(0, 1, 1000, 100001);
+    i64 chunkSize = GENERATE(1, 64);
+
+    i64 sum = ParallelReduce(count, chunkSize, (i64)0, [](i64 i) { return i; }, [](i64 a, i64 b) { return a + b; });
+    CHECK(sum == count * (count - 1) / 2);
+
+    // Chunks are combined in order, so non-commutative operations work too
+    std::string digits = ParallelReduce(
+        std::min(count, (i64)1000), chunkSize, std::string{}, [](i64 i) { return std::to_string(i % 10); },
+        [](const std::string& a, const std::string& b) { return a + b; });
+    bool inOrder = true;
+    for (u64 i = 0; i < digits.size(); i++)
+        if (digits[i] != '0' + (char)(i % 10))
+            inOrder = false;
+    CHECK(digits.size() == (u64)std::min(count, (i64)1000));
+    CHECK(inOrder);
+}
+
+TEST_CASE("Traversal counters of exiting workers", "[parallel]")
+{
+    // Workers add their counts to the total when they exit, whether the pool is replaced or destroyed at process exit. Slow
+    // chunks make sure every worker gets to run some of them, even on a single core
+    auto countQueries = [](i64 i) {
+        LocalTraversalCounters().m_RayQueries++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+
+    SetNumThreads(4);
+    ResetTraversalCounters();
+    ParallelFor(countQueries, 100, 1);
+    CHECK(GatherTraversalCounters().m_RayQueries == 100);
+
+    SetNumThreads(2);
+    CHECK(GatherTraversalCounters().m_RayQueries == 100);
+
+    // The pool is left running with the counters of its workers registered, so that they exit while statics are destroyed
+    SetNumThreads(4);
+    ParallelFor(countQueries, 100, 1);
+    CHECK(GatherTraversalCounters().m_RayQueries == 200);
+}
@@ -0,0 +1,42 @@
+#include "testutil.h"
+#include <catch_amalgamated.hpp>
+#include <yart.h>
+
+using namespace yart;
+using Catch::Approx;
+
+TEST_CASE("Variance estimator", "[variance]")
+{
+    PCG32Random rng(1);
+    std::vector<real> values;
+    for (i32 i = 0; i < 1000; i++)
+        values.push_back(rng.UniformFloat() * 4 + 10);
+
+    real mean = 0;
+    for (real value : values)
+        mean += value / values.size();
+    real variance = 0;
+    for (real value : values)
+        variance += (value - mean) * (value - mean) / (values.size() - 1);
+
+    VarianceEstimator estimator;
+    CHECK(estimator.Variance() == 0);
+    for (real value : values)
+        estimator.Add(value);
+    CHECK(estimator.Count() == 1000);
+    CHECK(estimator.Mean() == Approx(mean));
+    CHECK(estimator.Variance() == Approx(variance).epsilon(1e-3));
+
+    // Estimators of parts of the values merge into the estimator of all of them
+    VarianceEstimator first, second, empty;
+    for (i32 i = 0; i < 300; i++)
+        first.Add(values[i]);
+    for (i32 i = 300; i < 1000; i++)
+        second.Add(values[i]);
+    first.Merge(empty);
+    first.Merge(second);
+    empty.Merge(first);
+    CHECK(empty.Count() == 1000);
+    CHECK(empty.Mean() == Approx(mean));
+    CHECK(empty.Variance() == Approx(variance).epsilon(1e-3));
+}
@@ -0,0 +1,162 @@
+#include "testutil.h"
+#include <catch_amalgamated.hpp>
+#include <filesystem>
+#include <fstream>
+#include <yart.h>
+
+using namespace yart;
+
+namespace
+{
+    class ConstantIntegrator final : public SamplerIntegrator<RGBSpectrum>
+    {
+    public:
+        using SamplerIntegrator::SamplerIntegrator;
+
+        virtual RGBSpectrum Li(const Ray& ray, const Scene& scene, AbstractSampler& sampler, MemoryArena& arena,
+                               i32 depth = 0) const override
+        {
+            return RGBSpectrum::FromRGB({1, 1, 1});
+        }
+    };
+
+    // Uniform noise around 1 in the left half of the screen, a constant 1 in the right half
+    class HalfNoisyIntegrator final : public SamplerIntegrator<RGBSpectrum>
+    {
+    public:
+        using SamplerIntegrator::SamplerIntegrator;
+
+        virtual RGBSpectrum Li(const Ray& ray, const Scene& scene, AbstractSampler& sampler, MemoryArena& arena,
+                               i32 depth = 0) const override
+        {
+            real value = ray.o.x < 0 ? 2 * sampler.Get1D() : 1;
+            return RGBSpectrum::FromRGB({value, value, value});
+        }
+    };
+}
+
+TEST_CASE("Tiled rendering", "[integrators]")
+{
+    // A resolution that is not a multiple of the tile size leaves partial tiles along the right and bottom edges
+    const i64 samplesPerPixel = 3;
+    RenderFixture fixture({37, 21}, samplesPerPixel, "yart_tiled_rendering");
+    const std::filesystem::path statistics = std::filesystem::path(fixture.m_Filename).replace_extension(".stats.json");
+    std::filesystem::remove(statistics);
+
+    ConstantIntegrator integrator(fixture.m_Camera, fixture.m_Sampler);
+    integrator.Render(fixture.m_Scene);
+    CHECK(fixture.AllPixelsSampled(samplesPerPixel));
+
+    // Statistics are only written when asked for
+    CHECK(!std::filesystem::exists(statistics));
+    integrator.SetWriteStatistics(true);
+    integrator.Render(fixture.m_Scene);
+    CHECK(std::filesystem::exists(statistics));
+
+    std::filesystem::remove(statistics);
+}
+
+TEST_CASE("Progressive rendering", "[integrators]")
+{
+    const i64 samplesPerPixel = 5;
+    RenderFixture fixture({37, 21}, samplesPerPixel, "yart_progressive_rendering");
+    ConstantIntegrator integrator(fixture.m_Camera, fixture.m_Sampler);
+
+    ProgressiveParameters parameters;
+    parameters.m_SamplesPerPass = 2;
+
+    SECTION("Target samples per pixel")
+    {
+        // The last pass only takes the samples that are left
+        integrator.SetProgressiveParameters(parameters);
+        integrator.Render(fixture.m_Scene);
+        CHECK(integrator.SamplesPerPixelTaken() == samplesPerPixel);
+        CHECK(fixture.AllPixelsSampled(samplesPerPixel));
+    }
+
+    SECTION("Time budget")
+    {
+        // No pass fits in the budget, so only the first one is rendered
+        parameters.m_TimeBudget = 1e-9;
+        integrator.SetProgressiveParameters(parameters);
+        integrator.Render(fixture.m_Scene);
+        CHECK(integrator.SamplesPerPixelTaken() == parameters.m_SamplesPerPass);
+        CHECK(fixture.AllPixelsSampled(parameters.m_SamplesPerPass));
+    }
+
+    // Every pixel is evenly sampled, whichever pass the render stopped after
+    bool allPixelsWhite = true;
+    for (Vector2i pixel : fixture.m_Film.m_CroppedPixelBounds)
+        for (real value : fixture.m_Film.GetPixelRGB(pixel))
+            if (value != Catch::Approx(1).margin(1e-3))
+                allPixelsWhite = false;
+    CHECK(allPixelsWhite);
+}
+
+TEST_CASE("Adaptive sampling", "[integrators]")
+{
+    // The noisy half never converges within the samples of the sampler, the constant half does with the first pass
+    const Vector2i resolution{36, 20};
+    const i64 numPixels = resolution.x * resolution.y;
+    const i64 maxSamplesPerPixel = 64;
+    RenderFixture fixture(resolution, maxSamplesPerPixel, "yart_adaptive_sampling");
+    HalfNoisyIntegrator integrator(fixture.m_Camera, fixture.m_Sampler);
+
+    AdaptiveParameters adaptive;
+    adaptive.m_ErrorThreshold = 0.05;
+    adaptive.m_MinSamplesPerPixel = 8;
+    i64 noisySamples = 0;
+
+    SECTION("Samples of the sampler in every pixel")
+    {
+        integrator.SetAdaptiveParameters(adaptive);
+        integrator.Render(fixture.m_Scene);
+        noisySamples = maxSamplesPerPixel;
+        CHECK(integrator.SamplesPerPixelTaken() == (8 + maxSamplesPerPixel) / 2);
+    }
+
+    SECTION("Average sample budget")
+    {
+        // The samples the constant half leaves are spent on the noisy half
+        adaptive.m_SamplesPerPixel = 16;
+        integrator.SetAdaptiveParameters(adaptive);
+        integrator.Render(fixture.m_Scene);
+        noisySamples = 24;
+        CHECK(integrator.SamplesPerPixelTaken() == 16);
+    }
+
+    i64 numConverged = 0, numNoisy = 0;
+    for (const std::atomic<i32>& count : fixture.m_SampleCounts)
+    {
+        if (count == 8)
+            numConverged++;
+        else if (count == noisySamples)
+            numNoisy++;
+    }
+    CHECK(numConverged == numPixels / 2);
+    CHECK(numNoisy == numPixels / 2);
+
+    // Pixels in the constant half are exactly 1, however many samples they got
+    i64 numWhite = 0;
+    Film& film = fixture.m_Film;
+    for (Vector2i pixel : film.m_CroppedPixelBounds)
+        if (film.GetPixelLuminance(pixel).Variance() == 0 && film.GetPixelRGB(pixel)[1] == Catch::Approx(1).margin(1e-3))
+            numWhite++;
+    CHECK(numWhite == numPixels / 2);
+}
+
+TEST_CASE("Render statistics escape the image path", "[integrators]")
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "yart-statistics-test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    const std::filesystem::path image = directory / "a \"quoted\"\\\tname.exr";
+    WriteRenderStatistics(image.string(), "", 1, 4);
+
+    std::ifstream file(std::filesystem::path(image).replace_extension(".stats.json"));
+    std::string statistics((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK(statistics.find("a \\\"quoted\\\"\\\\\\tname.exr\", ") != std::string::npos);
+
+    std::filesystem::remove_all(directory);
+}
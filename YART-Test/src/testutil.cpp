@@ -1,4 +1,5 @@
 #include "testutil.h"
+#include <filesystem>
 using namespace Catch;
 
 bool Vector3fAreEqual(const Vector3f& v1, const Vector3f& v2)
@@ -42,3 +43,189 @@ bool Bounds3fAreEqual(const Bounds3f& b1, const Bounds3f& b2)
 {
     return Vector3fAreEqual(b1.m_MinBound, b2.m_MinBound) && Vector3fAreEqual(b1.m_MaxBound, b2.m_MaxBound);
 }
+
+Ref<AbstractPrimitive<RGBSpectrum>> SphereFactory::Create(const Vector3f& center, real radius)
+{
+    Transform& objectToWorld = m_Transforms.emplace_back(Translate(center));
+    Transform& worldToObject = m_Transforms.emplace_back(Inverse(objectToWorld));
+    auto sphere = CreateRef<Sphere>(&objectToWorld, &worldToObject, false, radius, -radius, radius, 360);
+    return CreateRef<GeometricPrimitive<RGBSpectrum>>(sphere);
+}
+
+void SphereFactory::Move(i32 index, const Vector3f& center)
+{
+    m_Transforms[2 * index] = Translate(center);
+    m_Transforms[2 * index + 1] = Inverse(m_Transforms[2 * index]);
+}
+
+CountingSampler::CountingSampler(i64 samplesPerPixel, u64 seed, std::vector<std::atomic<i32>>* sampleCounts, i32 width)
+    : PCG32Sampler(samplesPerPixel, seed), m_SampleCounts(sampleCounts), m_Width(width)
+{
+}
+
+real CountingSampler::Get1D()
+{
+    return m_RNG.UniformFloat();
+}
+
+Vector2f CountingSampler::Get2D()
+{
+    return {m_RNG.UniformFloat(), m_RNG.UniformFloat()};
+}
+
+bool CountingSampler::StartNextSample()
+{
+    (*m_SampleCounts)[m_CurrentPixel.y * m_Width + m_CurrentPixel.x]++;
+    return AbstractSampler::StartNextSample();
+}
+
+Scope<AbstractSampler> CountingSampler::Clone(u64 seed)
+{
+    return CreateScope<CountingSampler>(m_SamplesPerPixel, seed, m_SampleCounts, m_Width);
+}
+
+RenderFixture::RenderFixture(const Vector2i& resolution, i64 samplesPerPixel, const std::string& name)
+    : m_Filename((std::filesystem::temp_directory_path() / (name + ".exr")).string()),
+      m_Film(resolution, Bounds2f{{0, 0}, {1, 1}}, CreateScope<BoxFilter>(Vector2f{0.5, 0.5}), 0.1, m_Filename, 1),
+      m_Camera(CreateRef<OrthographicCamera>(Transform{}, Bounds2f{{-5, -5}, {5, 5}}, &m_Film)),
+      m_SampleCounts(resolution.x * resolution.y),
+      m_Sampler(CreateRef<CountingSampler>(samplesPerPixel, 0, &m_SampleCounts, resolution.x)),
+      m_Scene(m_Factory.Create({0, 0, 5}, 1))
+{
+}
+
+RenderFixture::~RenderFixture()
+{
+    std::filesystem::remove(m_Filename);
+}
+
+bool RenderFixture::AllPixelsSampled(i64 count) const
+{
+    for (const std::atomic<i32>& sampleCount : m_SampleCounts)
+        if (sampleCount != count)
+            return false;
+
+    return true;
+}
+
+std::vector<Vector3f> RandomPoints(i32 count, real extent, u64 seed)
+{
+    PCG32Random rng(seed);
+    std::vector<Vector3f> points(count);
+    for (Vector3f& point : points)
+        point = Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * extent;
+
+    return points;
+}
+
+std::vector<Bounds3f> RandomBoxes(i32 count, real extent, real minSize, real maxSize, u64 seed)
+{
+    PCG32Random rng(seed);
+    std::vector<Bounds3f> boxes(count);
+    for (Bounds3f& box : boxes)
+    {
+        Vector3f lowerBound = Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * extent;
+        Vector3f size = Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * (maxSize - minSize) +
+                        Vector3f{minSize, minSize, minSize};
+        box = Bounds3f{lowerBound, lowerBound + size};
+    }
+
+    return boxes;
+}
+
+bool MatchesBruteForce(const AbstractPrimitive<RGBSpectrum>& aggregate,
+                       const std::vector<Ref<AbstractPrimitive<RGBSpectrum>>>& primitives, real extent)
+{
+    PCG32Random rng(7);
+    for (i32 i = 0; i < 500; i++)
+    {
+        Vector3f origin{rng.UniformFloat() * extent, rng.UniformFloat() * extent, -1};
+        Vector3f target{rng.UniformFloat() * extent, rng.UniformFloat() * extent, extent + 1};
+        Ray ray(origin, Normalize(target - origin));
+
+        MaterialInteraction<RGBSpectrum> materialInteraction;
+        Ray bruteForceRay = ray;
+        for (const Ref<AbstractPrimitive<RGBSpectrum>>& primitive : primitives)
+            if (primitive)
+                primitive->IntersectRay(bruteForceRay, &materialInteraction);
+        bool expectedHit = bruteForceRay.m_Tmax != Infinity;
+
+        Ray closestRay = ray;
+        bool hit = aggregate.IntersectRay(closestRay, &materialInteraction);
+        if (hit != expectedHit || aggregate.IntersectRay(ray) != hit)
+            return false;
+        if (hit && closestRay.m_Tmax != Approx(bruteForceRay.m_Tmax))
+            return false;
+    }
+
+    return true;
+}
+
+static bool PointsAgree(const Vector3f& point, const Vector3f& referencePoint, real tolerance)
+{
+    if (tolerance == 0)
+        return Vector3fAreEqual(point, referencePoint);
+    return Norm(point - referencePoint) <= tolerance * (1 + Norm(referencePoint));
+}
+
+bool MatchesReference(const AbstractPrimitive<RGBSpectrum>& aggregate, const AbstractPrimitive<RGBSpectrum>& reference,
+                      const Bounds3f& origins, real maxLength, real tolerance)
+{
+    PCG32Random rng(3);
+    const i32 numRays = 64 * MaxRayPacketSize;
+    std::vector<Ray> rays(numRays);
+    for (Ray& ray : rays)
+    {
+        Vector3f o = origins.Lerp(Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()));
+        Vector3f d = Normalize(Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) - Vector3f{0.5, 0.5, 0.5});
+        ray = Ray(o, d, maxLength == Infinity ? Infinity : maxLength * rng.UniformFloat());
+    }
+
+    std::vector<MaterialInteraction<RGBSpectrum>> referenceInteractions(numRays), materialInteractions(numRays);
+    Scope<bool[]> referenceHits = CreateScope<bool[]>(numRays);
+    for (i32 i = 0; i < numRays; i++)
+    {
+        Ray referenceRay = rays[i];
+        referenceHits[i] = reference.IntersectRay(referenceRay, &referenceInteractions[i]);
+
+        Ray ray = rays[i];
+        bool hit = aggregate.IntersectRay(ray, &materialInteractions[i]);
+        if (hit != referenceHits[i] || aggregate.IntersectRay(Ray(rays[i])) != hit)
+            return false;
+        if (hit && !PointsAgree(materialInteractions[i].m_Point, referenceInteractions[i].m_Point, tolerance))
+            return false;
+    }
+
+    for (i32 first = 0; first < numRays; first += MaxRayPacketSize)
+    {
+        std::vector<Ray> packet(rays.begin() + first, rays.begin() + first + MaxRayPacketSize);
+        std::vector<Ray> occlusionPacket = packet;
+        u32 hitMask = aggregate.IntersectPacket(packet.data(), MaxRayPacketSize, &materialInteractions[first]);
+        if (hitMask != aggregate.IntersectPacket(occlusionPacket.data(), MaxRayPacketSize))
+            return false;
+        for (i32 i = 0; i < MaxRayPacketSize; i++)
+        {
+            bool hit = hitMask & (1u << i);
+            if (hit != referenceHits[first + i])
+                return false;
+            if (hit && !PointsAgree(materialInteractions[first + i].m_Point, referenceInteractions[first + i].m_Point, tolerance))
+                return false;
+        }
+    }
+
+    std::vector<Ray> stream = rays;
+    std::vector<Ray> occlusionStream = rays;
+    Scope<bool[]> hits = CreateScope<bool[]>(numRays);
+    Scope<bool[]> anyHits = CreateScope<bool[]>(numRays);
+    aggregate.IntersectStream(stream.data(), numRays, materialInteractions.data(), hits.get());
+    aggregate.IntersectStream(occlusionStream.data(), numRays, anyHits.get());
+    for (i32 i = 0; i < numRays; i++)
+    {
+        if (hits[i] != referenceHits[i] || anyHits[i] != referenceHits[i])
+            return false;
+        if (hits[i] && !PointsAgree(materialInteractions[i].m_Point, referenceInteractions[i].m_Point, tolerance))
+            return false;
+    }
+
+    return true;
+}
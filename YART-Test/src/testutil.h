@@ -1,9 +1,75 @@
 #pragma once
 #include <catch_amalgamated.hpp>
+#include <deque>
 #include <yart.h>
 using namespace yart;
 
 bool Vector3fAreEqual(const Vector3f& v1, const Vector3f& v2);
 bool Vector2fAreEqual(const Vector2f& v1, const Vector2f& v2);
 bool MatrixAreEqual(const Matrix4x4& m1, const Matrix4x4& m2);
-bool Bounds3fAreEqual(const Bounds3f& b1, const Bounds3f& b2);
\ No newline at end of file
+bool Bounds3fAreEqual(const Bounds3f& b1, const Bounds3f& b2);
+
+// Creates sphere primitives. Spheres keep pointers to their transforms, so the transforms live in a deque that never moves them
+class SphereFactory
+{
+public:
+    Ref<AbstractPrimitive<RGBSpectrum>> Create(const Vector3f& center, real radius);
+
+    // Moves the sphere created by the index-th call to Create()
+    void Move(i32 index, const Vector3f& center);
+
+private:
+    std::deque<Transform> m_Transforms;
+};
+
+// Counts the samples taken in every pixel, over all clones
+class CountingSampler final : public PCG32Sampler
+{
+public:
+    CountingSampler(i64 samplesPerPixel, u64 seed, std::vector<std::atomic<i32>>* sampleCounts, i32 width);
+
+    virtual real Get1D() override;
+    virtual Vector2f Get2D() override;
+    virtual bool StartNextSample() override;
+    virtual Scope<AbstractSampler> Clone(u64 seed) override;
+
+private:
+    std::vector<std::atomic<i32>>* m_SampleCounts;
+    const i32 m_Width;
+};
+
+// A film with a box filter seen through an orthographic camera, a sampler counting the samples of every pixel and a scene
+// holding a single sphere. The image is named after name in the temporary directory and removed along with the fixture
+struct RenderFixture
+{
+    RenderFixture(const Vector2i& resolution, i64 samplesPerPixel, const std::string& name);
+    ~RenderFixture();
+
+    // Whether every pixel took count samples
+    bool AllPixelsSampled(i64 count) const;
+
+    std::string m_Filename;
+    Film m_Film;
+    Ref<AbstractCamera> m_Camera;
+    std::vector<std::atomic<i32>> m_SampleCounts;
+    Ref<AbstractSampler> m_Sampler;
+    SphereFactory m_Factory;
+    Scene<RGBSpectrum> m_Scene;
+};
+
+// Points uniformly distributed in [0, extent]^3
+std::vector<Vector3f> RandomPoints(i32 count, real extent, u64 seed);
+
+// Boxes with lower corners uniformly distributed in [0, extent]^3 and side lengths uniformly distributed in [minSize, maxSize]
+std::vector<Bounds3f> RandomBoxes(i32 count, real extent, real minSize, real maxSize, u64 seed);
+
+// Checks that the aggregate finds the same closest hits and occlusion as testing every primitive, for random rays crossing
+// [0, extent]^3 along z. Null primitives are skipped
+bool MatchesBruteForce(const AbstractPrimitive<RGBSpectrum>& aggregate,
+                       const std::vector<Ref<AbstractPrimitive<RGBSpectrum>>>& primitives, real extent);
+
+// Checks that the aggregate finds the same closest hits and occlusion as a reference aggregate, one ray at a time, in packets
+// and in a stream. The rays start in origins and go in every direction, with random lengths up to maxLength. Hit points are
+// compared with Approx, or allowed to differ by tolerance relative to their magnitude if it is not 0
+bool MatchesReference(const AbstractPrimitive<RGBSpectrum>& aggregate, const AbstractPrimitive<RGBSpectrum>& reference,
+                      const Bounds3f& origins, real maxLength = Infinity, real tolerance = 0);